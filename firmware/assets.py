@@ -0,0 +1,129 @@
+"""Packs web-app/dist into the image the firmware maps from the assets partition.
+
+The layout is described in src/assets.hpp: a header, a table of fixed size
+entries sorted by path and then the file contents. A file ending in .gz is
+served under its name without the suffix with Content-Encoding: gzip.
+
+Run by PlatformIO as an extra script, it adds the `uploadassets` target:
+
+    pio run -e inkplate-10 -t uploadassets
+
+or on its own to only write the image:
+
+    python assets.py ../web-app/dist assets.bin
+"""
+
+import csv
+import os
+import struct
+import sys
+
+MAGIC = 0x54534149  # "IAST"
+VERSION = 1
+SUBTYPE = 0x40
+LABEL = "assets"
+GZIP = 0x1
+
+HEADER = struct.Struct("<IHHII")
+ENTRY = struct.Struct("<56s32s24sIIII")
+
+TYPES = {
+    ".html": "text/html",
+    ".js": "text/javascript",
+    ".css": "text/css",
+    ".woff2": "font/woff2",
+    ".png": "image/png",
+    ".svg": "image/svg+xml",
+    ".json": "application/json",
+}
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def collect(root):
+    """Maps each URI path to (file, flags), preferring the gzip variant."""
+    files = {}
+    for parent, _, names in os.walk(root):
+        for name in names:
+            full = os.path.join(parent, name)
+            path = "/" + os.path.relpath(full, root).replace(os.sep, "/")
+            flags = 0
+            if path.endswith(".gz"):
+                path = path[:-3]
+                flags = GZIP
+            if path in files and not flags:
+                continue
+            files[path] = (full, flags)
+    return files
+
+
+def pack(root):
+    files = collect(root)
+    paths = sorted(files, key=lambda p: p.encode())
+    offset = HEADER.size + ENTRY.size * len(paths)
+    table = b""
+    data = b""
+    for path in paths:
+        full, flags = files[path]
+        with open(full, "rb") as f:
+            content = f.read()
+        if len(path.encode()) >= 56:
+            raise ValueError("path too long for the asset table: " + path)
+        mime = TYPES.get(os.path.splitext(path)[1], "application/octet-stream")
+        etag = '"%x-%x"' % (len(content), fnv1a(content))
+        table += ENTRY.pack(path.encode(), mime.encode(), etag.encode(), offset + len(data), len(content), flags, 0)
+        data += content
+    size = offset + len(data)
+    return HEADER.pack(MAGIC, VERSION, len(paths), size, 0) + table + data
+
+
+def partition_offset(csv_path):
+    with open(csv_path) as f:
+        for row in csv.reader(line for line in f if not line.startswith("#")):
+            row = [col.strip() for col in row]
+            if row and row[0] == LABEL:
+                return int(row[3], 0), int(row[4], 0)
+    raise ValueError("no %s partition in %s" % (LABEL, csv_path))
+
+
+def write_image(root, out, limit=None):
+    image = pack(root)
+    if limit is not None and len(image) > limit:
+        raise ValueError("web app image is %d bytes, the partition %d" % (len(image), limit))
+    with open(out, "wb") as f:
+        f.write(image)
+    print("Packed %s into %s (%d bytes)" % (root, out, len(image)))
+
+
+try:
+    Import("env")  # noqa: F821
+except NameError:
+    env = None
+
+if env is not None:
+    def upload_assets(source, target, env):
+        offset, size = partition_offset(os.path.join(env.subst("$PROJECT_DIR"), "partitions.csv"))
+        image = os.path.join(env.subst("$BUILD_DIR"), LABEL + ".bin")
+        write_image(env.subst("$PROJECT_DATA_DIR"), image, size)
+        env.AutodetectUploadPort()
+        return env.Execute(
+            '"$PYTHONEXE" "$UPLOADER" --chip esp32 --port "$UPLOAD_PORT" --baud $UPLOAD_SPEED write_flash 0x%x "%s"'
+            % (offset, image)
+        )
+
+    env.AddCustomTarget(
+        name="uploadassets",
+        dependencies=None,
+        actions=[upload_assets],
+        title="Upload web app",
+        description="Pack web-app/dist and write it to the assets partition",
+    )
+elif __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("usage: assets.py DIST_DIR IMAGE")
+    write_image(sys.argv[1], sys.argv[2])
@@ -0,0 +1,1181 @@
+// Host benchmark for firmware/src.
+//
+// Runs the firmware code against the stand-ins in host/ on a scratch copy of
+// the SD card and web app image, and reports the median time per operation.
+// Inputs are generated from fixed seeds so that numbers from different
+// releases can be compared.
+//
+//   inkart_bench [--photos N] [--filter TEXT] [--json FILE] [--keep]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+#include "inkplate.hpp"
+#include "host_httpd.hpp"
+
+#include "api.hpp"
+#include "assets.hpp"
+#include "base64.hpp"
+#include "dither.hpp"
+#include "download.hpp"
+#include "draw.hpp"
+#include "events.hpp"
+#include "files.hpp"
+#include "frame.hpp"
+#include "image.hpp"
+#include "jpeg.hpp"
+#include "library.hpp"
+#include "metrics.hpp"
+#include "microbench.hpp"
+#include "webapp.hpp"
+
+Inkplate display(DisplayMode::INKPLATE_3BIT);
+
+namespace
+{
+  struct Result
+  {
+    std::string name;
+    double median_us;
+    double min_us;
+    double spread;
+    double bytes;
+  };
+
+  struct Options
+  {
+    size_t photos = 200;
+    std::string filter;
+    std::string json;
+    bool keep = false;
+  };
+
+  Options options;
+  std::vector<Result> results;
+
+  using Clock = std::chrono::steady_clock;
+
+  double elapsed_us(Clock::time_point start)
+  {
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  }
+
+  // Each case is calibrated so that one sample lasts at least 50 ms, then
+  // sampled seven times. The median is reported with the spread between the
+  // fastest and slowest sample so noisy runs are easy to spot.
+  void run(const std::string &name, double bytes, const std::function<void()> &fn)
+  {
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+      return;
+
+    fn();
+
+    size_t iterations = 1;
+    for (;;)
+    {
+      auto start = Clock::now();
+      for (size_t i = 0; i < iterations; i++)
+        fn();
+      const double us = elapsed_us(start);
+      if (us >= 50000 || iterations >= (1u << 20))
+        break;
+      iterations = us < 1 ? iterations * 16 : std::max<size_t>(iterations + 1, iterations * 60000 / us);
+    }
+
+    std::vector<double> samples;
+    for (int s = 0; s < 7; s++)
+    {
+      auto start = Clock::now();
+      for (size_t i = 0; i < iterations; i++)
+        fn();
+      samples.push_back(elapsed_us(start) / iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    Result r = {name, samples[3], samples[0], (samples[6] - samples[0]) / samples[3], bytes};
+    results.push_back(r);
+
+    printf("%-40s %12.2f us %12.2f us %6.1f%%", name.c_str(), r.median_us, r.min_us, r.spread * 100);
+    if (bytes > 0)
+      printf(" %10.2f MB/s", bytes / r.median_us);
+    printf("\n");
+    fflush(stdout);
+  }
+
+  uint32_t lcg(uint32_t &state)
+  {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+  }
+
+  void put16(std::string &s, size_t pos, uint16_t v)
+  {
+    s[pos] = v & 0xff;
+    s[pos + 1] = v >> 8;
+  }
+
+  void put32(std::string &s, size_t pos, uint32_t v)
+  {
+    put16(s, pos, v & 0xffff);
+    put16(s, pos + 2, v >> 16);
+  }
+
+  // Same layout as BmpDataView in web-app's Grayscale.svelte: 4-bit,
+  // eight gray palette entries, bottom-up rows.
+  std::string make_bmp(int32_t width, int32_t height, uint32_t seed)
+  {
+    const uint32_t header = 118;
+    const uint32_t stride = ((width * 4 + 31) / 32) * 4;
+    std::string bmp(header + stride * height, '\0');
+
+    bmp[0] = 'B';
+    bmp[1] = 'M';
+    put32(bmp, 2, bmp.size());
+    put32(bmp, 10, header);
+    put32(bmp, 14, 40);
+    put32(bmp, 18, width);
+    put32(bmp, 22, height);
+    put16(bmp, 26, 1);
+    put16(bmp, 28, 4);
+    put32(bmp, 34, stride * height);
+    put32(bmp, 38, 2835);
+    put32(bmp, 42, 2835);
+    put32(bmp, 46, 8);
+    for (int i = 0; i < 8; i++)
+      put32(bmp, 54 + i * 4, 0x00222222 * i);
+
+    uint32_t state = seed;
+    for (int32_t y = 0; y < height; y++)
+    {
+      for (int32_t x = 0; x < width; x++)
+      {
+        const int gradient = (x * 7 / width + y * 7 / height) / 2;
+        const int noise = (lcg(state) & 7) == 0 ? 1 : 0;
+        const uint8_t v = std::min(7, gradient + noise);
+        char &b = bmp[header + y * stride + x / 2];
+        b |= (x & 1) ? v : v << 4;
+      }
+    }
+    return bmp;
+  }
+
+  // The pixels of make_bmp() as a .ink file, PackBits runs per row.
+  std::string make_ink(int32_t width, int32_t height, uint32_t seed)
+  {
+    const std::string bmp = make_bmp(width, height, seed);
+    const uint32_t header = 118;
+    const uint32_t stride = ((width * 4 + 31) / 32) * 4;
+    const size_t packed_len = (width + 1) / 2;
+
+    std::string ink(sizeof(InkHeader), '\0');
+    memcpy(&ink[0], INK_MAGIC, 4);
+    put16(ink, 4, INK_VERSION);
+    put16(ink, 6, width);
+    put16(ink, 8, height);
+
+    for (int32_t y = 0; y < height; y++)
+    {
+      const std::string packed = bmp.substr(header + (height - 1 - y) * stride, packed_len);
+      std::string record(2, '\0');
+      size_t i = 0;
+      while (i < packed.size())
+      {
+        size_t run = 1;
+        while (i + run < packed.size() && run < 128 && packed[i + run] == packed[i])
+          run++;
+        if (run >= 2)
+        {
+          record += char(1 - int(run));
+          record += packed[i];
+          i += run;
+          continue;
+        }
+        size_t n = 1;
+        while (i + n < packed.size() && n < 128 &&
+               !(i + n + 2 < packed.size() && packed[i + n] == packed[i + n + 1] && packed[i + n] == packed[i + n + 2]))
+          n++;
+        record += char(n - 1);
+        record += packed.substr(i, n);
+        i += n;
+      }
+      put16(record, 0, record.size() - 2);
+      ink += record;
+    }
+    return ink;
+  }
+
+  struct JpegLayout
+  {
+    bool color;                // YCbCr with 4:2:0 chroma, else gray
+    bool interleaved;          // one scan for every component, else one scan each
+    uint16_t restart_interval; // MCUs between restart markers, 0 for none
+  };
+
+  // Gray levels of make_jpeg(): a diagonal gradient with some noise, so that
+  // blocks have AC coefficients of every size.
+  uint8_t jpeg_pixel(int32_t x, int32_t y, int32_t width, int32_t height, uint32_t seed)
+  {
+    uint32_t state = seed ^ (uint32_t(y) * 65537u + uint32_t(x));
+    return (x * 223 / width + y * 223 / height) / 2 + (lcg(state) & 31);
+  }
+
+  struct JpegBits
+  {
+    std::string &out;
+    uint32_t acc = 0;
+    int n = 0;
+
+    void put(uint32_t code, int len)
+    {
+      for (int i = len - 1; i >= 0; i--)
+      {
+        acc = acc << 1 | ((code >> i) & 1);
+        if (++n < 8)
+          continue;
+        out += char(acc);
+        if (acc == 0xFF)
+          out += '\0';
+        acc = 0;
+        n = 0;
+      }
+    }
+
+    void flush()
+    {
+      while (n > 0)
+        put(1, 1);
+    }
+  };
+
+  struct JpegTable
+  {
+    uint16_t code[256];
+    uint8_t size[256];
+  };
+
+  void jpeg_table(const uint8_t *counts, const uint8_t *symbols, JpegTable &table)
+  {
+    uint16_t code = 0;
+    for (int len = 1, k = 0; len <= 16; len++, code <<= 1)
+    {
+      for (int i = 0; i < counts[len - 1]; i++, k++, code++)
+      {
+        table.code[symbols[k]] = code;
+        table.size[symbols[k]] = len;
+      }
+    }
+  }
+
+  // Baseline JPEG of jpeg_pixel() as luma, with chroma that the decoder
+  // has to step over. The Huffman tables have the code lengths of Annex K,
+  // so most AC codes are longer than the decoder's lookup table.
+  std::string make_jpeg(int32_t width, int32_t height, uint32_t seed, const JpegLayout &layout)
+  {
+    static const uint8_t dc_counts[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1};
+    static const uint8_t ac_counts[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 125};
+    static const uint8_t ac_short[] = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13,
+        0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42,
+        0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82,
+    };
+    static const uint8_t zigzag[64] = {
+        0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+        12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+        35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+        58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+    };
+    static const uint8_t quant[2] = {2, 8};
+
+    uint8_t dc_symbols[12], ac_symbols[162];
+    for (int i = 0; i < 12; i++)
+      dc_symbols[i] = i;
+    // The 16-bit codes take every symbol the shorter ones leave.
+    size_t k = sizeof(ac_short);
+    memcpy(ac_symbols, ac_short, k);
+    const uint8_t *const ac_short_end = ac_short + sizeof(ac_short);
+    for (int rs = 0; rs < 256; rs++)
+    {
+      if ((rs & 15) >= 1 && (rs & 15) <= 10 && std::find(ac_short, ac_short_end, rs) == ac_short_end)
+        ac_symbols[k++] = rs;
+    }
+    JpegTable dc_table, ac_table;
+    jpeg_table(dc_counts, dc_symbols, dc_table);
+    jpeg_table(ac_counts, ac_symbols, ac_table);
+
+    double cosines[8][8];
+    for (int x = 0; x < 8; x++)
+    {
+      for (int u = 0; u < 8; u++)
+        cosines[x][u] = (u == 0 ? std::sqrt(0.5) : 1.0) / 2 * std::cos((2 * x + 1) * u * M_PI / 16);
+    }
+
+    // Components at their own resolution, edges repeated out to whole MCUs.
+    const int ncomps = layout.color ? 3 : 1;
+    const int hmax = layout.color ? 2 : 1;
+    const int32_t mcus_x = (width + 8 * hmax - 1) / (8 * hmax), mcus_y = (height + 8 * hmax - 1) / (8 * hmax);
+    std::vector<std::vector<uint8_t>> planes(ncomps);
+    int32_t plane_w[3], plane_h[3], stride[3];
+    for (int c = 0; c < ncomps; c++)
+    {
+      const int sub = c == 0 ? 1 : hmax;
+      plane_w[c] = (width + sub - 1) / sub;
+      plane_h[c] = (height + sub - 1) / sub;
+      stride[c] = mcus_x * 8 * hmax / sub;
+      planes[c].resize(size_t(stride[c]) * mcus_y * 8 * hmax / sub);
+      for (int32_t y = 0; y < mcus_y * 8 * hmax / sub; y++)
+      {
+        for (int32_t x = 0; x < stride[c]; x++)
+        {
+          const int32_t px = std::min(x, plane_w[c] - 1), py = std::min(y, plane_h[c] - 1);
+          planes[c][size_t(y) * stride[c] + x] =
+              c == 0 ? jpeg_pixel(px, py, width, height, seed) : 128 + (c == 1 ? 1 : -1) * ((px + py) % 64 - 32);
+        }
+      }
+    }
+
+    std::string jpeg = "\xFF\xD8";
+    const auto segment = [&](uint8_t marker, const std::string &body)
+    {
+      jpeg += '\xFF';
+      jpeg += char(marker);
+      jpeg += char((body.size() + 2) >> 8);
+      jpeg += char((body.size() + 2) & 0xff);
+      jpeg += body;
+    };
+    std::string body;
+    for (int t = 0; t < 2; t++)
+    {
+      body += char(t);
+      body.append(64, char(quant[t]));
+    }
+    segment(0xDB, body);
+    body = {char(8), char(height >> 8), char(height & 0xff), char(width >> 8), char(width & 0xff), char(ncomps)};
+    for (int c = 0; c < ncomps; c++)
+    {
+      body += char(1 + c);
+      body += char(c == 0 ? hmax << 4 | hmax : 0x11);
+      body += char(c == 0 ? 0 : 1);
+    }
+    segment(0xC0, body);
+    body.clear();
+    for (int t = 0; t < 2; t++)
+    {
+      body += char(t);
+      body.append(reinterpret_cast<const char *>(dc_counts), 16);
+      body.append(reinterpret_cast<const char *>(dc_symbols), 12);
+      body += char(0x10 | t);
+      body.append(reinterpret_cast<const char *>(ac_counts), 16);
+      body.append(reinterpret_cast<const char *>(ac_symbols), 162);
+    }
+    segment(0xC4, body);
+    if (layout.restart_interval > 0)
+      segment(0xDD, {char(layout.restart_interval >> 8), char(layout.restart_interval & 0xff)});
+
+    int pred[3];
+    JpegBits bits = {jpeg};
+    const auto encode_block = [&](int c, int32_t bx, int32_t by)
+    {
+      double coef[64];
+      for (int v = 0; v < 8; v++)
+      {
+        for (int u = 0; u < 8; u++)
+        {
+          double sum = 0;
+          for (int y = 0; y < 8; y++)
+          {
+            const uint8_t *row = &planes[c][size_t(by * 8 + y) * stride[c] + bx * 8];
+            for (int x = 0; x < 8; x++)
+              sum += (row[x] - 128) * cosines[x][u] * cosines[y][v];
+          }
+          coef[v * 8 + u] = sum;
+        }
+      }
+      int zz[64];
+      for (int i = 0; i < 64; i++)
+        zz[i] = int(std::lround(coef[zigzag[i]] / quant[c == 0 ? 0 : 1]));
+
+      const auto magnitude = [](int v)
+      {
+        int s = 0;
+        for (int a = std::abs(v); a > 0; a >>= 1)
+          s++;
+        return s;
+      };
+      const int diff = zz[0] - pred[c];
+      pred[c] = zz[0];
+      int s = magnitude(diff);
+      bits.put(dc_table.code[s], dc_table.size[s]);
+      bits.put(diff < 0 ? diff - 1 : diff, s);
+      int run = 0;
+      for (int i = 1; i < 64; i++)
+      {
+        if (zz[i] == 0)
+        {
+          run++;
+          continue;
+        }
+        for (; run >= 16; run -= 16)
+          bits.put(ac_table.code[0xF0], ac_table.size[0xF0]);
+        s = magnitude(zz[i]);
+        bits.put(ac_table.code[run << 4 | s], ac_table.size[run << 4 | s]);
+        bits.put(zz[i] < 0 ? zz[i] - 1 : zz[i], s);
+        run = 0;
+      }
+      if (run > 0)
+        bits.put(ac_table.code[0], ac_table.size[0]);
+    };
+    const auto scan = [&](const std::vector<int> &comps, int32_t count, const std::function<void(int32_t)> &mcu)
+    {
+      body = {char(comps.size())};
+      for (int c : comps)
+      {
+        body += char(1 + c);
+        body += char(c == 0 ? 0x00 : 0x11);
+      }
+      body += {char(0), char(63), char(0)};
+      segment(0xDA, body);
+      pred[0] = pred[1] = pred[2] = 0;
+      for (int32_t i = 0; i < count; i++)
+      {
+        if (i > 0 && layout.restart_interval > 0 && i % layout.restart_interval == 0)
+        {
+          bits.flush();
+          jpeg += '\xFF';
+          jpeg += char(0xD0 + (i / layout.restart_interval - 1) % 8);
+          pred[0] = pred[1] = pred[2] = 0;
+        }
+        mcu(i);
+      }
+      bits.flush();
+    };
+
+    if (layout.interleaved)
+    {
+      std::vector<int> comps;
+      for (int c = 0; c < ncomps; c++)
+        comps.push_back(c);
+      scan(comps, mcus_x * mcus_y, [&](int32_t i)
+           {
+             for (int c = 0; c < ncomps; c++)
+             {
+               const int n = c == 0 ? hmax : 1;
+               for (int by = 0; by < n; by++)
+               {
+                 for (int bx = 0; bx < n; bx++)
+                   encode_block(c, i % mcus_x * n + bx, i / mcus_x * n + by);
+               }
+             }
+           });
+    }
+    else
+    {
+      // Chroma first, so that the decoder steps over whole scans before the
+      // one it needs.
+      for (int c = ncomps - 1; c >= 0; c--)
+      {
+        const int32_t blocks_x = (plane_w[c] + 7) / 8;
+        scan({c}, blocks_x * ((plane_h[c] + 7) / 8), [&](int32_t i)
+             { encode_block(c, i % blocks_x, i / blocks_x); });
+      }
+    }
+    jpeg += "\xFF\xD9";
+    return jpeg;
+  }
+
+  // ustar archive of the given files, as `tar cf` writes it.
+  std::string make_tar(const std::vector<std::pair<std::string, std::string>> &files)
+  {
+    std::string tar;
+    for (const auto &file : files)
+    {
+      char header[512] = {};
+      snprintf(header, 100, "%s", file.first.c_str());
+      snprintf(header + 100, 8, "%07o", 0644);
+      snprintf(header + 124, 12, "%011o", unsigned(file.second.size()));
+      memset(header + 148, ' ', 8);
+      header[156] = '0';
+      memcpy(header + 257, "ustar\0" "00", 8);
+      unsigned sum = 0;
+      for (char c : header)
+        sum += uint8_t(c);
+      snprintf(header + 148, 8, "%06o", sum);
+      tar.append(header, sizeof(header));
+      tar += file.second;
+      tar.append((512 - file.second.size() % 512) % 512, '\0');
+    }
+    tar.append(1024, '\0');
+    return tar;
+  }
+
+  struct AssetFile
+  {
+    std::string path;
+    std::string type;
+    uint32_t flags;
+    std::string content;
+  };
+
+  // Web app image in the layout assets.py packs, files sorted by path.
+  std::string make_assets(std::vector<AssetFile> files)
+  {
+    std::sort(files.begin(), files.end(), [](const AssetFile &a, const AssetFile &b) { return a.path < b.path; });
+    const size_t table_size = sizeof(AssetHeader) + files.size() * sizeof(AssetEntry);
+    std::string image(table_size, '\0');
+    for (size_t i = 0; i < files.size(); i++)
+    {
+      AssetEntry entry = {};
+      snprintf(entry.path, sizeof(entry.path), "%s", files[i].path.c_str());
+      snprintf(entry.type, sizeof(entry.type), "%s", files[i].type.c_str());
+      make_etag(entry.etag, sizeof(entry.etag), files[i].content.size(), uint32_t(i + 1));
+      entry.offset = image.size();
+      entry.length = files[i].content.size();
+      entry.flags = files[i].flags;
+      memcpy(&image[sizeof(AssetHeader) + i * sizeof(AssetEntry)], &entry, sizeof(entry));
+      image += files[i].content;
+    }
+    const AssetHeader header = {ASSETS_MAGIC, ASSETS_VERSION, uint16_t(files.size()), uint32_t(image.size()), 0};
+    memcpy(&image[0], &header, sizeof(header));
+    return image;
+  }
+
+  std::string b64encode(const std::string &data)
+  {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 2 < data.size(); i += 3)
+    {
+      const uint32_t n = uint8_t(data[i]) << 16 | uint8_t(data[i + 1]) << 8 | uint8_t(data[i + 2]);
+      out += table[n >> 18];
+      out += table[(n >> 12) & 63];
+      out += table[(n >> 6) & 63];
+      out += table[n & 63];
+    }
+    if (i < data.size())
+    {
+      uint32_t n = uint8_t(data[i]) << 16;
+      if (i + 1 < data.size())
+        n |= uint8_t(data[i + 1]) << 8;
+      out += table[n >> 18];
+      out += table[(n >> 12) & 63];
+      out += i + 1 < data.size() ? table[(n >> 6) & 63] : '=';
+      out += '=';
+    }
+    return out;
+  }
+
+  void write_file(const std::string &path, const std::string &data)
+  {
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp == nullptr)
+    {
+      perror(path.c_str());
+      exit(1);
+    }
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+  }
+
+  void remove_tree(const std::string &path)
+  {
+    DIR *dir = opendir(path.c_str());
+    if (dir != nullptr)
+    {
+      struct dirent *ent;
+      while ((ent = readdir(dir)) != nullptr)
+      {
+        const std::string name = ent->d_name;
+        if (name == "." || name == "..")
+          continue;
+        remove_tree(path + "/" + name);
+      }
+      closedir(dir);
+      rmdir(path.c_str());
+    }
+    else
+    {
+      unlink(path.c_str());
+    }
+  }
+
+  void init_settings()
+  {
+    nvs_flash_init();
+    nvs_handle_t handle;
+    nvs_open("system_settings", NVS_READWRITE, &handle);
+    nvs_set_i16(handle, "version", 1);
+    nvs_set_u8(handle, "invert", 0);
+    nvs_set_u8(handle, "dithering", 1);
+    nvs_set_u8(handle, "orientation", 0);
+    nvs_set_i16(handle, "padding-top", 0);
+    nvs_set_i16(handle, "padding-left", 0);
+    nvs_set_i16(handle, "padding-right", 0);
+    nvs_set_i16(handle, "padding-bottom", 0);
+    nvs_set_u16(handle, "refresh", 30);
+    nvs_set_u8(handle, "shuffle", 0);
+    nvs_commit(handle);
+    nvs_close(handle);
+  }
+
+  void expect_status(const HostResponse &res, const char *status, const char *what)
+  {
+    if (res.status.compare(0, 3, status) != 0)
+    {
+      fprintf(stderr, "%s: unexpected status %s: %s\n", what, res.status.c_str(), res.body.c_str());
+      exit(1);
+    }
+  }
+
+  void expect_ok(const HostResponse &res, const char *what)
+  {
+    expect_status(res, "200", what);
+  }
+
+  // Follows the job a request handed to the worker until it has finished,
+  // so that its time counts towards the request.
+  void expect_job(httpd_handle_t server, const HostResponse &res, const char *what)
+  {
+    expect_status(res, "202", what);
+    const std::string location = res.header("Location");
+    for (;;)
+    {
+      const auto job = host_httpd_request(server, HTTP_GET, location);
+      expect_ok(job, what);
+      if (job.body.find("\"state\":\"done\"") != std::string::npos)
+        return;
+      if (job.body.find("\"state\":\"failed\"") != std::string::npos)
+      {
+        fprintf(stderr, "%s: job failed: %s\n", what, job.body.c_str());
+        exit(1);
+      }
+      vTaskDelay(1);
+    }
+  }
+
+  void expect_ok(esp_err_t ret, const char *what)
+  {
+    if (ret != ESP_OK)
+    {
+      fprintf(stderr, "%s: %s\n", what, esp_err_to_name(ret));
+      exit(1);
+    }
+  }
+
+  struct JpegRows
+  {
+    const JpegDecoder *decoder;
+    int32_t rows;
+    std::vector<uint8_t> gray;
+  };
+
+  void jpeg_row(void *ctx, int32_t y, const uint8_t *gray)
+  {
+    auto *rows = static_cast<JpegRows *>(ctx);
+    if (y != rows->rows)
+    {
+      fprintf(stderr, "jpeg: row %d after %d rows\n", y, rows->rows);
+      exit(1);
+    }
+    rows->gray.insert(rows->gray.end(), gray, gray + rows->decoder->width());
+    rows->rows++;
+  }
+
+  // Decodes a JPEG fed in pieces of the given size and checks that it came
+  // out at the expected size, every row once and in order.
+  std::vector<uint8_t> expect_jpeg(const std::string &jpeg, size_t piece, int32_t max_width, int32_t max_height,
+                                   int32_t width, int32_t height, const char *what)
+  {
+    JpegRows rows = {nullptr, 0, {}};
+    JpegDecoder decoder(jpeg_row, &rows, max_width, max_height);
+    rows.decoder = &decoder;
+    rows.gray.reserve(size_t(width) * height);
+    for (size_t pos = 0; pos < jpeg.size() && !decoder.done(); pos += piece)
+    {
+      const size_t n = std::min(piece, jpeg.size() - pos);
+      if (!decoder.feed(reinterpret_cast<const uint8_t *>(jpeg.data() + pos), n))
+        break;
+    }
+    if (!decoder.done() || decoder.width() != width || decoder.height() != height || rows.rows != height)
+    {
+      fprintf(stderr, "%s: decoded %dx%d in %d rows (%s), expected %dx%d\n", what, decoder.width(), decoder.height(),
+              rows.rows, decoder.done() ? "done" : "not done", width, height);
+      exit(1);
+    }
+    return std::move(rows.gray);
+  }
+
+  // Checks decoded gray levels against the mean of the pixels of
+  // jpeg_pixel() that each one stands for.
+  void expect_jpeg_pixels(const std::vector<uint8_t> &gray, int32_t scale, int32_t width, int32_t height, uint32_t seed,
+                          const char *what)
+  {
+    const int32_t w = (width + scale - 1) / scale, h = (height + scale - 1) / scale;
+    double total = 0;
+    for (int32_t y = 0; y < h; y++)
+    {
+      for (int32_t x = 0; x < w; x++)
+      {
+        int32_t sum = 0, n = 0;
+        for (int32_t sy = y * scale; sy < std::min(height, (y + 1) * scale); sy++)
+        {
+          for (int32_t sx = x * scale; sx < std::min(width, (x + 1) * scale); sx++, n++)
+            sum += jpeg_pixel(sx, sy, width, height, seed);
+        }
+        total += std::abs(gray[size_t(y) * w + x] - double(sum) / n);
+      }
+    }
+    // Well under a gray level at 1/1 and about two at 1/2, where the noise
+    // aliases. A decoder that loses its place is off by tens.
+    const double error = total / (double(w) * h);
+    if (error > 4)
+    {
+      fprintf(stderr, "%s: gray levels off by %.2f on average\n", what, error);
+      exit(1);
+    }
+  }
+
+  void usage(const char *argv0)
+  {
+    fprintf(stderr, "usage: %s [--photos N] [--filter TEXT] [--json FILE] [--keep]\n", argv0);
+    exit(2);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--photos" && i + 1 < argc)
+      options.photos = strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--filter" && i + 1 < argc)
+      options.filter = argv[++i];
+    else if (arg == "--json" && i + 1 < argc)
+      options.json = argv[++i];
+    else if (arg == "--keep")
+      options.keep = true;
+    else
+      usage(argv[0]);
+  }
+
+  if (!options.json.empty() && options.json[0] != '/')
+  {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) != nullptr)
+      options.json = std::string(cwd) + "/" + options.json;
+  }
+
+  char workdir[] = "/tmp/inkart-bench-XXXXXX";
+  if (mkdtemp(workdir) == nullptr || chdir(workdir) != 0)
+  {
+    perror("workdir");
+    return 1;
+  }
+  mkdir(SDCARD_ROOT, 0755);
+  mkdir(FLASH_ROOT, 0755);
+
+  const int16_t width = Inkplate::WIDTH, height = Inkplate::HEIGHT;
+  const std::string frame_bmp = make_bmp(width, height, 1);
+  const std::string frame_b64 = b64encode(frame_bmp);
+
+  for (size_t i = 0; i < options.photos; i++)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), SDCARD_ROOT "/%s%lu.bmp", i % 10 == 9 ? "." : "", 1650000000ul + i);
+    write_file(name, i == 0 ? frame_bmp : make_bmp(width, height, i + 1));
+  }
+  write_file(FLASH_ROOT "/" ASSETS_LABEL ".bin",
+             make_assets({
+                 {"/index.html", "text/html", 0, std::string(4096, 'h')},
+                 {"/build/bundle.js", "text/javascript", ASSET_GZIP, std::string(64 * 1024, 'j')},
+                 {"/favicon.png", "image/png", 0, std::string(1024, 'p')},
+             }));
+
+  init_settings();
+  display.begin(true);
+  library_rebuild();
+  start_web_server();
+  const auto server = host_httpd_last_server();
+  if (server == nullptr)
+  {
+    fprintf(stderr, "web server did not start\n");
+    return 1;
+  }
+
+  printf("InkArt host benchmark: %dx%d panel, %zu photos, workdir %s\n", width, height, options.photos, workdir);
+  printf("%-40s %15s %15s %7s %15s\n", "case", "median", "min", "spread", "throughput");
+
+  std::vector<char> decoded(frame_b64.size() / 4 * 3);
+  run("b64decode/frame", frame_b64.size(), [&]
+      { b64decode(frame_b64.data(), frame_b64.size(), decoded.data(), decoded.size()); });
+  run("b64decode/frame strict", frame_b64.size(), [&]
+      { b64decode(frame_b64.data(), frame_b64.size(), decoded.data(), decoded.size(), true); });
+  run("b64decode/frame table", frame_b64.size(), [&]
+      { b64decode_table(frame_b64.data(), frame_b64.size(), decoded.data(), decoded.size()); });
+
+  run("readbmps", 0, []
+      {
+        std::vector<std::string> bmps;
+        readbmps(SDCARD_ROOT "/", bmps);
+      });
+
+  run("library/rebuild", 0, []
+      { library_rebuild(); });
+  run("library/select", 0, []
+      {
+        static int index = -1;
+        PhotoRecord record;
+        library_select(index, false, record);
+      });
+  run("library/select shuffle", 0, []
+      {
+        int index = -1;
+        PhotoRecord record;
+        library_select(index, true, record);
+      });
+
+  run("api/GET system/info", 0, [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/system/info"), "info"); });
+  run("api/GET system/display", 0, [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/system/display"), "display"); });
+  run("api/POST system/display", 0, [&]
+      {
+        const std::string body = R"({"invert":false,"dithering":true,"orientation":"landscape",)"
+                                 R"("padding":{"top":0,"left":0,"right":0,"bottom":0}})";
+        expect_ok(host_httpd_request(server, HTTP_POST, "/api/v1/system/display", body), "display post");
+      });
+  run("api/GET system/time", 0, [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/system/time"), "time"); });
+  // A full wake history, as after a long stretch on the wall.
+  for (int i = 0; i < 64; i++)
+  {
+    wake_timer_start();
+    for (size_t p = 1; p < WAKE_PHASES; p++)
+      wake_phase_end(WakePhase(p));
+    wake_timer_commit();
+  }
+  run("api/GET system/metrics", 0, [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/system/metrics"), "metrics"); });
+  run("api/GET photos", 0, [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/photos"), "photos"); });
+  run("api/GET photos?limit=50", 0, [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/photos?limit=50"), "photos page"); });
+  run("api/GET photos cbor", 0, [&]
+      {
+        expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/photos", "", {{"Accept", "application/cbor"}}),
+                  "photos cbor");
+      });
+  run("api/GET photos msgpack", 0, [&]
+      {
+        expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/photos", "", {{"Accept", "application/msgpack"}}),
+                  "photos msgpack");
+      });
+  const auto list_etag = host_httpd_request(server, HTTP_GET, "/api/v1/photos?limit=50").header("ETag");
+  run("api/GET photos If-None-Match", 0, [&]
+      {
+        expect_status(host_httpd_request(server, HTTP_GET, "/api/v1/photos?limit=50", "",
+                                         {{"If-None-Match", list_etag}}),
+                      "304", "photos revalidate");
+      });
+  run("api/PATCH photos", 0, [&]
+      {
+        expect_ok(host_httpd_request(server, HTTP_PATCH, "/api/v1/photos",
+                                     R"({"data":[{"filename":"1650000001.bmp","hidden":true}]})"),
+                  "hide");
+        expect_ok(host_httpd_request(server, HTTP_PATCH, "/api/v1/photos",
+                                     R"({"data":[{"filename":"1650000001.bmp","hidden":false}]})"),
+                  "show");
+      });
+  // One request for a page of photos, skipping the ones the card keeps hidden.
+  std::string hide_batch = R"({"data":[)", show_batch = hide_batch;
+  for (size_t i = 0; i < std::min<size_t>(options.photos, 100); i++)
+  {
+    if (i % 10 == 9)
+      continue;
+    const std::string sep = hide_batch.back() == '[' ? "" : ",";
+    const std::string name = std::to_string(1650000000ul + i) + ".bmp";
+    hide_batch += sep + R"({"filename":")" + name + R"(","hidden":true})";
+    show_batch += sep + R"({"filename":")" + name + R"(","hidden":false})";
+  }
+  hide_batch += "]}";
+  show_batch += "]}";
+  run("api/PATCH photos 90", 0, [&]
+      {
+        expect_ok(host_httpd_request(server, HTTP_PATCH, "/api/v1/photos", hide_batch), "hide batch");
+        expect_ok(host_httpd_request(server, HTTP_PATCH, "/api/v1/photos", show_batch), "show batch");
+      });
+  run("api/GET photos/<name>", frame_bmp.size(), [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/photos/1650000000.bmp"), "download"); });
+  const auto photo_etag = host_httpd_request(server, HTTP_HEAD, "/api/v1/photos/1650000000.bmp").header("ETag");
+  run("api/GET photos/<name> If-None-Match", 0, [&]
+      {
+        expect_status(host_httpd_request(server, HTTP_GET, "/api/v1/photos/1650000000.bmp", "",
+                                         {{"If-None-Match", photo_etag}}),
+                      "304", "revalidate");
+      });
+  run("api/GET photos/<name> Range", 64 * 1024, [&]
+      {
+        expect_status(host_httpd_request(server, HTTP_GET, "/api/v1/photos/1650000000.bmp", "",
+                                         {{"Range", "bytes=65536-131071"}}),
+                      "206", "range");
+      });
+  run("api/GET photos/<name>/thumbnail", 0, [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/api/v1/photos/1650000000.bmp/thumbnail"), "thumbnail"); });
+  run("api/HEAD photos/<name>", 0, [&]
+      { expect_ok(host_httpd_request(server, HTTP_HEAD, "/api/v1/photos/1650000000.bmp"), "head"); });
+  const std::vector<std::pair<std::string, std::string>> raw_headers = {{"Content-Type", "image/bmp"}};
+  const std::vector<std::pair<std::string, std::string>> multipart_headers = {
+      {"Content-Type", "multipart/form-data; boundary=----InkArtBench"}};
+  const std::string frame_multipart = "------InkArtBench\r\n"
+                                      "Content-Disposition: form-data; name=\"file\"; filename=\"photo.bmp\"\r\n"
+                                      "Content-Type: image/bmp\r\n\r\n" +
+                                      frame_bmp + "\r\n------InkArtBench--\r\n";
+  const auto upload = [&](const std::string &body, const std::vector<std::pair<std::string, std::string>> &headers)
+  {
+    const auto res = host_httpd_request(server, HTTP_POST, "/api/v1/photos", body, headers);
+    expect_job(server, res, "upload");
+    const auto pos = res.body.find("\"filename\":\"");
+    const auto name = res.body.substr(pos + 12, res.body.find('"', pos + 12) - pos - 12);
+    expect_ok(host_httpd_request(server, HTTP_DELETE, "/api/v1/photos/" + name), "delete");
+  };
+  run("api/POST photos", frame_bmp.size(), [&]
+      { upload(frame_b64, {}); });
+  run("api/POST photos raw", frame_bmp.size(), [&]
+      { upload(frame_bmp, raw_headers); });
+  run("api/POST photos multipart", frame_bmp.size(), [&]
+      { upload(frame_multipart, multipart_headers); });
+  // The web app's way: a session filled in 64 KiB chunks, then committed.
+  run("api/PUT uploads chunked", frame_bmp.size(), [&]
+      {
+        auto res = host_httpd_request(server, HTTP_POST, "/api/v1/uploads",
+                                      "{\"size\": " + std::to_string(frame_bmp.size()) + "}");
+        expect_status(res, "201", "session");
+        const std::string location = res.header("Location");
+        const std::vector<std::pair<std::string, std::string>> chunk_headers = {
+            {"Content-Type", "application/octet-stream"}};
+        for (size_t offset = 0; offset < frame_bmp.size(); offset += 65536)
+        {
+          expect_ok(host_httpd_request(server, HTTP_PUT, location + "?offset=" + std::to_string(offset),
+                                       frame_bmp.substr(offset, 65536), chunk_headers),
+                    "chunk");
+        }
+        res = host_httpd_request(server, HTTP_POST, location + "/commit");
+        expect_job(server, res, "commit");
+        const auto pos = res.body.find("\"filename\":\"");
+        const auto name = res.body.substr(pos + 12, res.body.find('"', pos + 12) - pos - 12);
+        expect_ok(host_httpd_request(server, HTTP_DELETE, "/api/v1/photos/" + name), "delete");
+      });
+  const std::string upload_ink = make_ink(width, height, 1);
+  run("api/POST photos raw ink", upload_ink.size(), [&]
+      { upload(upload_ink, raw_headers); });
+  const std::string upload_jpeg = make_jpeg(width, height, 1, {true, true, 0});
+  run("api/POST photos raw jpeg", upload_jpeg.size(), [&]
+      { upload(upload_jpeg, raw_headers); });
+  std::vector<std::pair<std::string, std::string>> import_files;
+  for (int i = 0; i < 10; i++)
+    import_files.emplace_back("library/import" + std::to_string(i) + ".ink", upload_ink);
+  const std::string import_tar = make_tar(import_files);
+  run("api/POST photos/import 10 ink", import_tar.size(), [&]
+      {
+        expect_job(server,
+                   host_httpd_request(server, HTTP_POST, "/api/v1/photos/import", import_tar,
+                                      {{"Content-Type", "application/x-tar"}}),
+                   "import");
+        for (int i = 0; i < 10; i++)
+          expect_ok(host_httpd_request(server, HTTP_DELETE, "/api/v1/photos/import" + std::to_string(i) + ".ink"),
+                    "delete");
+      });
+  run("api/POST photos/preview", frame_bmp.size(), [&]
+      { expect_job(server, host_httpd_request(server, HTTP_POST, "/api/v1/photos/preview", frame_b64), "preview"); });
+  run("api/POST photos/preview raw", frame_bmp.size(), [&]
+      {
+        expect_job(server, host_httpd_request(server, HTTP_POST, "/api/v1/photos/preview", frame_bmp, raw_headers),
+                   "preview");
+      });
+  run("events/publish", 0, []
+      { events_publish("bench", "{\"value\":%d}", 1); });
+  // What the streams cost an upload, read out as the web app would.
+  std::vector<int> streams;
+  for (int i = 0; i < EVENT_SUBSCRIBERS; i++)
+  {
+    const auto res = host_httpd_request(server, HTTP_GET, "/api/v1/events");
+    expect_ok(res, "events");
+    streams.push_back(res.sockfd);
+  }
+  run("api/POST photos raw 3 event streams", frame_bmp.size(), [&]
+      {
+        upload(frame_bmp, raw_headers);
+        host_httpd_drain(server);
+        for (const int fd : streams)
+        {
+          if (host_httpd_read(server, fd).find("event: upload") == std::string::npos)
+          {
+            fprintf(stderr, "events: no upload progress\n");
+            exit(1);
+          }
+        }
+      });
+  for (const int fd : streams)
+    host_httpd_close(server, fd);
+  run("static/GET index", 4096, [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/"), "index"); });
+  run("static/GET bundle.js", 64 * 1024, [&]
+      { expect_ok(host_httpd_request(server, HTTP_GET, "/build/bundle.js"), "bundle"); });
+  const auto bundle_etag = host_httpd_request(server, HTTP_HEAD, "/build/bundle.js").header("ETag");
+  run("static/GET bundle.js If-None-Match", 0, [&]
+      {
+        expect_status(host_httpd_request(server, HTTP_GET, "/build/bundle.js", "", {{"If-None-Match", bundle_etag}}),
+                      "304", "bundle revalidate");
+      });
+
+  const std::string frame_path = SDCARD_ROOT "/1650000000.bmp";
+  display.selectDisplayMode(DisplayMode::INKPLATE_3BIT);
+  run("draw/drawImage", frame_bmp.size(), [&]
+      { display.drawImage(frame_path.c_str(), 0, 0, false, false); });
+  run("draw/drawImage dither", frame_bmp.size(), [&]
+      { display.drawImage(frame_path.c_str(), 0, 0, true, false); });
+  run("draw/drawImage dither invert rotate", frame_bmp.size(), [&]
+      {
+        display.setRotation(2);
+        display.drawImage(frame_path.c_str(), 0, 0, true, true);
+        display.setRotation(0);
+      });
+  std::string frame_copy = frame_bmp;
+  run("draw/drawBitmapFromBuffer", frame_bmp.size(), [&]
+      { display.drawBitmapFromBuffer(reinterpret_cast<uint8_t *>(&frame_copy[0]), 0, 0, true, false); });
+
+  // One wake: the old path, a frame cache miss and a frame cache hit.
+  RenderOptions render_options = {0, 0, 0, Dither::FLOYD_STEINBERG, false};
+  PhotoRecord frame_record;
+  expect_ok(library_find("1650000000.bmp", frame_record), "library_find");
+  Frame frame;
+  run("wake/drawImage", frame_bmp.size(), [&]
+      {
+        display.clearDisplay();
+        display.drawImage(frame_path.c_str(), 0, 0, true, false);
+      });
+  run("wake/render_photo", frame_bmp.size(), [&]
+      {
+        display.clearDisplay();
+        render_photo(frame_path.c_str(), render_options, frame);
+        draw_frame(frame);
+      });
+  frame_cache_store(frame_record, render_options, frame);
+  run("wake/frame_cache_load", Frame::SIZE, [&]
+      {
+        display.clearDisplay();
+        expect_ok(frame_cache_load(frame_record, render_options, frame), "frame cache");
+        draw_frame(frame);
+      });
+  const std::string frame_ink = make_ink(width, height, 1);
+  write_file("frame.ink", frame_ink);
+  run("wake/render_photo ink", frame_ink.size(), [&]
+      {
+        display.clearDisplay();
+        render_photo("frame.ink", render_options, frame);
+        draw_frame(frame);
+      });
+  // Every scale of a 4:2:0 photo, then restart markers and separate scans.
+  {
+    const int32_t jpeg_width = width + 3, jpeg_height = height + 4;
+    const std::string jpeg = make_jpeg(jpeg_width, jpeg_height, 1, {true, true, 0});
+    for (int32_t scale = 1; scale <= 8; scale *= 2)
+    {
+      const int32_t w = (jpeg_width + scale - 1) / scale, h = (jpeg_height + scale - 1) / scale;
+      const std::string name = "jpeg/decode 1/" + std::to_string(scale);
+      expect_jpeg_pixels(expect_jpeg(jpeg, 4096, w, h, w, h, name.c_str()), scale, jpeg_width, jpeg_height, 1,
+                         name.c_str());
+      run(name, jpeg.size(), [&]
+          { expect_jpeg(jpeg, 4096, w, h, w, h, name.c_str()); });
+    }
+    const std::string restarts = make_jpeg(jpeg_width, jpeg_height, 2, {true, true, 7});
+    expect_jpeg_pixels(expect_jpeg(restarts, 4096, jpeg_width, jpeg_height, jpeg_width, jpeg_height, "restarts"), 1,
+                       jpeg_width, jpeg_height, 2, "restarts");
+    run("jpeg/decode restarts", restarts.size(), [&]
+        { expect_jpeg(restarts, 4096, jpeg_width, jpeg_height, jpeg_width, jpeg_height, "restarts"); });
+    const std::string scans = make_jpeg(jpeg_width, jpeg_height, 3, {true, false, 5});
+    const int32_t w = (jpeg_width + 3) / 4, h = (jpeg_height + 3) / 4;
+    expect_jpeg_pixels(expect_jpeg(scans, 509, w, h, w, h, "non-interleaved"), 4, jpeg_width, jpeg_height, 3,
+                       "non-interleaved");
+    run("jpeg/decode non-interleaved 1/4", scans.size(), [&]
+        { expect_jpeg(scans, 509, w, h, w, h, "non-interleaved"); });
+    const std::string gray = make_jpeg(jpeg_width, jpeg_height, 4, {false, false, 0});
+    expect_jpeg_pixels(expect_jpeg(gray, 4096, jpeg_width, jpeg_height, jpeg_width, jpeg_height, "gray"), 1,
+                       jpeg_width, jpeg_height, 4, "gray");
+    run("jpeg/decode gray", gray.size(), [&]
+        { expect_jpeg(gray, 4096, jpeg_width, jpeg_height, jpeg_width, jpeg_height, "gray"); });
+  }
+  run("frame_cache/store", Frame::SIZE, [&]
+      { frame_cache_store(frame_record, render_options, frame); });
+  run("frame/band_hashes", Frame::SIZE, [&]
+      {
+        uint32_t bands[FRAME_BANDS];
+        frame.band_hashes(bands);
+      });
+
+  {
+    std::vector<uint8_t> gray(size_t(width) * height), levels(width);
+    uint32_t seed = 1;
+    for (auto &g : gray)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      g = seed >> 24;
+    }
+    for (size_t m = 0; m < DITHERS; m++)
+    {
+      run(std::string("dither/") + dither_names[m], gray.size(), [&]
+          {
+            Ditherer ditherer(Dither(m), width);
+            for (int32_t y = 0; y < height; y++)
+              ditherer.row(y, gray.data() + size_t(y) * width, levels.data());
+          });
+    }
+  }
+
+  run("draw/setup_info", 0, []
+      { draw_setup_info("InkArt1234", "iNKaRT5678", "192.168.4.1"); });
+  run("draw/padding_preview", 0, []
+      { draw_padding_preview(10, 20, 30, 40, 1, true); });
+
+  if (!options.json.empty())
+  {
+    FILE *fp = fopen(options.json.c_str(), "w");
+    if (fp != nullptr)
+    {
+      fprintf(fp, "{\n  \"panel\": [%d, %d],\n  \"photos\": %zu,\n  \"results\": [\n", width, height,
+              options.photos);
+      for (size_t i = 0; i < results.size(); i++)
+      {
+        const auto &r = results[i];
+        fprintf(fp, "    {\"name\": \"%s\", \"median_us\": %.3f, \"min_us\": %.3f, \"spread\": %.4f}%s\n",
+                r.name.c_str(), r.median_us, r.min_us, r.spread, i + 1 < results.size() ? "," : "");
+      }
+      fprintf(fp, "  ]\n}\n");
+      fclose(fp);
+    }
+  }
+
+  if (options.keep)
+  {
+    printf("kept %s\n", workdir);
+  }
+  else if (chdir("/") == 0)
+  {
+    remove_tree(workdir);
+  }
+  return 0;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Host stand-in for ESP-IDF's esp_attr.h. Placement attributes have no
+// meaning off the chip.
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define EXT_RAM_ATTR
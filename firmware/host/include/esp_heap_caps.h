@@ -0,0 +1,43 @@
+#pragma once
+
+// Host stand-in for esp_heap_caps.h. There is one kind of memory.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t)
+{
+  return malloc(size);
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t)
+{
+  return calloc(n, size);
+}
+
+static inline void heap_caps_free(void *ptr)
+{
+  free(ptr);
+}
+
+// The host heap is not inspected; it reports nothing free.
+static inline size_t heap_caps_get_free_size(uint32_t)
+{
+  return 0;
+}
+
+static inline size_t heap_caps_get_minimum_free_size(uint32_t)
+{
+  return 0;
+}
+
+static inline size_t heap_caps_get_largest_free_block(uint32_t)
+{
+  return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Host stand-in for ESP-IDF's esp_timer.h. Time counts from process start.
+
+#include <cstdint>
+
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,84 @@
+#pragma once
+
+// Host stand-in for ESP-IDF's esp_wifi.h.
+
+#include <cstdint>
+#include <cstring>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_system.h"
+
+typedef enum
+{
+  WIFI_MODE_NULL,
+  WIFI_MODE_STA,
+  WIFI_MODE_AP,
+  WIFI_MODE_APSTA,
+} wifi_mode_t;
+
+typedef enum
+{
+  WIFI_IF_STA,
+  WIFI_IF_AP,
+} wifi_interface_t;
+
+typedef enum
+{
+  WIFI_AUTH_OPEN,
+  WIFI_AUTH_WEP,
+  WIFI_AUTH_WPA_PSK,
+  WIFI_AUTH_WPA2_PSK,
+  WIFI_AUTH_WPA_WPA2_PSK,
+} wifi_auth_mode_t;
+
+typedef enum
+{
+  WIFI_EVENT_AP_START = 12,
+  WIFI_EVENT_AP_STOP,
+  WIFI_EVENT_AP_STACONNECTED,
+  WIFI_EVENT_AP_STADISCONNECTED,
+} wifi_event_t;
+
+typedef struct
+{
+  uint8_t ssid[32];
+  uint8_t password[64];
+  uint8_t ssid_len;
+  uint8_t channel;
+  wifi_auth_mode_t authmode;
+  uint8_t ssid_hidden;
+  uint8_t max_connection;
+  uint16_t beacon_interval;
+} wifi_ap_config_t;
+
+typedef union
+{
+  wifi_ap_config_t ap;
+} wifi_config_t;
+
+typedef struct
+{
+  int reserved;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() \
+  {                                \
+    0                              \
+  }
+
+typedef struct
+{
+  uint8_t mac[6];
+  uint8_t aid;
+} wifi_event_ap_staconnected_t;
+
+typedef struct
+{
+  uint8_t mac[6];
+  uint8_t aid;
+} wifi_event_ap_stadisconnected_t;
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_start(void);
@@ -0,0 +1,30 @@
+#pragma once
+
+// Host stand-in for FatFs' ff.h. f_getfree() reports the file system that
+// holds SDCARD_ROOT.
+
+#include <cstdint>
+
+typedef uint32_t DWORD;
+typedef uint16_t WORD;
+typedef char TCHAR;
+
+typedef enum
+{
+  FR_OK = 0,
+  FR_DISK_ERR,
+  FR_INT_ERR,
+  FR_NOT_READY,
+  FR_NO_FILE,
+  FR_NO_PATH,
+  FR_INVALID_NAME,
+} FRESULT;
+
+typedef struct
+{
+  DWORD n_fatent;
+  WORD csize;
+  WORD ssize;
+} FATFS;
+
+FRESULT f_getfree(const TCHAR *path, DWORD *nclst, FATFS **fatfs);
@@ -0,0 +1,7 @@
+#pragma once
+
+// Host stand-in for the driver's FreeMonoBold12pt7b font: metrics only.
+
+#include "inkplate.hpp"
+
+const GFXfont FreeMonoBold12pt7b PROGMEM = {nullptr, nullptr, 0x20, 0x7E, 24};
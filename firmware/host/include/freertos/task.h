@@ -0,0 +1,18 @@
+#pragma once
+
+// Host stand-in for FreeRTOS task.h. Tasks run on std::thread; core
+// affinity and priorities are ignored.
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+typedef struct host_task *TaskHandle_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+// Tells threads apart; the handle is not the one xTaskCreate() gave out.
+TaskHandle_t xTaskGetCurrentTaskHandle();
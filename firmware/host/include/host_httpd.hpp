@@ -0,0 +1,40 @@
+#pragma once
+
+// Host-only companion to the esp_http_server.h stand-in: injects requests
+// into a running server and captures the response.
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "esp_http_server.h"
+
+struct HostResponse
+{
+  std::string status;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+  bool handled = false;
+  int sockfd = -1;
+
+  std::string header(const std::string &field) const;
+};
+
+// Server started most recently by httpd_start(); start_web_server() does not
+// hand its handle out.
+httpd_handle_t host_httpd_last_server();
+
+// Dispatches one request. Bodies are delivered to httpd_req_recv() in pieces
+// of at most recv_chunk bytes, like TCP segments on the device.
+HostResponse host_httpd_request(httpd_handle_t server, httpd_method_t method, const std::string &uri,
+                                const std::string &body = "",
+                                const std::vector<std::pair<std::string, std::string>> &headers = {},
+                                size_t recv_chunk = 1436);
+
+// Takes what httpd_socket_send() has written to a socket that is still open.
+std::string host_httpd_read(httpd_handle_t server, int sockfd);
+
+// Closes a socket as a client hanging up would, releasing its session context.
+void host_httpd_close(httpd_handle_t server, int sockfd);
+
+// Waits until the work queued with httpd_queue_work() has run.
+void host_httpd_drain(httpd_handle_t server);
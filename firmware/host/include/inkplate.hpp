@@ -0,0 +1,114 @@
+#pragma once
+
+// Host stand-in for the ESP-IDF-InkPlate driver. The panel is a RAM
+// framebuffer with the same geometry and pixel packing as the device:
+// 3-bit mode keeps two pixels per byte (even x in the high nibble, 7 is
+// white) and 1-bit mode keeps eight pixels per byte (1 is black).
+// drawImage() and drawBitmapFromBuffer() decode BMP files the way the
+// driver does, pixel by pixel through drawPixel().
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#undef PROGMEM
+#define PROGMEM
+
+enum class DisplayMode
+{
+  INKPLATE_1BIT,
+  INKPLATE_3BIT,
+};
+
+typedef struct
+{
+  uint16_t bitmapOffset;
+  uint8_t width;
+  uint8_t height;
+  uint8_t xAdvance;
+  int8_t xOffset;
+  int8_t yOffset;
+} GFXglyph;
+
+typedef struct
+{
+  const uint8_t *bitmap;
+  const GFXglyph *glyph;
+  uint16_t first;
+  uint16_t last;
+  uint8_t yAdvance;
+} GFXfont;
+
+namespace ESP
+{
+  void delay(uint32_t ms);
+}
+
+class Inkplate
+{
+public:
+#if defined(INKPLATE_6)
+  static constexpr int16_t WIDTH = 800;
+  static constexpr int16_t HEIGHT = 600;
+#else
+  static constexpr int16_t WIDTH = 1200;
+  static constexpr int16_t HEIGHT = 825;
+#endif
+
+  Inkplate(DisplayMode mode);
+
+  bool begin(bool sd_card_init = false);
+  void clearDisplay();
+  void display();
+  void partialUpdate(bool force = false);
+
+  void selectDisplayMode(DisplayMode mode);
+  DisplayMode getDisplayMode() const { return mode; }
+
+  void setRotation(uint8_t r);
+  uint8_t getRotation() const { return rotation; }
+  int16_t width() const { return (rotation & 1) ? HEIGHT : WIDTH; }
+  int16_t height() const { return (rotation & 1) ? WIDTH : HEIGHT; }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color);
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+  void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+  void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color);
+  void fillScreen(uint16_t color);
+
+  void setTextSize(uint8_t s) { text_size = s; }
+  void setFont(const GFXfont *f) { font = f; }
+  void setCursor(int16_t x, int16_t y)
+  {
+    cursor_x = x;
+    cursor_y = y;
+  }
+  int16_t getCursorX() const { return cursor_x; }
+  int16_t getCursorY() const { return cursor_y; }
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+  uint8_t readTouchpad(uint8_t pad);
+
+  bool drawImage(const char *path, int x, int y, bool dither = true, bool invert = false);
+  bool drawBitmapFromBuffer(uint8_t *buf, int x, int y, bool dither, bool invert);
+
+  // Host only: framebuffer of the current mode and panel statistics.
+  const uint8_t *hostFrameBuffer() const;
+  size_t hostFrameBufferSize() const;
+  uint32_t hostRefreshCount() const { return refresh_count; }
+
+private:
+  bool drawBitmap(const uint8_t *header, size_t header_len, const uint8_t *(*row)(void *, int32_t), void *ctx, int x,
+                  int y, bool dither, bool invert);
+
+  DisplayMode mode;
+  uint8_t rotation = 0;
+  std::vector<uint8_t> frame_3bit;
+  std::vector<uint8_t> frame_1bit;
+  const GFXfont *font = nullptr;
+  uint8_t text_size = 1;
+  int16_t cursor_x = 0;
+  int16_t cursor_y = 0;
+  uint32_t refresh_count = 0;
+};
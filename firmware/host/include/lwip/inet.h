@@ -0,0 +1,7 @@
+#pragma once
+
+// Host stand-in for lwIP's inet.h.
+
+#include <cstdint>
+
+char *inet_ntoa_r(uint32_t addr, char *buf, int buflen);
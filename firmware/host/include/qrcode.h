@@ -0,0 +1,22 @@
+#pragma once
+
+// Host stand-in for ricmoo/QRCode. It produces a QR-sized module pattern
+// derived from the text instead of a scannable code; the draw path costs
+// the same.
+
+#include <cstdint>
+
+typedef struct QRCode
+{
+  uint8_t version;
+  uint8_t size;
+  uint8_t ecc;
+  uint8_t mode;
+  uint8_t mask;
+  uint8_t *modules;
+} QRCode;
+
+#define qrcode_getBufferSize(version) ((((4 * (version) + 17) * (4 * (version) + 17)) + 7) / 8)
+
+int8_t qrcode_initText(QRCode *qrcode, uint8_t *modules, uint8_t version, uint8_t ecc, const char *data);
+bool qrcode_getModule(QRCode *qrcode, uint8_t x, uint8_t y);
@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <strings.h>
+#include <thread>
+#include <vector>
+#include "esp_http_server.h"
+#include "host_httpd.hpp"
+
+namespace
+{
+  struct Session
+  {
+    void *ctx;
+    void (*free_ctx)(void *ctx);
+    std::string sent;
+  };
+
+  struct Server
+  {
+    httpd_config_t config;
+    std::vector<httpd_uri_t> handlers;
+
+    // Held while a handler or a work item runs, like httpd's single task.
+    std::recursive_mutex task;
+    std::map<int, Session> sessions;
+    std::vector<int> closing;
+    int next_fd = 3;
+
+    std::mutex work_lock;
+    std::condition_variable work_cond;
+    std::deque<std::pair<httpd_work_fn_t, void *>> work;
+    bool working = false;
+    bool stopping = false;
+    std::thread worker;
+  };
+
+  void work_loop(Server *server)
+  {
+    std::unique_lock<std::mutex> lock(server->work_lock);
+    for (;;)
+    {
+      server->work_cond.wait(lock, [&] { return server->stopping || !server->work.empty(); });
+      if (server->stopping)
+        return;
+      const auto item = server->work.front();
+      server->work.pop_front();
+      server->working = true;
+      lock.unlock();
+      {
+        std::lock_guard<std::recursive_mutex> task(server->task);
+        item.first(item.second);
+      }
+      lock.lock();
+      server->working = false;
+      server->work_cond.notify_all();
+    }
+  }
+
+  void close_session(Server *server, int fd)
+  {
+    const auto found = server->sessions.find(fd);
+    if (found == server->sessions.end())
+      return;
+    const Session session = found->second;
+    server->sessions.erase(found);
+    if (session.free_ctx && session.ctx)
+      session.free_ctx(session.ctx);
+  }
+
+  // Mirrors httpd's bookkeeping for one request. Header, type and status
+  // values are kept as pointers and only read when the response goes out,
+  // so handlers that pass short-lived buffers misbehave here as they do on
+  // the device.
+  struct Context
+  {
+    const Server *server;
+    int sockfd;
+    const std::string *body;
+    size_t body_pos;
+    size_t recv_chunk;
+    const std::vector<std::pair<std::string, std::string>> *req_headers;
+
+    const char *status;
+    const char *type;
+    std::vector<std::pair<const char *, const char *>> resp_headers;
+    bool headers_sent;
+    bool finished;
+    HostResponse *response;
+    // Bytes a handler wrote with httpd_send(), parsed once it returns.
+    std::string raw;
+  };
+
+  Server *last_server = nullptr;
+
+  Context *context(httpd_req_t *r)
+  {
+    return static_cast<Context *>(r->aux);
+  }
+
+  void send_headers(Context *ctx)
+  {
+    if (ctx->headers_sent)
+      return;
+    ctx->headers_sent = true;
+    ctx->response->status = ctx->status;
+    ctx->response->headers.emplace_back("Content-Type", ctx->type);
+    for (const auto &hdr : ctx->resp_headers)
+    {
+      ctx->response->headers.emplace_back(hdr.first, hdr.second);
+    }
+  }
+
+  const std::pair<std::string, std::string> *find_header(httpd_req_t *r, const char *field)
+  {
+    for (const auto &hdr : *context(r)->req_headers)
+    {
+      if (strcasecmp(hdr.first.c_str(), field) == 0)
+        return &hdr;
+    }
+    return nullptr;
+  }
+
+  void parse_raw(Context *ctx)
+  {
+    const std::string &raw = ctx->raw;
+    const size_t head_end = raw.find("\r\n\r\n");
+    if (head_end == std::string::npos)
+      return;
+    size_t line_end = raw.find("\r\n");
+    const size_t status = raw.find(' ');
+    if (status < line_end)
+      ctx->response->status = raw.substr(status + 1, line_end - status - 1);
+    while (line_end < head_end)
+    {
+      const size_t start = line_end + 2;
+      line_end = raw.find("\r\n", start);
+      const size_t colon = raw.find(':', start);
+      if (colon < line_end)
+      {
+        const size_t value = raw.find_first_not_of(' ', colon + 1);
+        ctx->response->headers.emplace_back(raw.substr(start, colon - start), raw.substr(value, line_end - value));
+      }
+    }
+    ctx->response->body = raw.substr(head_end + 4);
+  }
+
+  const char *query_of(httpd_req_t *r)
+  {
+    const char *q = strchr(r->uri, '?');
+    return q ? q + 1 : nullptr;
+  }
+}
+
+std::string HostResponse::header(const std::string &field) const
+{
+  for (const auto &hdr : headers)
+  {
+    if (strcasecmp(hdr.first.c_str(), field.c_str()) == 0)
+      return hdr.second;
+  }
+  return "";
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+  auto server = new Server();
+  server->config = *config;
+  server->worker = std::thread(work_loop, server);
+  last_server = server;
+  *handle = server;
+  return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+  auto server = static_cast<Server *>(handle);
+  if (last_server == server)
+    last_server = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(server->work_lock);
+    server->stopping = true;
+    server->work_cond.notify_all();
+  }
+  server->worker.join();
+  while (!server->sessions.empty())
+    close_session(server, server->sessions.begin()->first);
+  delete server;
+  return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+  auto server = static_cast<Server *>(handle);
+  for (const auto &h : server->handlers)
+  {
+    if (h.method == uri_handler->method && strcmp(h.uri, uri_handler->uri) == 0)
+      return ESP_ERR_HTTPD_HANDLER_EXISTS;
+  }
+  if (server->handlers.size() >= server->config.max_uri_handlers)
+    return ESP_ERR_HTTPD_HANDLERS_FULL;
+  server->handlers.push_back(*uri_handler);
+  return ESP_OK;
+}
+
+bool httpd_uri_match_wildcard(const char *uri_template, const char *uri_to_match, size_t match_upto)
+{
+  const size_t tpl_len = strlen(uri_template);
+  size_t exact_match_chars = tpl_len;
+
+  const char last = tpl_len > 0 ? uri_template[tpl_len - 1] : 0;
+  const char prevlast = tpl_len > 1 ? uri_template[tpl_len - 2] : 0;
+  const bool asterisk = last == '*' || (prevlast == '*' && last == '?');
+  const bool quest = last == '?' || (prevlast == '?' && last == '*');
+
+  if (exact_match_chars < size_t(asterisk + quest * 2))
+    return false;
+
+  exact_match_chars -= asterisk + quest * 2;
+  if (match_upto < exact_match_chars)
+    return false;
+
+  if (!quest)
+  {
+    if (!asterisk && match_upto != exact_match_chars)
+      return false;
+    return strncmp(uri_template, uri_to_match, exact_match_chars) == 0;
+  }
+
+  if (match_upto > exact_match_chars && uri_template[exact_match_chars] != uri_to_match[exact_match_chars])
+    return false;
+  if (strncmp(uri_template, uri_to_match, exact_match_chars) != 0)
+    return false;
+  return asterisk || match_upto <= exact_match_chars + 1;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+  auto ctx = context(r);
+  const size_t remaining = ctx->body->size() - ctx->body_pos;
+  const size_t len = std::min({buf_len, remaining, ctx->recv_chunk});
+  if (len == 0)
+    return buf_len == 0 ? 0 : HTTPD_SOCK_ERR_TIMEOUT;
+  memcpy(buf, ctx->body->data() + ctx->body_pos, len);
+  ctx->body_pos += len;
+  return len;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+  auto hdr = find_header(r, field);
+  return hdr ? hdr->second.size() : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+  auto hdr = find_header(r, field);
+  if (hdr == nullptr)
+    return ESP_ERR_NOT_FOUND;
+  if (val_size == 0)
+    return ESP_ERR_HTTPD_RESULT_TRUNC;
+  strncpy(val, hdr->second.c_str(), val_size - 1);
+  val[val_size - 1] = '\0';
+  return hdr->second.size() < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r)
+{
+  auto q = query_of(r);
+  return q ? strlen(q) : 0;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+  auto q = query_of(r);
+  if (q == nullptr)
+    return ESP_ERR_NOT_FOUND;
+  if (buf_len == 0)
+    return ESP_ERR_HTTPD_RESULT_TRUNC;
+  strncpy(buf, q, buf_len - 1);
+  buf[buf_len - 1] = '\0';
+  return strlen(q) < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+  const size_t key_len = strlen(key);
+  const char *p = qry;
+  while (p && *p)
+  {
+    const char *end = strchr(p, '&');
+    const size_t len = end ? size_t(end - p) : strlen(p);
+    if (len > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '=')
+    {
+      const size_t vlen = len - key_len - 1;
+      if (val_size == 0)
+        return ESP_ERR_HTTPD_RESULT_TRUNC;
+      const size_t n = std::min(vlen, val_size - 1);
+      memcpy(val, p + key_len + 1, n);
+      val[n] = '\0';
+      return vlen < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+    p = end ? end + 1 : nullptr;
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+  context(r)->status = status;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+  context(r)->type = type;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+  auto ctx = context(r);
+  if (ctx->resp_headers.size() >= ctx->server->config.max_resp_headers)
+    return ESP_ERR_HTTPD_RESP_HDR;
+  ctx->resp_headers.emplace_back(field, value);
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+  auto ctx = context(r);
+  if (ctx->finished)
+    return ESP_ERR_HTTPD_INVALID_REQ;
+  if (buf_len == HTTPD_RESP_USE_STRLEN)
+    buf_len = buf ? strlen(buf) : 0;
+  send_headers(ctx);
+  ctx->response->headers.emplace_back("Content-Length", std::to_string(buf_len));
+  if (buf_len > 0)
+    ctx->response->body.append(buf, buf_len);
+  ctx->finished = true;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+  auto ctx = context(r);
+  if (ctx->finished)
+    return ESP_ERR_HTTPD_INVALID_REQ;
+  if (buf_len == HTTPD_RESP_USE_STRLEN)
+    buf_len = buf ? strlen(buf) : 0;
+  if (!ctx->headers_sent)
+  {
+    send_headers(ctx);
+    ctx->response->headers.emplace_back("Transfer-Encoding", "chunked");
+  }
+  if (buf_len == 0)
+  {
+    ctx->finished = true;
+    return ESP_OK;
+  }
+  ctx->response->body.append(buf, buf_len);
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+  static const char *statuses[] = {
+      "500 Internal Server Error",
+      "501 Method Not Implemented",
+      "505 Version Not Supported",
+      "400 Bad Request",
+      "401 Unauthorized",
+      "403 Forbidden",
+      "404 Not Found",
+      "405 Method Not Allowed",
+      "408 Request Timeout",
+      "411 Length Required",
+      "414 URI Too Long",
+      "431 Request Header Fields Too Large",
+  };
+  auto ctx = context(req);
+  if (ctx->headers_sent)
+  {
+    // httpd would write the error into the middle of the chunked body.
+    ctx->finished = true;
+    return ESP_ERR_HTTPD_INVALID_REQ;
+  }
+  ctx->status = statuses[error < HTTPD_ERR_CODE_MAX ? error : 0];
+  ctx->type = HTTPD_TYPE_TEXT;
+  return httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+}
+
+int httpd_send(httpd_req_t *r, const char *buf, size_t buf_len)
+{
+  auto ctx = context(r);
+  if (ctx->headers_sent)
+    return HTTPD_SOCK_ERR_FAIL;
+  ctx->finished = true;
+  ctx->raw.append(buf, buf_len);
+  return buf_len;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+  return context(r)->sockfd;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg)
+{
+  auto server = static_cast<Server *>(handle);
+  std::lock_guard<std::mutex> lock(server->work_lock);
+  server->work.emplace_back(work, arg);
+  server->work_cond.notify_all();
+  return ESP_OK;
+}
+
+int httpd_socket_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int)
+{
+  auto server = static_cast<Server *>(hd);
+  std::lock_guard<std::recursive_mutex> task(server->task);
+  const auto found = server->sessions.find(sockfd);
+  if (found == server->sessions.end())
+    return HTTPD_SOCK_ERR_INVALID;
+  found->second.sent.append(buf, buf_len);
+  return buf_len;
+}
+
+// Closing is queued like on the device, so a handler that triggers it still
+// gets to leave its session context behind.
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+  auto server = static_cast<Server *>(handle);
+  std::lock_guard<std::recursive_mutex> task(server->task);
+  if (server->sessions.count(sockfd) == 0)
+    return ESP_ERR_NOT_FOUND;
+  server->closing.push_back(sockfd);
+  return httpd_queue_work(
+      handle,
+      [](void *arg)
+      {
+        auto server = static_cast<Server *>(arg);
+        std::vector<int> closing;
+        closing.swap(server->closing);
+        for (const int fd : closing)
+          close_session(server, fd);
+      },
+      server);
+}
+
+std::string host_httpd_read(httpd_handle_t handle, int sockfd)
+{
+  auto server = static_cast<Server *>(handle);
+  std::lock_guard<std::recursive_mutex> task(server->task);
+  const auto found = server->sessions.find(sockfd);
+  if (found == server->sessions.end())
+    return "";
+  std::string sent;
+  sent.swap(found->second.sent);
+  return sent;
+}
+
+void host_httpd_close(httpd_handle_t handle, int sockfd)
+{
+  auto server = static_cast<Server *>(handle);
+  std::lock_guard<std::recursive_mutex> task(server->task);
+  close_session(server, sockfd);
+}
+
+void host_httpd_drain(httpd_handle_t handle)
+{
+  auto server = static_cast<Server *>(handle);
+  std::unique_lock<std::mutex> lock(server->work_lock);
+  server->work_cond.wait(lock, [&] { return server->work.empty() && !server->working; });
+}
+
+httpd_handle_t host_httpd_last_server()
+{
+  return last_server;
+}
+
+HostResponse host_httpd_request(httpd_handle_t server, httpd_method_t method, const std::string &uri,
+                                const std::string &body,
+                                const std::vector<std::pair<std::string, std::string>> &headers,
+                                size_t recv_chunk)
+{
+  auto srv = static_cast<Server *>(server);
+  std::lock_guard<std::recursive_mutex> task(srv->task);
+  HostResponse response;
+  const int sockfd = srv->next_fd++;
+  srv->sessions[sockfd] = {};
+
+  auto req = std::make_unique<httpd_req_t>();
+  strncpy(req->uri, uri.c_str(), HTTPD_MAX_URI_LEN);
+  req->handle = server;
+  req->method = method;
+  req->content_len = body.size();
+
+  Context ctx = {srv, sockfd, &body, 0, recv_chunk, &headers, HTTPD_200, HTTPD_TYPE_TEXT, {}, false, false,
+                 &response, {}};
+  req->aux = &ctx;
+
+  const size_t match_len = uri.find('?') == std::string::npos ? uri.size() : uri.find('?');
+  bool uri_found = false;
+  for (const auto &h : srv->handlers)
+  {
+    const bool match = srv->config.uri_match_fn ? srv->config.uri_match_fn(h.uri, req->uri, match_len)
+                                                : strlen(h.uri) == match_len && strncmp(h.uri, req->uri, match_len) == 0;
+    if (!match)
+      continue;
+    uri_found = true;
+    if (h.method != method)
+      continue;
+
+    req->user_ctx = h.user_ctx;
+    response.handled = true;
+    h.handler(req.get());
+    if (!ctx.raw.empty())
+      parse_raw(&ctx);
+    else if (!ctx.finished)
+      httpd_resp_send_chunk(req.get(), nullptr, 0);
+    if (req->sess_ctx != nullptr)
+    {
+      srv->sessions[sockfd].ctx = req->sess_ctx;
+      srv->sessions[sockfd].free_ctx = req->free_ctx;
+      response.sockfd = sockfd;
+    }
+    else
+    {
+      srv->sessions.erase(sockfd);
+    }
+    return response;
+  }
+
+  httpd_resp_send_err(req.get(), uri_found ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND,
+                      uri_found ? "Request method for this URI is not handled by server"
+                                : "This URI does not exist");
+  srv->sessions.erase(sockfd);
+  return response;
+}
@@ -0,0 +1,102 @@
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "esp_partition.h"
+
+#ifndef FLASH_ROOT
+#define FLASH_ROOT "./flash"
+#endif
+
+namespace
+{
+  struct Mapping
+  {
+    void *addr;
+    size_t len;
+  };
+
+  std::mutex mutex;
+  std::map<std::string, std::unique_ptr<esp_partition_t>> partitions;
+  std::map<spi_flash_mmap_handle_t, Mapping> mappings;
+  spi_flash_mmap_handle_t next_handle = 1;
+
+  std::string partition_path(const esp_partition_t *partition)
+  {
+    return std::string(FLASH_ROOT "/") + partition->label + ".bin";
+  }
+}
+
+// There is no partition table on the host, so any label with a file is
+// found, with the type it was asked for.
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+  if (label == nullptr || strlen(label) >= sizeof(esp_partition_t::label))
+    return nullptr;
+  std::lock_guard<std::mutex> lock(mutex);
+  struct stat st;
+  if (stat((std::string(FLASH_ROOT "/") + label + ".bin").c_str(), &st) != 0)
+    return nullptr;
+
+  auto &partition = partitions[label];
+  if (partition == nullptr)
+    partition.reset(new esp_partition_t{});
+  partition->type = type;
+  partition->subtype = subtype;
+  partition->size = st.st_size;
+  strcpy(partition->label, label);
+  return partition.get();
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+  if (src_offset > partition->size || size > partition->size - src_offset)
+    return ESP_ERR_INVALID_SIZE;
+  FILE *fp = fopen(partition_path(partition).c_str(), "rb");
+  if (fp == nullptr)
+    return ESP_FAIL;
+  const bool ok = fseek(fp, src_offset, SEEK_SET) == 0 && fread(dst, 1, size, fp) == size;
+  fclose(fp);
+  return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size, spi_flash_mmap_memory_t,
+                             const void **out_ptr, spi_flash_mmap_handle_t *out_handle)
+{
+  if (offset > partition->size || size > partition->size - offset || size == 0)
+    return ESP_ERR_INVALID_ARG;
+  const int fd = open(partition_path(partition).c_str(), O_RDONLY);
+  if (fd < 0)
+    return ESP_FAIL;
+  // Like the flash MMU, mapping starts at a page boundary.
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const size_t start = offset / page * page;
+  const size_t len = offset - start + size;
+  void *addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, start);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return ESP_ERR_NO_MEM;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  *out_handle = next_handle++;
+  mappings[*out_handle] = {addr, len};
+  *out_ptr = static_cast<uint8_t *>(addr) + (offset - start);
+  return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  const auto found = mappings.find(handle);
+  if (found == mappings.end())
+    return;
+  munmap(found->second.addr, found->second.len);
+  mappings.erase(found);
+}
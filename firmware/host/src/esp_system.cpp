@@ -0,0 +1,228 @@
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <sys/time.h>
+#include <sys/statvfs.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "lwip/inet.h"
+#include "ff.h"
+
+#ifndef SDCARD_ROOT
+#define SDCARD_ROOT "/sdcard"
+#endif
+
+const char *esp_err_to_name(esp_err_t code)
+{
+  switch (code)
+  {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  case ESP_ERR_NVS_NOT_FOUND:
+    return "ESP_ERR_NVS_NOT_FOUND";
+  case ESP_ERR_NVS_INVALID_HANDLE:
+    return "ESP_ERR_NVS_INVALID_HANDLE";
+  case ESP_ERR_NVS_INVALID_LENGTH:
+    return "ESP_ERR_NVS_INVALID_LENGTH";
+  case ESP_ERR_HTTPD_HANDLERS_FULL:
+    return "ESP_ERR_HTTPD_HANDLERS_FULL";
+  case ESP_ERR_HTTPD_HANDLER_EXISTS:
+    return "ESP_ERR_HTTPD_HANDLER_EXISTS";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+static esp_log_level_t log_level()
+{
+  static const esp_log_level_t level = []
+  {
+    const char *env = getenv("INKART_LOG");
+    return env ? static_cast<esp_log_level_t>(atoi(env)) : ESP_LOG_WARN;
+  }();
+  return level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+  if (level > log_level())
+    return;
+
+  static std::mutex mutex;
+  static const char letters[] = "NEWIDV";
+  std::lock_guard<std::mutex> lock(mutex);
+
+  fprintf(stderr, "%c (%s) ", letters[level], tag);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+void esp_log_level_set(const char *, esp_log_level_t)
+{
+}
+
+uint32_t esp_random(void)
+{
+  // Fixed seed so that benchmark runs are reproducible.
+  static uint32_t state = 0x1badf00d;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+  const uint8_t base[6] = {0x24, 0x0a, 0xc4, 0x12, 0x34, 0x56};
+  memcpy(mac, base, sizeof(base));
+  mac[5] += type;
+  return ESP_OK;
+}
+
+void esp_restart(void)
+{
+  exit(0);
+}
+
+int64_t esp_timer_get_time(void)
+{
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t)
+{
+  return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+  const char *env = getenv("INKART_WAKEUP");
+  return env && strcmp(env, "timer") == 0 ? ESP_SLEEP_WAKEUP_TIMER : ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+void esp_deep_sleep_start(void)
+{
+  ESP_LOGI("sleep", "Deep sleep requested; exiting");
+  exit(0);
+}
+
+// The device keeps its own clock; never let a handler touch the host's.
+extern "C" int settimeofday(const struct timeval *tv, const struct timezone *) __THROW
+{
+  ESP_LOGI("time", "settimeofday(%ld) ignored on host", tv ? (long)tv->tv_sec : 0L);
+  return 0;
+}
+
+struct esp_netif_obj
+{
+  esp_netif_ip_info_t ip_info;
+};
+
+static esp_netif_obj ap_netif = {{{0x0104a8c0}, {0x00ffffff}, {0x0104a8c0}}};
+
+esp_err_t esp_netif_init(void)
+{
+  return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_ap(void)
+{
+  return &ap_netif;
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *)
+{
+  return &ap_netif;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info)
+{
+  if (esp_netif == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  *ip_info = esp_netif->ip_info;
+  return ESP_OK;
+}
+
+char *inet_ntoa_r(uint32_t addr, char *buf, int buflen)
+{
+  snprintf(buf, buflen, "%u.%u.%u.%u", addr & 0xff, (addr >> 8) & 0xff, (addr >> 16) & 0xff, addr >> 24);
+  return buf;
+}
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+
+esp_err_t esp_event_loop_create_default(void)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t, int32_t, esp_event_handler_t, void *,
+                                              esp_event_handler_instance_t *)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t, wifi_config_t *)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+  return ESP_OK;
+}
+
+FRESULT f_getfree(const TCHAR *, DWORD *nclst, FATFS **fatfs)
+{
+  static FATFS fs;
+  struct statvfs st;
+  if (statvfs(SDCARD_ROOT, &st) != 0)
+    return FR_NOT_READY;
+
+  fs.ssize = 512;
+  fs.csize = st.f_frsize >= 512 ? st.f_frsize / 512 : 1;
+  fs.n_fatent = st.f_blocks + 2;
+  *nclst = st.f_bfree;
+  *fatfs = &fs;
+  return FR_OK;
+}
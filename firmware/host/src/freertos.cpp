@@ -0,0 +1,157 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *, uint32_t, void *parameters, UBaseType_t,
+                                   TaskHandle_t *created_task, BaseType_t)
+{
+  std::thread(task, parameters).detach();
+  if (created_task)
+    *created_task = nullptr;
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+  return xTaskCreatePinnedToCore(task, name, stack_depth, parameters, priority, created_task, 0);
+}
+
+void vTaskDelete(TaskHandle_t)
+{
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+  static thread_local char self;
+  return reinterpret_cast<TaskHandle_t>(&self);
+}
+
+struct host_queue
+{
+  size_t length;
+  size_t item_size;
+  std::deque<std::vector<uint8_t>> items;
+  std::mutex mutex;
+  std::condition_variable changed;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+  auto queue = new (std::nothrow) host_queue();
+  if (queue)
+  {
+    queue->length = length;
+    queue->item_size = item_size;
+  }
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+  delete queue;
+}
+
+// Waits for pred under lock for the given number of ticks.
+template <typename Pred>
+static bool wait(QueueHandle_t queue, std::unique_lock<std::mutex> &lock, TickType_t ticks, Pred pred)
+{
+  if (ticks == portMAX_DELAY)
+  {
+    queue->changed.wait(lock, pred);
+    return true;
+  }
+  return queue->changed.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), pred);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!wait(queue, lock, ticks_to_wait, [queue]
+            { return queue->items.size() < queue->length; }))
+    return pdFAIL;
+  const auto p = static_cast<const uint8_t *>(item);
+  queue->items.emplace_back(p, p + queue->item_size);
+  queue->changed.notify_all();
+  return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!wait(queue, lock, ticks_to_wait, [queue]
+            { return !queue->items.empty(); }))
+    return pdFAIL;
+  memcpy(buffer, queue->items.front().data(), queue->item_size);
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdPASS;
+}
+
+struct host_mutex
+{
+  std::timed_mutex mutex;
+  std::recursive_timed_mutex recursive;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return new (std::nothrow) host_mutex();
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+  delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+  if (ticks_to_wait == portMAX_DELAY)
+  {
+    semaphore->mutex.lock();
+    return pdPASS;
+  }
+  return semaphore->mutex.try_lock_for(std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS)) ? pdPASS : pdFAIL;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  semaphore->mutex.unlock();
+  return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+  return new (std::nothrow) host_mutex();
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+  if (ticks_to_wait == portMAX_DELAY)
+  {
+    semaphore->recursive.lock();
+    return pdPASS;
+  }
+  return semaphore->recursive.try_lock_for(std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS)) ? pdPASS
+                                                                                                          : pdFAIL;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore)
+{
+  semaphore->recursive.unlock();
+  return pdPASS;
+}
@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "inkplate.hpp"
+
+void ESP::delay(uint32_t ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+Inkplate::Inkplate(DisplayMode mode)
+    : mode(mode),
+      frame_3bit(WIDTH * HEIGHT / 2, 0x77),
+      frame_1bit(WIDTH * HEIGHT / 8, 0x00)
+{
+}
+
+bool Inkplate::begin(bool)
+{
+  return true;
+}
+
+void Inkplate::clearDisplay()
+{
+  if (mode == DisplayMode::INKPLATE_3BIT)
+    std::fill(frame_3bit.begin(), frame_3bit.end(), 0x77);
+  else
+    std::fill(frame_1bit.begin(), frame_1bit.end(), 0x00);
+}
+
+void Inkplate::display()
+{
+  refresh_count++;
+}
+
+void Inkplate::partialUpdate(bool)
+{
+  refresh_count++;
+}
+
+void Inkplate::selectDisplayMode(DisplayMode m)
+{
+  if (m != mode)
+  {
+    mode = m;
+    clearDisplay();
+  }
+}
+
+void Inkplate::setRotation(uint8_t r)
+{
+  rotation = r & 3;
+}
+
+void Inkplate::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+  if (x < 0 || y < 0 || x >= width() || y >= height())
+    return;
+
+  switch (rotation)
+  {
+  case 1:
+    std::swap(x, y);
+    x = WIDTH - x - 1;
+    break;
+  case 2:
+    x = WIDTH - x - 1;
+    y = HEIGHT - y - 1;
+    break;
+  case 3:
+    std::swap(x, y);
+    y = HEIGHT - y - 1;
+    break;
+  }
+
+  if (mode == DisplayMode::INKPLATE_3BIT)
+  {
+    uint8_t &b = frame_3bit[(y * WIDTH + x) >> 1];
+    const uint8_t v = color & 7;
+    b = (x & 1) ? (b & 0xf0) | v : (b & 0x0f) | (v << 4);
+  }
+  else
+  {
+    uint8_t &b = frame_1bit[(y * WIDTH + x) >> 3];
+    const uint8_t mask = 0x80 >> (x & 7);
+    b = color ? (b | mask) : (b & ~mask);
+  }
+}
+
+void Inkplate::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+  for (int16_t j = y; j < y + h; j++)
+    for (int16_t i = x; i < x + w; i++)
+      drawPixel(i, j, color);
+}
+
+void Inkplate::drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+{
+  drawLine(x, y, x + w - 1, y, color);
+  drawLine(x, y + h - 1, x + w - 1, y + h - 1, color);
+  drawLine(x, y, x, y + h - 1, color);
+  drawLine(x + w - 1, y, x + w - 1, y + h - 1, color);
+}
+
+void Inkplate::drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color)
+{
+  const int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+  const int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+  int err = dx + dy;
+  for (;;)
+  {
+    drawPixel(x0, y0, color);
+    if (x0 == x1 && y0 == y1)
+      break;
+    const int e2 = 2 * err;
+    if (e2 >= dy)
+    {
+      err += dy;
+      x0 += sx;
+    }
+    if (e2 <= dx)
+    {
+      err += dx;
+      y0 += sy;
+    }
+  }
+}
+
+void Inkplate::fillScreen(uint16_t color)
+{
+  fillRect(0, 0, width(), height(), color);
+}
+
+int Inkplate::printf(const char *format, ...)
+{
+  char buff[256];
+  va_list args;
+  va_start(args, format);
+  const int len = vsnprintf(buff, sizeof(buff), format, args);
+  va_end(args);
+
+  const uint16_t black = mode == DisplayMode::INKPLATE_3BIT ? 0 : 1;
+  const int16_t advance = (font ? font->yAdvance : 8) * text_size;
+  for (const char *c = buff; *c; c++)
+  {
+    if (*c == '\n')
+    {
+      cursor_x = 0;
+      cursor_y += advance;
+    }
+    else
+    {
+      if (*c != ' ')
+        fillRect(cursor_x, cursor_y - advance * 2 / 3, advance / 2, advance * 2 / 3, black);
+      cursor_x += advance * 7 / 12;
+    }
+  }
+  return len;
+}
+
+uint8_t Inkplate::readTouchpad(uint8_t)
+{
+  return 0;
+}
+
+const uint8_t *Inkplate::hostFrameBuffer() const
+{
+  return mode == DisplayMode::INKPLATE_3BIT ? frame_3bit.data() : frame_1bit.data();
+}
+
+size_t Inkplate::hostFrameBufferSize() const
+{
+  return mode == DisplayMode::INKPLATE_3BIT ? frame_3bit.size() : frame_1bit.size();
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+
+static uint16_t read16(const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+bool Inkplate::drawBitmap(const uint8_t *header, size_t header_len, const uint8_t *(*row)(void *, int32_t),
+                          void *ctx, int x, int y, bool dither, bool invert)
+{
+  if (header_len < 54 || header[0] != 'B' || header[1] != 'M')
+    return false;
+
+  const uint32_t info_size = read32(header + 14);
+  const int32_t w = read32(header + 18);
+  const int32_t raw_h = read32(header + 22);
+  const uint16_t bpp = read16(header + 28);
+  const uint32_t compression = read32(header + 30);
+  uint32_t colors = read32(header + 46);
+  if (w <= 0 || raw_h == 0 || compression != 0)
+    return false;
+  if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24)
+    return false;
+
+  const bool bottom_up = raw_h > 0;
+  const int32_t h = bottom_up ? raw_h : -raw_h;
+
+  uint8_t palette[256] = {};
+  if (bpp <= 8)
+  {
+    if (colors == 0 || colors > (1u << bpp))
+      colors = 1u << bpp;
+    const uint8_t *p = header + 14 + info_size;
+    if (14 + info_size + colors * 4 > header_len)
+      return false;
+    for (uint32_t i = 0; i < colors; i++, p += 4)
+      palette[i] = (p[2] * 77 + p[1] * 150 + p[0] * 29) >> 8;
+  }
+
+  std::vector<int16_t> err_cur(w + 2, 0), err_next(w + 2, 0);
+  const bool three_bit = mode == DisplayMode::INKPLATE_3BIT;
+
+  for (int32_t j = 0; j < h; j++)
+  {
+    const uint8_t *src = row(ctx, bottom_up ? h - 1 - j : j);
+    if (src == nullptr)
+      return false;
+
+    for (int32_t i = 0; i < w; i++)
+    {
+      int gray;
+      switch (bpp)
+      {
+      case 1:
+        gray = palette[(src[i >> 3] >> (7 - (i & 7))) & 1];
+        break;
+      case 4:
+        gray = palette[(i & 1) ? src[i >> 1] & 0x0f : src[i >> 1] >> 4];
+        break;
+      case 8:
+        gray = palette[src[i]];
+        break;
+      default:
+        gray = (src[i * 3 + 2] * 77 + src[i * 3 + 1] * 150 + src[i * 3] * 29) >> 8;
+        break;
+      }
+
+      uint8_t val;
+      if (dither)
+      {
+        const int want = std::clamp(gray + err_cur[i + 1], 0, 255);
+        val = three_bit ? want >> 5 : want < 128;
+        const int level = three_bit ? val * 255 / 7 : (val ? 0 : 255);
+        const int err = want - level;
+        err_cur[i + 2] += err * 7 / 16;
+        err_next[i] += err * 3 / 16;
+        err_next[i + 1] += err * 5 / 16;
+        err_next[i + 2] += err / 16;
+      }
+      else
+      {
+        val = three_bit ? gray >> 5 : gray < 128;
+      }
+      if (invert)
+        val = three_bit ? 7 - val : !val;
+      drawPixel(x + i, y + j, val);
+    }
+
+    std::swap(err_cur, err_next);
+    std::fill(err_next.begin(), err_next.end(), 0);
+  }
+  return true;
+}
+
+namespace
+{
+  struct FileRows
+  {
+    FILE *fp;
+    uint32_t offset;
+    uint32_t stride;
+    std::vector<uint8_t> buff;
+  };
+
+  const uint8_t *file_row(void *ctx, int32_t index)
+  {
+    auto rows = static_cast<FileRows *>(ctx);
+    if (fseek(rows->fp, rows->offset + index * rows->stride, SEEK_SET) != 0)
+      return nullptr;
+    if (fread(rows->buff.data(), 1, rows->stride, rows->fp) != rows->stride)
+      return nullptr;
+    return rows->buff.data();
+  }
+
+  struct BufferRows
+  {
+    const uint8_t *data;
+    uint32_t stride;
+  };
+
+  const uint8_t *buffer_row(void *ctx, int32_t index)
+  {
+    auto rows = static_cast<BufferRows *>(ctx);
+    return rows->data + index * rows->stride;
+  }
+}
+
+bool Inkplate::drawImage(const char *path, int x, int y, bool dither, bool invert)
+{
+  FILE *fp = fopen(path, "rb");
+  if (fp == nullptr)
+    return false;
+
+  uint8_t header[54 + 256 * 4];
+  const size_t header_len = fread(header, 1, sizeof(header), fp);
+  bool ret = false;
+  if (header_len >= 54)
+  {
+    const uint32_t stride = ((read32(header + 18) * read16(header + 28) + 31) / 32) * 4;
+    FileRows rows = {fp, read32(header + 10), stride, std::vector<uint8_t>(stride)};
+    ret = drawBitmap(header, header_len, file_row, &rows, x, y, dither, invert);
+  }
+  fclose(fp);
+  return ret;
+}
+
+bool Inkplate::drawBitmapFromBuffer(uint8_t *buf, int x, int y, bool dither, bool invert)
+{
+  const uint32_t stride = ((read32(buf + 18) * read16(buf + 28) + 31) / 32) * 4;
+  BufferRows rows = {buf + read32(buf + 10), stride};
+  return drawBitmap(buf, read32(buf + 10), buffer_row, &rows, x, y, dither, invert);
+}
@@ -0,0 +1,246 @@
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "nvs_flash.h"
+
+namespace
+{
+  enum class ItemType : uint8_t
+  {
+    I8,
+    U8,
+    I16,
+    U16,
+    I32,
+    U32,
+    STR,
+    BLOB,
+  };
+
+  struct Item
+  {
+    ItemType type;
+    std::vector<uint8_t> data;
+  };
+
+  struct Handle
+  {
+    std::string ns;
+    bool writable;
+  };
+
+  std::mutex mutex;
+  bool initialized = false;
+  std::map<std::string, std::map<std::string, Item>> storage;
+  std::map<nvs_handle_t, Handle> handles;
+  nvs_handle_t next_handle = 1;
+  uint32_t write_count = 0;
+
+  esp_err_t set_item(nvs_handle_t handle, const char *key, ItemType type, const void *value, size_t length)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = handles.find(handle);
+    if (iter == handles.end())
+      return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!iter->second.writable)
+      return ESP_ERR_NVS_READ_ONLY;
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+      return ESP_ERR_NVS_KEY_TOO_LONG;
+
+    write_count++;
+    auto bytes = static_cast<const uint8_t *>(value);
+    storage[iter->second.ns][key] = Item{type, std::vector<uint8_t>(bytes, bytes + length)};
+    return ESP_OK;
+  }
+
+  esp_err_t get_item(nvs_handle_t handle, const char *key, ItemType type, const Item **out)
+  {
+    auto iter = handles.find(handle);
+    if (iter == handles.end())
+      return ESP_ERR_NVS_INVALID_HANDLE;
+    auto &ns = storage[iter->second.ns];
+    auto item = ns.find(key);
+    if (item == ns.end() || item->second.type != type)
+      return ESP_ERR_NVS_NOT_FOUND;
+    *out = &item->second;
+    return ESP_OK;
+  }
+
+  template <typename T>
+  esp_err_t get_value(nvs_handle_t handle, const char *key, ItemType type, T *out_value)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Item *item;
+    auto ret = get_item(handle, key, type, &item);
+    if (ret == ESP_OK)
+      memcpy(out_value, item->data.data(), sizeof(T));
+    return ret;
+  }
+
+  esp_err_t get_bytes(nvs_handle_t handle, const char *key, ItemType type, void *out_value, size_t *length)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Item *item;
+    auto ret = get_item(handle, key, type, &item);
+    if (ret != ESP_OK)
+      return ret;
+    if (out_value == nullptr)
+    {
+      *length = item->data.size();
+      return ESP_OK;
+    }
+    if (*length < item->data.size())
+      return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(out_value, item->data.data(), item->data.size());
+    *length = item->data.size();
+    return ESP_OK;
+  }
+}
+
+esp_err_t nvs_flash_init(void)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  initialized = true;
+  return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  storage.clear();
+  return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!initialized)
+    return ESP_ERR_NVS_NOT_INITIALIZED;
+  if (open_mode == NVS_READONLY && storage.find(name) == storage.end())
+    return ESP_ERR_NVS_NOT_FOUND;
+
+  storage[name];
+  *out_handle = next_handle++;
+  handles[*out_handle] = Handle{name, open_mode == NVS_READWRITE};
+  return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  handles.erase(handle);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  write_count++;
+  return handles.count(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  auto iter = handles.find(handle);
+  if (iter == handles.end())
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  return storage[iter->second.ns].erase(key) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  auto iter = handles.find(handle);
+  if (iter == handles.end())
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  storage[iter->second.ns].clear();
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_i8(nvs_handle_t handle, const char *key, int8_t value)
+{
+  return set_item(handle, key, ItemType::I8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+  return set_item(handle, key, ItemType::U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_i16(nvs_handle_t handle, const char *key, int16_t value)
+{
+  return set_item(handle, key, ItemType::I16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value)
+{
+  return set_item(handle, key, ItemType::U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value)
+{
+  return set_item(handle, key, ItemType::I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+  return set_item(handle, key, ItemType::U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+  return set_item(handle, key, ItemType::STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+  return set_item(handle, key, ItemType::BLOB, value, length);
+}
+
+esp_err_t nvs_get_i8(nvs_handle_t handle, const char *key, int8_t *out_value)
+{
+  return get_value(handle, key, ItemType::I8, out_value);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+  return get_value(handle, key, ItemType::U8, out_value);
+}
+
+esp_err_t nvs_get_i16(nvs_handle_t handle, const char *key, int16_t *out_value)
+{
+  return get_value(handle, key, ItemType::I16, out_value);
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *out_value)
+{
+  return get_value(handle, key, ItemType::U16, out_value);
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *out_value)
+{
+  return get_value(handle, key, ItemType::I32, out_value);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+  return get_value(handle, key, ItemType::U32, out_value);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+  return get_bytes(handle, key, ItemType::STR, out_value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+  return get_bytes(handle, key, ItemType::BLOB, out_value, length);
+}
+
+uint32_t host_nvs_write_count(void)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return write_count;
+}
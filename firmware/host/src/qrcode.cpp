@@ -0,0 +1,34 @@
+#include <cstring>
+#include "qrcode.h"
+
+int8_t qrcode_initText(QRCode *qrcode, uint8_t *modules, uint8_t version, uint8_t ecc, const char *data)
+{
+  qrcode->version = version;
+  qrcode->size = 4 * version + 17;
+  qrcode->ecc = ecc;
+  qrcode->mode = 2;
+  qrcode->mask = 0;
+  qrcode->modules = modules;
+
+  uint32_t hash = 2166136261u;
+  for (const char *c = data; *c; c++)
+    hash = (hash ^ uint8_t(*c)) * 16777619u;
+
+  const size_t len = qrcode_getBufferSize(version);
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= hash << 13;
+    hash ^= hash >> 17;
+    hash ^= hash << 5;
+    modules[i] = hash;
+  }
+  return 0;
+}
+
+bool qrcode_getModule(QRCode *qrcode, uint8_t x, uint8_t y)
+{
+  if (x >= qrcode->size || y >= qrcode->size)
+    return false;
+  const uint32_t offset = y * qrcode->size + x;
+  return (qrcode->modules[offset >> 3] >> (7 - (offset & 7))) & 1;
+}
@@ -1,103 +1,150 @@
+#include <cstring>
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <fstream>
+#include <atomic>
+#include <cerrno>
+#include <memory>
+#include <new>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <strings.h>
 #include "ff.h"
 #include "lwip/inet.h"
-#include "nvs_flash.h"
 #include "esp_netif.h"
 #include "esp_http_server.h"
 #include "esp_system.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_sleep.h"
 
+#include "api.hpp"
+#include "arena.hpp"
+#include "body.hpp"
+#include "download.hpp"
+#include "events.hpp"
 #include "files.hpp"
+#include "frame.hpp"
+#include "jobs.hpp"
+#include "library.hpp"
+#include "lock.hpp"
+#include "metrics.hpp"
+#include "session.hpp"
+#include "settings.hpp"
+#include "thumbnail.hpp"
 #include "draw.hpp"
+#include "upload.hpp"
 
 #include "nlohmann/json.hpp"
 
-using nlohmann::json;
+// Handlers that build documents open an ArenaScope first, so the documents
+// live in PSRAM and are released in one step when the handler returns.
+using json = ArenaJson;
 
 static const char *TAG = "api";
 
-static const uint8_t base64table[256] =
-    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x3f, 0x3e, 0x3e, 0x3f,
-     0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-     0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
-     0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x00, 0x00, 0x00, 0x00, 0x3f,
-     0x00, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
-     0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33};
-
-#define b64d(i) ((uint32_t)base64table[(uint8_t)i])
-
-ssize_t b64decode(const char *data, const size_t len, char *buff, const size_t buflen)
+// Appends j to out.
+static void encode(const json &j, BodyFormat format, std::string &out)
 {
-  if (len == 0)
-    return 0;
-  if (len % 4 != 0)
-    return -1;
+  switch (format)
+  {
+  case BodyFormat::CBOR:
+    json::to_cbor(j, out);
+    break;
+  case BodyFormat::MSGPACK:
+    json::to_msgpack(j, out);
+    break;
+  default:
+    out += j.dump();
+    break;
+  }
+}
 
-  uint8_t pad1 = data[len - 1] == '=';
-  uint8_t pad2 = pad1 && data[len - 2] != '=';
-  const size_t last = (len - pad1) / 4 << 2;
-  const size_t total = last / 4 * 3 + pad1 + pad2;
+// Sends j in the form the client accepts, with whatever status is set.
+static void send_json(httpd_req_t *req, const json &j)
+{
+  const auto format = body_format(req, "Accept");
+  std::string str;
+  encode(j, format, str);
 
-  if (buflen < total)
-    return -1;
+  httpd_resp_set_hdr(req, "Vary", "Accept");
+  httpd_resp_set_type(req, body_type(format));
+  httpd_resp_send(req, str.data(), str.size());
+}
 
-  char *b = buff;
-  for (size_t i = 0; i < last; i += 4)
-  {
-    uint32_t n = b64d(data[i]) << 18 | b64d(data[i + 1]) << 12 | b64d(data[i + 2]) << 6 | b64d(data[i + 3]);
-    *b++ = n >> 16;
-    *b++ = n >> 8 & 0xFF;
-    *b++ = n & 0xFF;
-  }
+// The fields of one settings group in a request body, applied to a copy of
+// the stored settings.
+struct SettingsBody : BodyReader
+{
+  explicit SettingsBody(SettingsGroup group) : group(group), settings(settings_get()) {}
 
-  if (pad1)
+  bool field(const std::string &path, const nlohmann::json &value) override
   {
-    uint32_t n = b64d(data[last]) << 18 | b64d(data[last + 1]) << 12;
-    *b++ = n >> 16;
-    if (pad2)
+    if (group == SettingsGroup::TIME && path == "time")
     {
-      n |= b64d(data[last + 2]) << 6;
-      *b++ = n >> 8 & 0xFF;
+      has_time = value.is_number_unsigned();
+      if (has_time)
+        time_ms = value.get<uint64_t>();
+      else
+        invalid = true;
+      return true;
     }
+    if (settings_field_from_json(path, value, group, settings) == ESP_ERR_INVALID_ARG)
+      invalid = true;
+    return true;
   }
-  return b - buff;
-}
 
-esp_err_t parse_json(httpd_req_t *req, json &j)
+  SettingsGroup group;
+  Settings settings;
+  bool invalid = false;
+  bool has_time = false; // the clock was given along with the TIME group
+  uint64_t time_ms = 0;
+};
+
+static void job_to_json(const JobStatus &status, json &j)
 {
-  char buff[128];
-  if (req->content_len >= sizeof(buff))
+  j["id"] = status.id;
+  j["type"] = status.type;
+  j["state"] = job_state_names[size_t(status.state)];
+  if (status.state == JobState::FAILED)
   {
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Content too long");
-    return ESP_FAIL;
+    j["error"] = esp_err_to_name(status.result);
   }
+}
 
-  auto len = httpd_req_recv(req, buff, sizeof(buff));
-  if (len <= 0)
+// Hands work that would hold up the server to the job worker and answers
+// 202 with the job, which /api/v1/jobs/<id> follows to the end. ctx is
+// released here when the job cannot be queued.
+static esp_err_t submit_job(httpd_req_t *req, const char *type, job_fn_t fn, void *ctx, void (*release)(void *),
+                            json &res)
+{
+  uint32_t id;
+  const auto ret = job_submit(type, fn, ctx, id);
+  if (ret != ESP_OK)
   {
-    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read content");
+    release(ctx);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_sendstr(req, ret == ESP_ERR_NO_MEM ? "Busy" : "No job worker");
     return ESP_FAIL;
   }
 
-  buff[len] = '\0';
-  j = json::parse(buff, nullptr, false);
-  if (j.is_discarded())
-  {
-    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to parse content");
-    return ESP_FAIL;
-  }
+  char location[32];
+  snprintf(location, sizeof(location), "/api/v1/jobs/%u", id);
+  const JobStatus status = {id, type, JobState::QUEUED, ESP_OK};
+  res["status"] = "ok";
+  job_to_json(status, res["job"]);
+
+  httpd_resp_set_status(req, "202 Accepted");
+  httpd_resp_set_hdr(req, "Location", location);
+  send_json(req, res);
 
   return ESP_OK;
 }
 
-static esp_err_t system_info_get_handler(httpd_req_t *req)
+esp_err_t system_info_get_handler(httpd_req_t *req, const RouteParams &)
 {
+  ArenaScope arena;
   json j;
   j["system"]["version"] = APP_VERSION;
 
@@ -138,188 +185,135 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
     j["storage"] = nullptr;
   }
 
-  std::vector<std::string> bmps;
-  readbmps("/sdcard/", bmps);
-  j["photos"] = bmps.size();
-
-  const std::string str = j.dump(4);
+  uint32_t count, visible;
+  if (library_count(count, visible) == ESP_OK)
+  {
+    j["photos"] = count;
+  }
+  else
+  {
+    j["photos"] = nullptr;
+  }
 
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
+  send_json(req, j);
 
   return ESP_OK;
 }
 
-httpd_uri_t system_info_get_uri = {
-    .uri = "/api/v1/system/info",
-    .method = HTTP_GET,
-    .handler = system_info_get_handler,
-    .user_ctx = nullptr,
-};
-
-std::vector<std::string> orientations = {
-    "landscape",
-    "portrait-left",
-    "upside-down",
-    "portrait-right",
-};
-
-static esp_err_t system_display_get_handler(httpd_req_t *req)
+esp_err_t system_display_get_handler(httpd_req_t *req, const RouteParams &)
 {
+  ArenaScope arena;
   json j;
+  settings_to_json(settings_get(), SettingsGroup::DISPLAY, j);
 
-  nvs_handle_t handle;
-  nvs_open("system_settings", NVS_READONLY, &handle);
-
-  uint8_t val = 0;
-  nvs_get_u8(handle, "invert", &val);
-  j["invert"] = bool(val);
-  nvs_get_u8(handle, "dithering", &val);
-  j["dithering"] = bool(val);
-  nvs_get_u8(handle, "orientation", &val);
-  j["orientation"] = orientations[val];
-
-  int16_t val1 = 0;
-  nvs_get_i16(handle, "padding-top", &val1);
-  j["padding"]["top"] = val1;
-  nvs_get_i16(handle, "padding-left", &val1);
-  j["padding"]["left"] = val1;
-  nvs_get_i16(handle, "padding-right", &val1);
-  j["padding"]["right"] = val1;
-  nvs_get_i16(handle, "padding-bottom", &val1);
-  j["padding"]["bottom"] = val1;
-
-  nvs_close(handle);
-
-  const std::string str = j.dump(4);
-
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
+  send_json(req, j);
 
   return ESP_OK;
 }
 
-httpd_uri_t system_display_get_uri = {
-    .uri = "/api/v1/system/display",
-    .method = HTTP_GET,
-    .handler = system_display_get_handler,
-    .user_ctx = nullptr,
-};
-
-static esp_err_t system_display_post_handler(httpd_req_t *req)
+esp_err_t system_display_post_handler(httpd_req_t *req, const RouteParams &)
 {
-  json j;
-  auto ret = parse_json(req, j);
+  ArenaScope arena;
+  SettingsBody body(SettingsGroup::DISPLAY);
+  auto ret = receive_body(req, body);
   if (ret != ESP_OK)
   {
     return ret;
   }
-
-  nvs_handle_t handle;
-  nvs_open("system_settings", NVS_READWRITE, &handle);
-
-  uint8_t val;
-  if (j.contains("invert"))
-  {
-    val = j["invert"];
-    nvs_set_u8(handle, "invert", val);
-  }
-  if (j.contains("dithering"))
+  if (body.invalid)
   {
-    val = j["dithering"];
-    nvs_set_u8(handle, "dithering", val);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid settings");
+    return ESP_FAIL;
   }
-  if (j.contains("orientation"))
+  const Settings &settings = body.settings;
+
+  RenderOptions before;
+  load_render_options(before);
+
+  if (settings_set(settings) != ESP_OK)
   {
-    std::string orientation = j["orientation"];
-    auto iter = std::find(orientations.begin(), orientations.end(), orientation);
-    val = std::distance(orientations.begin(), iter);
-    nvs_set_u8(handle, "orientation", val);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store settings");
+    return ESP_FAIL;
   }
-  if (j.contains("padding"))
+
+  RenderOptions after;
+  load_render_options(after);
+  if (after.key() != before.key())
   {
-    int16_t val1;
-    val1 = j["padding"]["top"];
-    nvs_set_i16(handle, "padding-top", val1);
-    val1 = j["padding"]["left"];
-    nvs_set_i16(handle, "padding-left", val1);
-    val1 = j["padding"]["right"];
-    nvs_set_i16(handle, "padding-right", val1);
-    val1 = j["padding"]["bottom"];
-    nvs_set_i16(handle, "padding-bottom", val1);
+    frame_cache_clear();
   }
-  nvs_commit(handle);
-  nvs_close(handle);
 
   json ok;
   ok["status"] = "ok";
-  const std::string str = ok.dump(4);
-
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
+  send_json(req, ok);
 
   return ESP_OK;
 }
 
-httpd_uri_t system_display_post_uri = {
-    .uri = "/api/v1/system/display",
-    .method = HTTP_POST,
-    .handler = system_display_post_handler,
-    .user_ctx = nullptr,
+struct PaddingPreview
+{
+  int16_t top;
+  int16_t left;
+  int16_t right;
+  int16_t bottom;
+  uint8_t orientation;
+  bool invert;
 };
 
-static esp_err_t system_display_preview_post_handler(httpd_req_t *req)
+// Tells event subscribers what a preview is doing to the panel.
+static void display_phase(const char *phase)
 {
-  json j;
-  auto ret = parse_json(req, j);
-  if (ret != ESP_OK)
-  {
-    return ret;
-  }
+  events_publish("display", "{\"phase\":\"%s\"}", phase);
+}
 
-  bool invert = false;
-  uint8_t rotation = 0;
-  int16_t top = 0, left = 0, right = 0, bottom = 0;
+static void padding_preview_release(void *ctx)
+{
+  delete static_cast<PaddingPreview *>(ctx);
+}
 
-  if (j.contains("invert"))
+static esp_err_t padding_preview_job(void *ctx)
+{
+  std::unique_ptr<PaddingPreview> preview(static_cast<PaddingPreview *>(ctx));
+  // Drawing a few lines is nothing next to the refresh.
+  display_phase("refresh");
+  draw_padding_preview(preview->top, preview->left, preview->right, preview->bottom, preview->orientation,
+                       preview->invert);
+  display_phase("idle");
+  return ESP_OK;
+}
+
+esp_err_t system_display_preview_post_handler(httpd_req_t *req, const RouteParams &)
+{
+  ArenaScope arena;
+  // Fields left out of the request preview as they are stored.
+  SettingsBody body(SettingsGroup::DISPLAY);
+  auto ret = receive_body(req, body);
+  if (ret != ESP_OK)
   {
-    invert = j["invert"];
+    return ret;
   }
-  if (j.contains("orientation"))
+  if (body.invalid)
   {
-    std::string orientation = j["orientation"];
-    auto iter = std::find(orientations.begin(), orientations.end(), orientation);
-    rotation = std::distance(orientations.begin(), iter);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid settings");
+    return ESP_FAIL;
   }
-  if (j.contains("padding"))
+  const Settings &settings = body.settings;
+
+  auto preview = new (std::nothrow) PaddingPreview{settings.padding_top, settings.padding_left, settings.padding_right,
+                                                    settings.padding_bottom, settings.orientation, settings.invert};
+  if (preview == nullptr)
   {
-    top = j["padding"]["top"];
-    left = j["padding"]["left"];
-    right = j["padding"]["right"];
-    bottom = j["padding"]["bottom"];
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
   }
 
-  draw_padding_preview(top, left, right, bottom, rotation, invert);
-
-  json ok;
-  ok["status"] = "ok";
-  const std::string str = ok.dump(4);
-
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
-
-  return ESP_OK;
+  json res;
+  return submit_job(req, "display-preview", padding_preview_job, preview, padding_preview_release, res);
 }
 
-httpd_uri_t system_display_preview_post_uri = {
-    .uri = "/api/v1/system/display/preview",
-    .method = HTTP_POST,
-    .handler = system_display_preview_post_handler,
-    .user_ctx = nullptr,
-};
-
-static esp_err_t system_time_get_handler(httpd_req_t *req)
+esp_err_t system_time_get_handler(httpd_req_t *req, const RouteParams &)
 {
+  ArenaScope arena;
   json j;
 
   struct timeval tv_now;
@@ -327,168 +321,359 @@ static esp_err_t system_time_get_handler(httpd_req_t *req)
   uint64_t time_ms = tv_now.tv_sec * 1000LL + tv_now.tv_usec / 1000;
 
   j["time"] = time_ms;
+  settings_to_json(settings_get(), SettingsGroup::TIME, j);
 
-  nvs_handle_t handle;
-  nvs_open("system_settings", NVS_READONLY, &handle);
-
-  uint16_t val = 0;
-  nvs_get_u16(handle, "refresh", &val);
-  j["refresh"] = val;
-
-  uint8_t val2 = 0;
-  nvs_get_u8(handle, "shuffle", &val2);
-  j["shuffle"] = val2;
-
-  nvs_close(handle);
-
-  const std::string str = j.dump(4);
-
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
+  send_json(req, j);
 
   return ESP_OK;
 }
 
-httpd_uri_t system_time_get_uri = {
-    .uri = "/api/v1/system/time",
-    .method = HTTP_GET,
-    .handler = system_time_get_handler,
-    .user_ctx = nullptr,
-};
-
-static esp_err_t system_time_post_handler(httpd_req_t *req)
+esp_err_t system_time_post_handler(httpd_req_t *req, const RouteParams &)
 {
-  json j;
-  auto ret = parse_json(req, j);
+  ArenaScope arena;
+  SettingsBody body(SettingsGroup::TIME);
+  auto ret = receive_body(req, body);
   if (ret != ESP_OK)
   {
     return ret;
   }
+  if (body.invalid)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid settings");
+    return ESP_FAIL;
+  }
+  const Settings &settings = body.settings;
 
-  if (j.contains("time"))
+  if (body.has_time)
   {
-    uint64_t time_ms = j["time"];
+    const uint64_t time_ms = body.time_ms;
     struct timeval tv_now;
     tv_now.tv_sec = time_ms / 1000;
     tv_now.tv_usec = (time_ms % 1000) * 1000;
     settimeofday(&tv_now, nullptr);
   }
 
-  if (j.contains("refresh") || j.contains("shuffle"))
+  if (settings_set(settings) != ESP_OK)
   {
-    nvs_handle_t handle;
-    nvs_open("system_settings", NVS_READWRITE, &handle);
-    if (j.contains("refresh"))
-    {
-      uint16_t val = j["refresh"];
-      nvs_set_u16(handle, "refresh", val);
-    }
-    if (j.contains("shuffle"))
-    {
-      uint8_t val = j["shuffle"];
-      nvs_set_u8(handle, "shuffle", val);
-    }
-    nvs_commit(handle);
-    nvs_close(handle);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store settings");
+    return ESP_FAIL;
   }
 
   json ok;
   ok["status"] = "ok";
-  const std::string str = ok.dump(4);
-
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
+  send_json(req, ok);
 
   return ESP_OK;
 }
 
-httpd_uri_t system_time_post_uri = {
-    .uri = "/api/v1/system/time",
-    .method = HTTP_POST,
-    .handler = system_time_post_handler,
-    .user_ctx = nullptr,
-};
-
-static esp_err_t photo_list_get_handler(httpd_req_t *req)
+static json summarize(std::vector<uint32_t> &values)
 {
+  std::sort(values.begin(), values.end());
   json j;
-  j["data"] = json::array();
+  j["min"] = values.front();
+  j["median"] = values[values.size() / 2];
+  j["max"] = values.back();
+  return j;
+}
+
+// Free memory of one kind in bytes. fragmentation is the percentage of it
+// that lies outside the largest free block.
+static void heap_to_json(uint32_t caps, json &j)
+{
+  const size_t free = heap_caps_get_free_size(caps);
+  const size_t largest = heap_caps_get_largest_free_block(caps);
+  j["free"] = free;
+  j["minimum"] = heap_caps_get_minimum_free_size(caps);
+  j["largest"] = largest;
+  j["fragmentation"] = free > 0 ? 100 - largest * 100 / free : 0;
+}
+
+// Reports how long the recorded timer wakes spent in each phase, oldest
+// wake first. Times are in microseconds. heap tells whether internal RAM
+// holds up over a long setup session.
+esp_err_t system_metrics_get_handler(httpd_req_t *req, const RouteParams &)
+{
+  ArenaScope arena;
+  std::vector<WakeRecord> records;
+  wake_history(records);
 
-  std::vector<std::string> bmp_images;
-  readbmps("/sdcard/", bmp_images);
+  json j;
+  j["wakes"] = records.size();
+  j["phases"] = json::object();
+  j["history"] = json::array();
 
-  for (const auto &img : bmp_images)
+  std::vector<uint32_t> totals;
+  for (const auto &record : records)
   {
     json ent;
-    if (img[0] == '.')
+    uint32_t total = 0;
+    for (size_t p = 0; p < WAKE_PHASES; p++)
     {
-      ent["filename"] = img.substr(1);
-      ent["hidden"] = true;
+      ent[wake_phase_names[p]] = record.phase_us[p];
+      total += record.phase_us[p];
     }
-    else
+    ent["total"] = total;
+    ent["cache_hit"] = bool(record.flags & WAKE_CACHE_HIT);
+    ent["failed"] = bool(record.flags & WAKE_FAILED);
+    ent["skipped"] = bool(record.flags & WAKE_SKIPPED);
+    j["history"].push_back(ent);
+    totals.push_back(total);
+  }
+
+  if (!records.empty())
+  {
+    std::vector<uint32_t> values(records.size());
+    for (size_t p = 0; p < WAKE_PHASES; p++)
     {
-      ent["filename"] = img;
-      ent["hidden"] = false;
+      for (size_t i = 0; i < records.size(); i++)
+      {
+        values[i] = records[i].phase_us[p];
+      }
+      j["phases"][wake_phase_names[p]] = summarize(values);
     }
-    j["data"].push_back(ent);
+    j["phases"]["total"] = summarize(totals);
   }
 
-  const std::string str = j.dump(4);
+  heap_to_json(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, j["heap"]["internal"]);
+  heap_to_json(MALLOC_CAP_SPIRAM, j["heap"]["spiram"]);
+  ArenaStats stats;
+  arena_stats(stats);
+  j["heap"]["arena"]["requests"] = stats.scopes;
+  j["heap"]["arena"]["peak"] = stats.peak;
+  j["heap"]["arena"]["fallbacks"] = stats.fallbacks;
+  EventStats events;
+  events_stats(events);
+  j["events"]["published"] = events.published;
+  j["events"]["lost"] = events.lost;
+  j["events"]["subscribers"] = events.subscribers;
+
+  send_json(req, j);
 
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
+  return ESP_OK;
+}
+
+static const uint32_t photo_list_max_limit = 200;
+
+// Sends one page of the photo index in name order:
+//
+//   GET /api/v1/photos?limit=50&after=1650000000.bmp
+//
+// Without limit the whole library is listed. "next" is the cursor for the
+// following page and only present when there is one. Every page carries the
+// index generation as its ETag, so polling an unchanged library gets 304.
+esp_err_t photo_list_get_handler(httpd_req_t *req, const RouteParams &)
+{
+  ArenaScope arena;
+  uint32_t limit = UINT32_MAX;
+  char after[sizeof(PhotoRecord::name)] = "";
+  char query[128], value[16];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    if (httpd_query_key_value(query, "limit", value, sizeof(value)) == ESP_OK)
+    {
+      char *end;
+      limit = strtoul(value, &end, 10);
+      if (*end != '\0' || limit == 0 || limit > photo_list_max_limit)
+      {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid limit");
+        return ESP_FAIL;
+      }
+    }
+    httpd_query_key_value(query, "after", after, sizeof(after));
+  }
+
+  uint32_t generation;
+  ArenaVector<PhotoRecord> records;
+  bool more;
+  if (library_generation(generation) != ESP_OK || library_list(after, limit, records, more) != ESP_OK)
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read photo index");
+    return ESP_FAIL;
+  }
+
+  // Each form of the page is a representation of its own.
+  static const char *const etag_suffixes[] = {"", "-cbor", "-msgpack"};
+  const auto format = body_format(req, "Accept");
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%08x%s\"", generation, etag_suffixes[size_t(format)]);
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Vary", "Accept");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  if (etag_matches(req, etag))
+  {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, nullptr, 0);
+    return ESP_OK;
+  }
+
+  // Entries are serialised one at a time so that no document of the whole
+  // page is ever built. The binary forms frame them by hand: CBOR with
+  // indefinite lengths, MessagePack with the counts known up front.
+  httpd_resp_set_type(req, body_type(format));
+  std::string str;
+  switch (format)
+  {
+  case BodyFormat::CBOR:
+    str = "\xbf\x64" "data\x9f";
+    break;
+  case BodyFormat::MSGPACK:
+  {
+    const uint32_t n = records.size();
+    str = more ? "\x82\xa4" "data" : "\x81\xa4" "data";
+    if (n < 16)
+    {
+      str += char(0x90 | n);
+    }
+    else
+    {
+      str += n < 65536 ? '\xdc' : '\xdd';
+      for (int shift = n < 65536 ? 8 : 24; shift >= 0; shift -= 8)
+      {
+        str += char(n >> shift);
+      }
+    }
+    break;
+  }
+  default:
+    str = "{\"data\":[";
+    break;
+  }
+  httpd_resp_send_chunk(req, str.data(), str.size());
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    const auto &record = records[i];
+    // Each entry reuses the memory of the one before.
+    ArenaScope entry_arena;
+    json ent;
+    ent["filename"] = record.name;
+    ent["hidden"] = bool(record.flags & PHOTO_HIDDEN);
+    ent["size"] = record.size;
+    ent["width"] = record.width;
+    ent["height"] = record.height;
+    ent["uploaded"] = record.mtime;
+    str = format == BodyFormat::JSON && i > 0 ? "," : "";
+    encode(ent, format, str);
+    if (httpd_resp_send_chunk(req, str.data(), str.size()) != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Failed to send photo list");
+      return ESP_FAIL;
+    }
+  }
+  const json next = more ? json(records.back().name) : json();
+  switch (format)
+  {
+  case BodyFormat::CBOR:
+    str = more ? "\xff\x64" "next" : "\xff";
+    if (more)
+    {
+      encode(next, format, str);
+    }
+    str += '\xff';
+    break;
+  case BodyFormat::MSGPACK:
+    str = more ? "\xa4" "next" : "";
+    if (more)
+    {
+      encode(next, format, str);
+    }
+    break;
+  default:
+    str = more ? "],\"next\":" + next.dump() + "}" : "]}";
+    break;
+  }
+  httpd_resp_send_chunk(req, str.data(), str.size());
+  httpd_resp_send_chunk(req, nullptr, 0);
 
   return ESP_OK;
 }
 
-httpd_uri_t photo_list_get_uri = {
-    .uri = "/api/v1/photos",
-    .method = HTTP_GET,
-    .handler = photo_list_get_handler,
-    .user_ctx = nullptr,
+// Hundreds of entries of {"filename":"IMG_0001.JPG","hidden":true}.
+static const size_t photo_patch_limit = 64 * 1024;
+
+// {"data":[{"filename":...,"hidden":...},...]}
+struct PhotoPatchBody : BodyReader
+{
+  bool field(const std::string &path, const nlohmann::json &value) override
+  {
+    if (path == "data/filename")
+    {
+      has_filename = value.is_string();
+      if (has_filename)
+        change.filename = value.get<std::string>();
+    }
+    else if (path == "data/hidden")
+    {
+      has_hidden = value.is_boolean();
+      change.hidden = has_hidden && value.get<bool>();
+    }
+    return true;
+  }
+
+  bool object_end(const std::string &path) override
+  {
+    if (path != "data")
+      return true;
+    // Names come straight from the client, so they may not leave the card root.
+    if (!has_filename || !has_hidden || change.filename.find('/') != std::string::npos ||
+        change.filename[0] == '.' || !is_photo_name(change.filename))
+      invalid = true;
+    else
+      changes.push_back(std::move(change));
+    change = HiddenChange();
+    has_filename = has_hidden = false;
+    return true;
+  }
+
+  std::vector<HiddenChange> changes;
+  bool invalid = false;
+
+private:
+  HiddenChange change = {};
+  bool has_filename = false;
+  bool has_hidden = false;
 };
 
-static esp_err_t photo_list_patch_handler(httpd_req_t *req)
+esp_err_t photo_list_patch_handler(httpd_req_t *req, const RouteParams &)
 {
-  json j;
-  auto ret = parse_json(req, j);
+  ArenaScope arena;
+  PhotoPatchBody body;
+  auto ret = receive_body(req, body, photo_patch_limit);
   if (ret != ESP_OK)
   {
     return ret;
   }
+  if (body.invalid)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid photos");
+    return ESP_FAIL;
+  }
 
-  if (j.contains("data") && j["data"].is_array())
+  std::vector<HiddenChange> renamed;
+  for (auto &change : body.changes)
   {
-    for (const auto &ent : j["data"])
+    const std::string shown = SDCARD_ROOT "/" + change.filename;
+    const std::string hidden = SDCARD_ROOT "/." + change.filename;
+    const auto &old_path = change.hidden ? shown : hidden;
+    const auto &new_path = change.hidden ? hidden : shown;
+    if (rename(old_path.c_str(), new_path.c_str()) != 0)
     {
-      bool hidden = ent["hidden"];
-      std::string filename = ent["filename"];
-      std::string old_path, new_path;
-      if (hidden)
-      {
-        old_path = "/sdcard/" + filename;
-        new_path = "/sdcard/." + filename;
-      }
-      else
-      {
-        old_path = "/sdcard/." + filename;
-        new_path = "/sdcard/" + filename;
-      }
-
-      if (rename(old_path.c_str(), new_path.c_str()) != 0)
-      {
-        ret |= ESP_FAIL;
-      }
+      ret |= ESP_FAIL;
+    }
+    else
+    {
+      renamed.push_back(std::move(change));
     }
   }
+  if (!renamed.empty())
+  {
+    library_set_hidden(renamed);
+  }
 
   json res;
   res["status"] = ret == ESP_OK ? "ok" : "fail";
-  std::string str = res.dump(4);
-  httpd_resp_set_type(req, "application/json");
   if (ret == ESP_OK)
   {
-    httpd_resp_sendstr(req, str.c_str());
+    send_json(req, res);
   }
   else
   {
@@ -498,90 +683,138 @@ static esp_err_t photo_list_patch_handler(httpd_req_t *req)
   return ret;
 }
 
-httpd_uri_t photo_list_patch_uri = {
-    .uri = "/api/v1/photos",
-    .method = HTTP_PATCH,
-    .handler = photo_list_patch_handler,
-    .user_ctx = nullptr,
-};
-
-static esp_err_t photo_binary_get_handler(httpd_req_t *req)
+static const char *photo_type(const std::string &filename)
 {
-  std::string uri = req->uri;
-  const auto filename = uri.substr(uri.find_last_of("/") + 1);
+  const char *ext = filename.c_str() + filename.find_last_of(".") + 1;
+  if (strcasecmp(ext, "ink") == 0)
+    return "image/x-inkart";
+  if (strcasecmp(ext, "jpg") == 0 || strcasecmp(ext, "jpeg") == 0)
+    return "image/jpeg";
+  return "image/bmp";
+}
 
-  std::ifstream ifs("/sdcard/." + filename, std::ios::in | std::ios::binary);
-  if (!ifs)
-  {
-    ifs.open("/sdcard/" + filename, std::ios::in | std::ios::binary);
-  }
+// Photos uploaded before thumbnails existed get theirs made on the worker,
+// one at a time so that they never take the queue slots uploads need.
+static std::atomic<bool> thumbnail_queued{false};
+
+static esp_err_t thumbnail_job(void *ctx)
+{
+  std::unique_ptr<std::string> name(static_cast<std::string *>(ctx));
+  PhotoRecord record;
+  const auto ret = library_find(*name, record) == ESP_OK ? thumbnail_fill(record) : ESP_ERR_NOT_FOUND;
+  thumbnail_queued = false;
+  return ret;
+}
 
-  if (!ifs)
+esp_err_t photo_thumbnail_get_handler(httpd_req_t *req, const RouteParams &params)
+{
+  const std::string filename(params[0]);
+  PhotoRecord record;
+  if (library_find(filename, record) != ESP_OK)
   {
     ESP_LOGE(TAG, "Image not found: %s", filename.c_str());
     httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found.");
     return ESP_FAIL;
   }
 
-  httpd_resp_set_type(req, "image/bmp");
-  httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=31536000, immutable");
-
-  char buff[1024];
-  ssize_t read_bytes;
+  char etag[24];
+  const auto path = thumbnail_path(record.name);
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0)
+  {
+    make_etag(etag, sizeof(etag), st.st_size, record.mtime);
+    const Download download = {
+        path.c_str(), size_t(st.st_size), etag, "image/bmp", nullptr, "public, max-age=31536000, immutable",
+    };
+    return send_download(req, download);
+  }
 
-  do
+  // Decoding the photo here would hold up every other request, so the photo
+  // itself goes out until its thumbnail is there, revalidated each time.
+  if (!thumbnail_queued.exchange(true))
   {
-    read_bytes = ifs.readsome(buff, sizeof(buff));
-    if (read_bytes == -1)
+    uint32_t id;
+    auto name = new (std::nothrow) std::string(record.name);
+    if (name == nullptr || job_submit("thumbnail", thumbnail_job, name, id) != ESP_OK)
     {
-      ESP_LOGE(TAG, "Failed to read image: %s", filename.c_str());
+      delete name;
+      thumbnail_queued = false;
     }
-    else if (read_bytes > 0)
+  }
+  make_etag(etag, sizeof(etag), record.size, record.mtime);
+  const auto photo = photo_path(record);
+  const Download download = {
+      photo.c_str(), record.size, etag, photo_type(record.name), nullptr, "no-cache",
+  };
+  return send_download(req, download);
+}
+
+esp_err_t photo_binary_get_handler(httpd_req_t *req, const RouteParams &params)
+{
+  const std::string filename(params[0]);
+
+  // The index knows where the photo lives and what it is, so a revalidation
+  // never touches the file.
+  PhotoRecord record;
+  std::string path;
+  if (library_find(filename, record) == ESP_OK)
+  {
+    path = photo_path(record);
+  }
+  else
+  {
+    struct stat st;
+    path = SDCARD_ROOT "/." + filename;
+    if (stat(path.c_str(), &st) != 0)
     {
-      if (httpd_resp_send_chunk(req, buff, read_bytes) != ESP_OK)
+      path = SDCARD_ROOT "/" + filename;
+      if (stat(path.c_str(), &st) != 0)
       {
-        ESP_LOGE(TAG, "File sending failed: %s", filename.c_str());
-        httpd_resp_sendstr_chunk(req, nullptr);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
+        ESP_LOGE(TAG, "Image not found: %s", filename.c_str());
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found.");
         return ESP_FAIL;
       }
     }
-  } while (read_bytes > 0);
+    record.size = st.st_size;
+    record.mtime = st.st_mtime;
+  }
 
-  httpd_resp_send_chunk(req, nullptr, 0);
-  return ESP_OK;
+  char etag[24];
+  make_etag(etag, sizeof(etag), record.size, record.mtime);
+  const Download download = {
+      path.c_str(), record.size, etag, photo_type(filename), nullptr, "public, max-age=31536000, immutable",
+  };
+  return send_download(req, download);
 }
 
-httpd_uri_t photo_binary_get_uri = {
-    .uri = "/api/v1/photos/*",
-    .method = HTTP_GET,
-    .handler = photo_binary_get_handler,
-    .user_ctx = nullptr,
-};
-
-static esp_err_t photo_binary_delete_handler(httpd_req_t *req)
+esp_err_t photo_binary_delete_handler(httpd_req_t *req, const RouteParams &params)
 {
-  std::string uri = req->uri;
-  const auto filename = uri.substr(uri.find_last_of("/") + 1);
+  ArenaScope arena;
+  const std::string filename(params[0]);
 
   esp_err_t ret = ESP_OK;
-  auto filepath = "/sdcard/" + filename;
+  auto filepath = SDCARD_ROOT "/" + filename;
   if (remove(filepath.c_str()) != 0)
   {
-    filepath = "/sdcard/." + filename;
+    filepath = SDCARD_ROOT "/." + filename;
     if (remove(filepath.c_str()) != 0)
     {
       ret |= ESP_FAIL;
     }
   }
+  if (ret == ESP_OK)
+  {
+    StoreLock lock;
+    library_remove(filename);
+    frame_cache_remove(filename);
+    thumbnail_remove(filename);
+  }
 
   json res;
   res["status"] = ret == ESP_OK ? "ok" : "fail";
-  std::string str = res.dump(4);
-  httpd_resp_set_type(req, "application/json");
   if (ret == ESP_OK)
   {
-    httpd_resp_sendstr(req, str.c_str());
+    send_json(req, res);
   }
   else
   {
@@ -591,32 +824,159 @@ static esp_err_t photo_binary_delete_handler(httpd_req_t *req)
   return ret;
 }
 
-httpd_uri_t photo_binary_delete_uri = {
-    .uri = "/api/v1/photos/*",
-    .method = HTTP_DELETE,
-    .handler = photo_binary_delete_handler,
-    .user_ctx = nullptr,
+// Stores an upload and shrinks it into a thumbnail in the same pass. The
+// first bytes tell whether it is a BMP, .ink or JPEG photo.
+struct UploadTarget
+{
+  FILE *fp;
+  uint8_t magic[4];
+  size_t magic_len = 0;
+  ThumbnailStream thumbnail;
 };
 
-static esp_err_t photo_binary_post_handler(httpd_req_t *req)
+static esp_err_t upload_target_sink(void *ctx, const uint8_t *data, size_t len)
 {
-  if (req->content_len % 4 != 0)
+  auto target = static_cast<UploadTarget *>(ctx);
+  if (fwrite(data, 1, len, target->fp) != len)
+    return ESP_FAIL;
+  for (size_t i = 0; i < len && target->magic_len < sizeof(target->magic); i++)
+    target->magic[target->magic_len++] = data[i];
+  // A file the thumbnailer cannot read is still stored as it always was.
+  target->thumbnail.feed(data, len);
+  return ESP_OK;
+}
+
+// The rest of an upload once the file is in place: rendering its frame and
+// writing its thumbnail, which was made on the way in when there is a target.
+struct UploadJob
+{
+  std::string name;
+  std::unique_ptr<UploadTarget> target;
+};
+
+static void upload_job_release(void *ctx)
+{
+  delete static_cast<UploadJob *>(ctx);
+}
+
+static esp_err_t upload_job(void *ctx)
+{
+  std::unique_ptr<UploadJob> job(static_cast<UploadJob *>(ctx));
+  // The photo may have been deleted while the job was queued.
+  PhotoRecord record;
+  if (library_find(job->name, record) != ESP_OK)
   {
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid content length");
+    return ESP_ERR_NOT_FOUND;
+  }
+  // Render now so that the first wake showing this photo is a cache hit.
+  const auto ret = frame_cache_fill(record);
+  const auto thumb = job->target ? thumbnail_store(record, job->target->thumbnail) : thumbnail_fill(record);
+  return ret != ESP_OK ? ret : thumb;
+}
+
+static void send_upload_err(httpd_req_t *req, esp_err_t ret)
+{
+  if (ret == ESP_ERR_INVALID_ARG)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid content");
+  }
+  else if (ret == ESP_ERR_TIMEOUT)
+  {
+    httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, "Timed out receiving content");
+  }
+  else
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive content");
+  }
+}
+
+// Uploads within the same second are told apart by a counter after the
+// time, <sec>-<n>, and give up after this many names.
+static const int upload_name_tries = 100;
+
+static void upload_name(char *buff, size_t size, const char *dir, long stamp, int n, const char *ext)
+{
+  if (n == 0)
+    snprintf(buff, size, "%s%ld.%s", dir, stamp, ext);
+  else
+    snprintf(buff, size, "%s%ld-%d.%s", dir, stamp, n, ext);
+}
+
+// Moves a received .part file to the name of the photo, whose extension the
+// first bytes decide, taking the first name that is free shown or hidden.
+// FAT refuses to rename onto an existing file and POSIX replaces it, so the
+// name is checked first. The .part file stays where it was on failure.
+static esp_err_t rename_upload(const std::string &part, long stamp, const uint8_t *magic, size_t magic_len,
+                               std::string &name)
+{
+  const char *ext = "bmp";
+  if (magic_len >= 4 && memcmp(magic, INK_MAGIC, 4) == 0)
+    ext = "ink";
+  else if (magic_len >= 2 && magic[0] == 0xFF && magic[1] == 0xD8)
+    ext = "jpg";
+  char buff[64];
+  for (int n = 0; n < upload_name_tries; n++)
+  {
+    upload_name(buff, sizeof(buff), "", stamp, n, ext);
+    const std::string path = SDCARD_ROOT "/" + std::string(buff);
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 || stat((SDCARD_ROOT "/." + std::string(buff)).c_str(), &st) == 0)
+      continue;
+    if (rename(part.c_str(), path.c_str()) != 0)
+      break;
+    ESP_LOGI(TAG, "Create new file completed: %s", buff);
+    name = buff;
+    return ESP_OK;
+  }
+  ESP_LOGE(TAG, "Failed to rename %s", part.c_str());
+  return ESP_FAIL;
+}
+
+// Hands the rest of a stored upload to the job worker.
+static esp_err_t submit_upload(httpd_req_t *req, const std::string &name, std::unique_ptr<UploadTarget> target)
+{
+  // A photo the index does not know would fail its job and stay out of the
+  // list, so it goes again and the client is told to send it anew.
+  const auto ret = library_add(name);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to index %s: %s", name.c_str(), esp_err_to_name(ret));
+    remove((SDCARD_ROOT "/" + name).c_str());
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to index photo");
+    return ESP_FAIL;
+  }
+
+  // The photo is stored; what is left only speeds up later requests.
+  auto job = new (std::nothrow) UploadJob{name, std::move(target)};
+  if (job == nullptr)
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
     return ESP_FAIL;
   }
 
-  const size_t total_len = req->content_len;
-  size_t cur_len = 0;
+  json res;
+  res["filename"] = name;
+  return submit_job(req, "upload", upload_job, job, upload_job_release, res);
+}
 
+esp_err_t photo_binary_post_handler(httpd_req_t *req, const RouteParams &)
+{
+  ArenaScope arena;
   char buff[128];
-  char buff2[96];
   struct timeval tv_now;
   gettimeofday(&tv_now, nullptr);
-  snprintf(buff, sizeof(buff), "/sdcard/%ld.bmp", tv_now.tv_sec);
-
-  std::ofstream ofs(buff, std::ios::out | std::ios::binary);
-  if (!ofs)
+  // Received under a name the photo index ignores until the format is known,
+  // and that no other upload of the same second has taken.
+  std::unique_ptr<UploadTarget> target(new (std::nothrow) UploadTarget());
+  FILE *fp = nullptr;
+  for (int n = 0; target && fp == nullptr && n < upload_name_tries; n++)
+  {
+    upload_name(buff, sizeof(buff), SDCARD_ROOT "/", tv_now.tv_sec, n, "part");
+    fp = fopen(buff, "wx");
+    if (fp == nullptr && errno != EEXIST)
+      break;
+  }
+  if (fp == nullptr)
   {
     ESP_LOGE(TAG, "Failed to create new file");
     httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create new file");
@@ -624,128 +984,612 @@ static esp_err_t photo_binary_post_handler(httpd_req_t *req)
   }
   ESP_LOGI(TAG, "Open new file: %s", buff);
 
-  while (cur_len < total_len)
+  // Let the card see whole clusters rather than one write per TCP segment.
+  setvbuf(fp, nullptr, _IOFBF, 16384);
+  target->fp = fp;
+  auto ret = receive_upload(req, upload_target_sink, target.get());
+  if (fclose(fp) != 0 && ret == ESP_OK)
+  {
+    ret = ESP_FAIL;
+  }
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to receive %s: %s", buff, esp_err_to_name(ret));
+    remove(buff);
+    send_upload_err(req, ret);
+    return ESP_FAIL;
+  }
+  std::string name;
+  if (rename_upload(buff, tv_now.tv_sec, target->magic, target->magic_len, name) != ESP_OK)
+  {
+    remove(buff);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create new file");
+    return ESP_FAIL;
+  }
+  return submit_upload(req, name, std::move(target));
+}
+
+// Upload sessions let a photo arrive in chunks over as many connections as
+// it takes:
+//
+//   POST   /api/v1/uploads                  {"size": 1485054} opens a session
+//   PUT    /api/v1/uploads/<id>?offset=N    writes the raw body at offset N
+//   GET    /api/v1/uploads/<id>             lists the received ranges
+//   POST   /api/v1/uploads/<id>/commit      stores the photo once complete
+//   DELETE /api/v1/uploads/<id>             gives up
+//
+// A chunk cut off by a dropped connection still counts for the bytes that
+// made it to the card, so the client resends only the ranges missing from
+// the session.
+static void session_to_json(const UploadSession &session, json &j)
+{
+  char id[9];
+  snprintf(id, sizeof(id), "%08x", session.id);
+  j["id"] = id;
+  j["size"] = session.size;
+  j["received"] = json::array();
+  for (const auto &range : session.received)
   {
-    auto len = httpd_req_recv(req, buff, sizeof(buff));
-    if (len <= 0)
+    j["received"].push_back({range.first, range.second});
+  }
+}
+
+static esp_err_t send_session(httpd_req_t *req, const UploadSession &session, const char *status)
+{
+  json j;
+  session_to_json(session, j);
+
+  httpd_resp_set_status(req, status);
+  send_json(req, j);
+
+  return ESP_OK;
+}
+
+// Finds the session named by the id in /api/v1/uploads/<id>. Answers 404
+// when there is no such session.
+static UploadSession *request_session(httpd_req_t *req, std::string_view id)
+{
+  UploadSession *session = nullptr;
+  if (id.size() == 8)
+  {
+    const std::string hex(id);
+    char *end;
+    const uint32_t value = strtoul(hex.c_str(), &end, 16);
+    if (*end == '\0')
     {
-      ESP_LOGE(TAG, "Failed to receive content");
-      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive content");
-      return ESP_FAIL;
+      session = upload_session_find(value);
     }
-    auto decoded = b64decode(buff, len, buff2, sizeof(buff2));
-    if (decoded == -1)
+  }
+  if (session == nullptr)
+  {
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found.");
+  }
+  return session;
+}
+
+static esp_err_t upload_session_commit(httpd_req_t *req, UploadSession &session)
+{
+  if (!session.complete())
+  {
+    return send_session(req, session, "409 Conflict");
+  }
+
+  const auto part = upload_session_path(session.id);
+  uint8_t magic[4];
+  size_t magic_len = 0;
+  FILE *fp = fopen(part.c_str(), "rb");
+  if (fp != nullptr)
+  {
+    magic_len = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+  }
+
+  // A commit that fails keeps the session and its file, so it can be retried.
+  struct timeval tv_now;
+  gettimeofday(&tv_now, nullptr);
+  std::string name;
+  if (rename_upload(part, tv_now.tv_sec, magic, magic_len, name) != ESP_OK)
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create new file");
+    return ESP_FAIL;
+  }
+  upload_session_remove(session.id, true);
+  return submit_upload(req, name, nullptr);
+}
+
+esp_err_t upload_session_commit_handler(httpd_req_t *req, const RouteParams &params)
+{
+  ArenaScope arena;
+  UploadSession *session = request_session(req, params[0]);
+  if (session == nullptr)
+  {
+    return ESP_FAIL;
+  }
+  return upload_session_commit(req, *session);
+}
+
+// {"size":...}
+struct UploadBody : BodyReader
+{
+  bool field(const std::string &path, const nlohmann::json &value) override
+  {
+    if (path == "size")
     {
-      ESP_LOGE(TAG, "Failed to decode base64 binary");
-      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to decode base64 binary");
-      return ESP_FAIL;
+      has_size = value.is_number_unsigned();
+      size = has_size ? value.get<uint64_t>() : 0;
     }
-    else if (decoded > 0)
+    return true;
+  }
+
+  bool has_size = false;
+  uint64_t size = 0;
+};
+
+esp_err_t upload_session_post_handler(httpd_req_t *req, const RouteParams &)
+{
+  ArenaScope arena;
+  UploadBody body;
+  auto ret = receive_body(req, body);
+  if (ret != ESP_OK)
+  {
+    return ret;
+  }
+  if (!body.has_size || body.size > UPLOAD_SESSION_MAX_SIZE)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid size");
+    return ESP_FAIL;
+  }
+
+  uint32_t id;
+  ret = upload_session_create(body.size, id);
+  if (ret != ESP_OK)
+  {
+    send_upload_err(req, ret);
+    return ESP_FAIL;
+  }
+
+  char location[32];
+  snprintf(location, sizeof(location), "/api/v1/uploads/%08x", id);
+  httpd_resp_set_hdr(req, "Location", location);
+  return send_session(req, *upload_session_find(id), "201 Created");
+}
+
+struct ChunkTarget
+{
+  FILE *fp;
+  uint32_t end; // size of the session
+  uint32_t offset;
+  uint32_t written = 0;
+};
+
+static esp_err_t chunk_target_sink(void *ctx, const uint8_t *data, size_t len)
+{
+  auto target = static_cast<ChunkTarget *>(ctx);
+  if (len > target->end - target->offset - target->written)
+    return ESP_ERR_INVALID_ARG;
+  if (fwrite(data, 1, len, target->fp) != len)
+    return ESP_FAIL;
+  target->written += len;
+  return ESP_OK;
+}
+
+esp_err_t upload_session_put_handler(httpd_req_t *req, const RouteParams &params)
+{
+  ArenaScope arena;
+  UploadSession *session = request_session(req, params[0]);
+  if (session == nullptr)
+  {
+    return ESP_FAIL;
+  }
+
+  char query[64], value[16];
+  char *end = value;
+  unsigned long offset = 0;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "offset", value, sizeof(value)) == ESP_OK)
+  {
+    offset = strtoul(value, &end, 10);
+  }
+  if (end == value || *end != '\0' || offset > session->size)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid offset");
+    return ESP_FAIL;
+  }
+  // Chunks are raw, so a body that would run past the end is turned away
+  // before it can overwrite anything.
+  char content_type[32] = "";
+  httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type));
+  if (strcasecmp(content_type, "application/octet-stream") != 0 || req->content_len > session->size - offset)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid chunk");
+    return ESP_FAIL;
+  }
+
+  const auto path = upload_session_path(session->id);
+  FILE *fp = fopen(path.c_str(), "r+b");
+  if (fp == nullptr || fseek(fp, offset, SEEK_SET) != 0)
+  {
+    ESP_LOGE(TAG, "Failed to open %s", path.c_str());
+    if (fp)
     {
-      ofs.write(buff2, decoded);
+      fclose(fp);
     }
-    cur_len += len;
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to open file");
+    return ESP_FAIL;
+  }
+
+  // Let the card see whole clusters rather than one write per TCP segment.
+  setvbuf(fp, nullptr, _IOFBF, 16384);
+  ChunkTarget target = {fp, session->size, uint32_t(offset)};
+  auto ret = receive_upload(req, chunk_target_sink, &target);
+  // Whatever reached the card counts, even when the connection dropped.
+  if (fclose(fp) == 0)
+  {
+    upload_session_add(*session, target.offset, target.offset + target.written);
+  }
+  else if (ret == ESP_OK)
+  {
+    ret = ESP_FAIL;
+  }
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to receive chunk at %lu: %s", offset, esp_err_to_name(ret));
+    send_upload_err(req, ret);
+    return ESP_FAIL;
+  }
+
+  return send_session(req, *session, HTTPD_200);
+}
+
+esp_err_t upload_session_get_handler(httpd_req_t *req, const RouteParams &params)
+{
+  ArenaScope arena;
+  UploadSession *session = request_session(req, params[0]);
+  if (session == nullptr)
+  {
+    return ESP_FAIL;
+  }
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  return send_session(req, *session, HTTPD_200);
+}
+
+esp_err_t upload_session_delete_handler(httpd_req_t *req, const RouteParams &params)
+{
+  ArenaScope arena;
+  UploadSession *session = request_session(req, params[0]);
+  if (session == nullptr)
+  {
+    return ESP_FAIL;
   }
-  ESP_LOGI(TAG, "Create new file completed");
+  upload_session_remove(session->id);
 
   json res;
-  snprintf(buff, sizeof(buff), "%ld.bmp", tv_now.tv_sec);
-  res["filename"] = buff;
   res["status"] = "ok";
-  std::string str = res.dump(4);
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
+  send_json(req, res);
 
   return ESP_OK;
 }
 
-httpd_uri_t photo_binary_post_uri = {
-    .uri = "/api/v1/photos",
-    .method = HTTP_POST,
-    .handler = photo_binary_post_handler,
-    .user_ctx = nullptr,
+// Unpacks a tar archive of photos straight onto the card:
+//
+//   POST /api/v1/photos/import  (Content-Type: application/x-tar)
+//
+// Every photo keeps its name without directories, and the answer lists
+// what became of each file. The index is updated once, after the last
+// file, and the frames and thumbnails are left to a single job.
+struct ImportTarget
+{
+  uint8_t *buffer; // write buffer shared by every file
+  FILE *fp = nullptr;
+  std::string name;
+  json files = json::array();
+  std::vector<std::string> added;
 };
 
-#include "inkplate.hpp"
-extern Inkplate display;
+#define IMPORT_PART SDCARD_ROOT "/import.part"
+#define IMPORT_BUFFER_SIZE 16384
 
-static esp_err_t photo_preview_binary_post_handler(httpd_req_t *req)
+static void import_result(ImportTarget &target, const char *status)
 {
-  if (req->content_len % 4 != 0)
+  json ent;
+  ent["filename"] = target.name;
+  ent["status"] = status;
+  target.files.push_back(ent);
+}
+
+static esp_err_t import_begin(void *ctx, const char *path, uint32_t size)
+{
+  auto target = static_cast<ImportTarget *>(ctx);
+  const char *slash = strrchr(path, '/');
+  target->name = slash ? slash + 1 : path;
+
+  struct stat st;
+  if (target->name.empty() || target->name[0] == '.' || target->name.size() >= sizeof(PhotoRecord::name) ||
+      !is_photo_name(target->name) || size == 0)
   {
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid content length");
+    // Directories, macOS resource forks and anything else that is not a
+    // photo are passed over quietly.
+    if (!target->name.empty() && target->name[0] != '.')
+      import_result(*target, "skipped");
+    return ESP_OK;
+  }
+  if (stat((SDCARD_ROOT "/" + target->name).c_str(), &st) == 0 ||
+      stat((SDCARD_ROOT "/." + target->name).c_str(), &st) == 0)
+  {
+    import_result(*target, "exists");
+    return ESP_OK;
+  }
+
+  target->fp = fopen(IMPORT_PART, "wb");
+  if (target->fp == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to create %s", IMPORT_PART);
     return ESP_FAIL;
   }
+  setvbuf(target->fp, reinterpret_cast<char *>(target->buffer), _IOFBF, IMPORT_BUFFER_SIZE);
+  return ESP_OK;
+}
 
-  int16_t x, y;
-  uint8_t invert, rotation, dithering;
+static esp_err_t import_sink(void *ctx, const uint8_t *data, size_t len)
+{
+  auto target = static_cast<ImportTarget *>(ctx);
+  if (target->fp != nullptr && fwrite(data, 1, len, target->fp) != len)
+    return ESP_FAIL;
+  return ESP_OK;
+}
 
-  nvs_handle_t handle;
-  nvs_open("system_settings", NVS_READONLY, &handle);
-  nvs_get_u8(handle, "invert", &invert);
-  nvs_get_u8(handle, "dithering", &dithering);
-  nvs_get_u8(handle, "orientation", &rotation);
-  nvs_get_i16(handle, "padding-top", &y);
-  nvs_get_i16(handle, "padding-left", &x);
-  nvs_close(handle);
+static esp_err_t import_end(void *ctx)
+{
+  auto target = static_cast<ImportTarget *>(ctx);
+  if (target->fp == nullptr)
+    return ESP_OK;
 
-  const size_t total_len = req->content_len;
-  size_t cur_len = 0;
+  const bool written = fclose(target->fp) == 0;
+  target->fp = nullptr;
+  if (!written || rename(IMPORT_PART, (SDCARD_ROOT "/" + target->name).c_str()) != 0)
+  {
+    ESP_LOGE(TAG, "Failed to store %s", target->name.c_str());
+    remove(IMPORT_PART);
+    import_result(*target, "failed");
+    return ESP_FAIL;
+  }
+  import_result(*target, "ok");
+  target->added.push_back(target->name);
+  return ESP_OK;
+}
 
-  char buff[128];
-  char *buf = (char *)malloc(total_len * 3 / 4);
+static void import_job_release(void *ctx)
+{
+  delete static_cast<std::vector<std::string> *>(ctx);
+}
 
-  while (cur_len < total_len)
+static esp_err_t import_job(void *ctx)
+{
+  std::unique_ptr<std::vector<std::string>> names(static_cast<std::vector<std::string> *>(ctx));
+  esp_err_t ret = ESP_OK;
+  for (const auto &name : *names)
   {
-    auto len = httpd_req_recv(req, buff, sizeof(buff));
-    if (len <= 0)
+    PhotoRecord record;
+    if (library_find(name, record) != ESP_OK)
     {
-      ESP_LOGE(TAG, "Failed to receive content");
-      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive content");
-      return ESP_FAIL;
+      continue;
     }
-    auto buff2 = buf + (cur_len * 3 / 4);
-    auto decoded = b64decode(buff, len, buff2, len * 3 / 4);
-    if (decoded == -1)
+    const auto frame = frame_cache_fill(record);
+    const auto thumb = thumbnail_fill(record);
+    if (frame != ESP_OK || thumb != ESP_OK)
     {
-      ESP_LOGE(TAG, "Failed to decode base64 binary");
-      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to decode base64 binary");
-      return ESP_FAIL;
+      ret = frame != ESP_OK ? frame : thumb;
     }
-    cur_len += len;
   }
+  return ret;
+}
+
+static esp_err_t tar_stream_sink(void *ctx, const uint8_t *data, size_t len)
+{
+  return static_cast<TarStream *>(ctx)->feed(data, len);
+}
+
+esp_err_t photo_import_post_handler(httpd_req_t *req, const RouteParams &)
+{
+  ArenaScope arena;
+  ImportTarget target;
+  target.buffer = static_cast<uint8_t *>(malloc(IMPORT_BUFFER_SIZE));
+  if (target.buffer == nullptr)
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
+  }
+
+  TarStream tar(import_begin, import_sink, import_end, &target);
+  auto ret = receive_upload(req, tar_stream_sink, &tar);
+  if (ret == ESP_OK)
+  {
+    ret = tar.finish();
+  }
+  if (target.fp != nullptr)
+  {
+    // The archive broke off inside a photo.
+    fclose(target.fp);
+    remove(IMPORT_PART);
+    import_result(target, "failed");
+  }
+  free(target.buffer);
+
+  // Photos stored before a failure stay, so the index has to know them.
+  if (!target.added.empty())
+  {
+    library_add(target.added);
+  }
+  ESP_LOGI(TAG, "Imported %u photos", unsigned(target.added.size()));
+  if (ret == ESP_ERR_INVALID_SIZE)
+  {
+    ret = ESP_ERR_INVALID_ARG;
+  }
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to import: %s", esp_err_to_name(ret));
+    send_upload_err(req, ret);
+    return ESP_FAIL;
+  }
+
+  json res;
+  res["files"] = std::move(target.files);
+  if (target.added.empty())
+  {
+    res["status"] = "ok";
+    send_json(req, res);
+    return ESP_OK;
+  }
+
+  auto names = new (std::nothrow) std::vector<std::string>(std::move(target.added));
+  if (names == nullptr)
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
+  }
+  return submit_job(req, "import", import_job, names, import_job_release, res);
+}
+
+#include "inkplate.hpp"
+extern Inkplate display;
+
+static esp_err_t photo_stream_sink(void *ctx, const uint8_t *data, size_t len)
+{
+  return static_cast<PhotoStream *>(ctx)->feed(data, len);
+}
+
+// A preview holds a whole frame until the panel shows it, so only one at a
+// time is taken rather than one for each slot of the job queue.
+static std::atomic<bool> preview_busy{false};
+
+static void photo_preview_release(void *ctx)
+{
+  delete static_cast<Frame *>(ctx);
+  preview_busy = false;
+}
 
+static esp_err_t photo_preview_job(void *ctx)
+{
+  std::unique_ptr<Frame> frame(static_cast<Frame *>(ctx));
+  display_phase("draw");
   display.selectDisplayMode(DisplayMode::INKPLATE_3BIT);
-  display.setRotation(rotation);
-  display.drawBitmapFromBuffer((uint8_t *)buf, x, y, dithering, invert);
+  display.clearDisplay();
+  draw_frame(*frame);
+  display_phase("refresh");
   display.display();
-
-  free(buf);
+  frame.reset();
+  preview_busy = false;
+  display_phase("idle");
   ESP_LOGI(TAG, "Preview file completed");
+  return ESP_OK;
+}
+
+esp_err_t photo_preview_binary_post_handler(httpd_req_t *req, const RouteParams &)
+{
+  ArenaScope arena;
+  if (preview_busy.exchange(true))
+  {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_sendstr(req, "Busy");
+    return ESP_FAIL;
+  }
+  RenderOptions options;
+  load_render_options(options);
+
+  // Rows are rendered while the rest of the body is still on its way. The
+  // display belongs to the job worker, so they go into a frame of their own.
+  std::unique_ptr<Frame> frame(new (std::nothrow) Frame());
+  if (!frame || !frame->valid())
+  {
+    frame.reset();
+    preview_busy = false;
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
+  }
+  esp_err_t ret;
+  display_phase("decode");
+  {
+    PhotoStream stream(options, frame.get());
+    ret = receive_upload(req, photo_stream_sink, &stream);
+    if (ret == ESP_OK)
+    {
+      ret = stream.finish();
+    }
+  }
+  if (ret == ESP_ERR_INVALID_SIZE)
+  {
+    // The body ended before the last row.
+    ret = ESP_ERR_INVALID_ARG;
+  }
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to preview: %s", esp_err_to_name(ret));
+    frame.reset();
+    preview_busy = false;
+    display_phase("idle");
+    send_upload_err(req, ret);
+    return ESP_FAIL;
+  }
 
   json res;
-  res["status"] = "ok";
-  std::string str = res.dump(4);
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
+  ret = submit_job(req, "photo-preview", photo_preview_job, frame.release(), photo_preview_release, res);
+  if (ret != ESP_OK)
+  {
+    display_phase("idle");
+  }
+  return ret;
+}
+
+// Reports a job that a request handed to the worker:
+//
+//   GET /api/v1/jobs/12  {"id": 12, "type": "upload", "state": "running"}
+//
+// Failed jobs carry the error. Only the most recent jobs are remembered.
+esp_err_t job_get_handler(httpd_req_t *req, const RouteParams &params)
+{
+  ArenaScope arena;
+  const std::string id(params[0]);
+  char *end;
+  const unsigned long value = strtoul(id.c_str(), &end, 10);
+  JobStatus status;
+  if (id.empty() || *end != '\0' || value > UINT32_MAX || job_status(value, status) != ESP_OK)
+  {
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found.");
+    return ESP_FAIL;
+  }
+
+  json j;
+  job_to_json(status, j);
+
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  send_json(req, j);
 
   return ESP_OK;
 }
 
-httpd_uri_t photo_preview_binary_post_uri = {
-    .uri = "/api/v1/photos/preview",
-    .method = HTTP_POST,
-    .handler = photo_preview_binary_post_handler,
-    .user_ctx = nullptr,
-};
+// Streams progress as Server-Sent Events, so the web app need not poll:
+//
+//   GET /api/v1/events
+//
+//   event: job      {"id": 12, "type": "upload", "state": "done"}
+//   event: upload   {"received": 65536, "total": 1048576}
+//   event: display  {"phase": "refresh"}
+//   event: library  {"generation": 42}
+//
+// A client that fell too far behind gets "lost" and should reload what it
+// shows. The stream holds one of the few sockets httpd has open.
+esp_err_t events_get_handler(httpd_req_t *req, const RouteParams &)
+{
+  return events_subscribe(req);
+}
 
-static esp_err_t system_reboot_post_handler(httpd_req_t *req)
+esp_err_t system_reboot_post_handler(httpd_req_t *req, const RouteParams &)
 {
+  ArenaScope arena;
   json res;
   res["status"] = "ok";
-  std::string str = res.dump(4);
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_sendstr(req, str.c_str());
+  send_json(req, res);
 
   ESP::delay(1000);
   esp_sleep_enable_timer_wakeup(1000000);
@@ -754,9 +1598,3 @@ static esp_err_t system_reboot_post_handler(httpd_req_t *req)
   return ESP_OK;
 }
 
-httpd_uri_t system_reboot_post_uri = {
-    .uri = "/api/v1/system/reboot",
-    .method = HTTP_POST,
-    .handler = system_reboot_post_handler,
-    .user_ctx = nullptr,
-};
@@ -2,16 +2,29 @@
 
 #include "esp_http_server.h"
 
-extern httpd_uri_t system_info_get_uri;
-extern httpd_uri_t system_display_get_uri;
-extern httpd_uri_t system_display_post_uri;
-extern httpd_uri_t system_display_preview_post_uri;
-extern httpd_uri_t system_time_get_uri;
-extern httpd_uri_t system_time_post_uri;
-extern httpd_uri_t photo_list_get_uri;
-extern httpd_uri_t photo_list_patch_uri;
-extern httpd_uri_t photo_binary_get_uri;
-extern httpd_uri_t photo_binary_delete_uri;
-extern httpd_uri_t photo_binary_post_uri;
-extern httpd_uri_t photo_preview_binary_post_uri;
-extern httpd_uri_t system_reboot_post_uri;
+#include "router.hpp"
+
+// Handlers of the routes start_web_server() builds its routing table from.
+esp_err_t system_info_get_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t system_display_get_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t system_display_post_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t system_display_preview_post_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t system_time_get_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t system_time_post_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t system_metrics_get_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t system_reboot_post_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t photo_list_get_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t photo_list_patch_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t photo_binary_post_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t photo_import_post_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t photo_preview_binary_post_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t photo_binary_get_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t photo_binary_delete_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t photo_thumbnail_get_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t upload_session_post_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t upload_session_put_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t upload_session_get_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t upload_session_delete_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t upload_session_commit_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t job_get_handler(httpd_req_t *req, const RouteParams &params);
+esp_err_t events_get_handler(httpd_req_t *req, const RouteParams &params);
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "arena.hpp"
+
+static const char *TAG = "arena";
+
+static const size_t align = alignof(std::max_align_t);
+
+static size_t round_up(size_t size)
+{
+  return (size + align - 1) & ~(align - 1);
+}
+
+struct ArenaBlock
+{
+  ArenaBlock *next;
+  size_t size; // bytes after the header
+  size_t used;
+
+  uint8_t *data()
+  {
+    return reinterpret_cast<uint8_t *>(this) + round_up(sizeof(ArenaBlock));
+  }
+};
+
+// Each task serving requests has its own chain of scopes.
+static thread_local ArenaScope *current = nullptr;
+
+static std::atomic<uint32_t> scopes{0};
+static std::atomic<uint32_t> peak{0};
+static std::atomic<uint32_t> fallbacks{0};
+
+Arena::~Arena()
+{
+  while (blocks != nullptr)
+  {
+    ArenaBlock *next = blocks->next;
+    heap_caps_free(blocks);
+    blocks = next;
+  }
+  heap_caps_free(spare);
+}
+
+ArenaBlock *Arena::new_block(size_t size)
+{
+  // Blocks grow with their number, not with an oversized one before them.
+  const size_t want = std::max(size, size_t(ARENA_BLOCK_SIZE) << std::min<size_t>(count, 4));
+  if (spare != nullptr && spare->size >= size)
+  {
+    ArenaBlock *block = spare;
+    spare = nullptr;
+    return block;
+  }
+
+  const size_t bytes = round_up(sizeof(ArenaBlock)) + want;
+  void *mem = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (mem == nullptr)
+  {
+    // Boards without PSRAM still get one release per request.
+    mem = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+    if (mem == nullptr)
+    {
+      ESP_LOGE(TAG, "Failed to allocate %u bytes", unsigned(bytes));
+      return nullptr;
+    }
+  }
+  auto block = static_cast<ArenaBlock *>(mem);
+  block->size = want;
+  total += bytes;
+  high = std::max(high, total);
+  return block;
+}
+
+void *Arena::allocate(size_t size)
+{
+  size = round_up(size);
+  if (blocks == nullptr || blocks->size - blocks->used < size)
+  {
+    // The rest of a block that is too small goes unused.
+    ArenaBlock *block = new_block(size);
+    if (block == nullptr)
+      return nullptr;
+    block->next = blocks;
+    block->used = 0;
+    blocks = block;
+    count++;
+  }
+  void *ptr = blocks->data() + blocks->used;
+  blocks->used += size;
+  return ptr;
+}
+
+bool Arena::deallocate(void *ptr, size_t size)
+{
+  for (ArenaBlock *block = blocks; block != nullptr; block = block->next)
+  {
+    uint8_t *p = static_cast<uint8_t *>(ptr);
+    if (p < block->data() || p >= block->data() + block->size)
+      continue;
+    if (block == blocks && p + round_up(size) == block->data() + block->used)
+      block->used -= round_up(size);
+    return true;
+  }
+  return false;
+}
+
+Arena::Mark Arena::mark() const
+{
+  return {blocks, blocks != nullptr ? blocks->used : 0};
+}
+
+void Arena::rewind(const Mark &mark)
+{
+  while (blocks != mark.block)
+  {
+    ArenaBlock *block = blocks;
+    blocks = block->next;
+    count--;
+    // One block is kept for the next scope rather than freed and
+    // allocated again for every entry of a list.
+    if (spare != nullptr && spare->size >= block->size)
+      std::swap(spare, block);
+    if (spare != nullptr)
+    {
+      total -= round_up(sizeof(ArenaBlock)) + spare->size;
+      heap_caps_free(spare);
+    }
+    spare = block;
+  }
+  if (blocks != nullptr)
+    blocks->used = mark.used;
+}
+
+ArenaScope::ArenaScope() : arena(current != nullptr ? current->arena : &own), start(arena->mark()), outer(current)
+{
+  current = this;
+}
+
+ArenaScope::~ArenaScope()
+{
+  current = outer;
+  if (outer != nullptr)
+  {
+    arena->rewind(start);
+    return;
+  }
+  scopes++;
+  const uint32_t size = own.peak();
+  uint32_t seen = peak;
+  while (size > seen && !peak.compare_exchange_weak(seen, size))
+  {
+  }
+}
+
+void arena_stats(ArenaStats &stats)
+{
+  stats.scopes = scopes;
+  stats.peak = peak;
+  stats.fallbacks = fallbacks;
+}
+
+void *arena_allocate(size_t size)
+{
+  if (current == nullptr)
+  {
+    fallbacks++;
+    return malloc(size);
+  }
+  return current->arena->allocate(size);
+}
+
+void arena_deallocate(void *ptr, size_t size)
+{
+  if (current == nullptr || !current->arena->deallocate(ptr, size))
+    free(ptr);
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+// Size of the first block of an arena. Every further block is twice the
+// size of the one before.
+#define ARENA_BLOCK_SIZE 4096
+
+struct ArenaBlock;
+
+// Monotonic memory for the documents of one request. Blocks come from PSRAM
+// where the board has it, so the many small allocations of building JSON
+// stay out of internal RAM, and all of them go away in one step with the
+// arena. Freed memory is only reused when it was the latest allocation, as
+// when a vector grows.
+class Arena
+{
+public:
+  Arena() = default;
+  ~Arena();
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Returns nullptr when no block can be had.
+  void *allocate(size_t size);
+  // Returns false for memory that did not come from this arena.
+  bool deallocate(void *ptr, size_t size);
+
+  struct Mark
+  {
+    ArenaBlock *block;
+    size_t used;
+  };
+  Mark mark() const;
+  // Releases everything allocated since mark was taken.
+  void rewind(const Mark &mark);
+  // Most bytes the arena has held at once.
+  size_t peak() const
+  {
+    return high;
+  }
+
+private:
+  ArenaBlock *new_block(size_t size);
+
+  ArenaBlock *blocks = nullptr; // newest first
+  ArenaBlock *spare = nullptr;  // left over from a rewind
+  size_t count = 0;
+  size_t total = 0;
+  size_t high = 0;
+};
+
+// Makes an arena the one ArenaAllocator draws from on the calling task until
+// the scope ends. The outermost scope of a task owns the arena and releases
+// it; a scope opened inside another one shares that arena and rewinds it on
+// the way out, which suits a document per entry of a long list. Nothing
+// allocated within a scope may outlive it.
+class ArenaScope
+{
+public:
+  ArenaScope();
+  ~ArenaScope();
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+  friend void *arena_allocate(size_t size);
+  friend void arena_deallocate(void *ptr, size_t size);
+
+  Arena own;
+  Arena *arena;
+  Arena::Mark start;
+  ArenaScope *outer;
+};
+
+struct ArenaStats
+{
+  uint32_t scopes;    // arenas released by outermost scopes
+  uint32_t peak;      // bytes of the largest arena
+  uint32_t fallbacks; // allocations made outside any scope, from the heap
+};
+
+void arena_stats(ArenaStats &stats);
+
+// Memory from the innermost scope of the calling task, or from the heap
+// when there is none.
+void *arena_allocate(size_t size);
+void arena_deallocate(void *ptr, size_t size);
+
+template <typename T>
+class ArenaAllocator
+{
+public:
+  using value_type = T;
+
+  ArenaAllocator() = default;
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &)
+  {
+  }
+
+  T *allocate(size_t n)
+  {
+    void *ptr = arena_allocate(n * sizeof(T));
+    // Out of memory ends like it does with std::allocator without exceptions.
+    if (ptr == nullptr)
+      abort();
+    return static_cast<T *>(ptr);
+  }
+  void deallocate(T *ptr, size_t n)
+  {
+    arena_deallocate(ptr, n * sizeof(T));
+  }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U> &) const
+  {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U> &) const
+  {
+    return false;
+  }
+};
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// The documents the API builds for a response. Their members, keys and
+// strings all come from the arena of the request being served.
+using ArenaJson = nlohmann::basic_json<std::map, std::vector, ArenaString, bool, std::int64_t, std::uint64_t, double,
+                                       ArenaAllocator>;
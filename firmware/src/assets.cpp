@@ -0,0 +1,114 @@
+#include <cstring>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+
+#include "assets.hpp"
+
+static const char *TAG = "assets";
+
+static const uint8_t *image = nullptr;
+static const AssetEntry *entries = nullptr;
+static size_t count = 0;
+
+static bool terminated(const char *field, size_t size)
+{
+  return memchr(field, '\0', size) != nullptr;
+}
+
+// Everything assets_find and the handlers rely on, so that a truncated or
+// foreign image is turned away at boot rather than read past its end.
+static bool check_table(const AssetHeader &header, const AssetEntry *table)
+{
+  for (size_t i = 0; i < header.count; i++)
+  {
+    const AssetEntry &entry = table[i];
+    if (!terminated(entry.path, sizeof(entry.path)) || !terminated(entry.type, sizeof(entry.type)) ||
+        !terminated(entry.etag, sizeof(entry.etag)))
+      return false;
+    if (entry.offset > header.size || entry.length > header.size - entry.offset)
+      return false;
+    if (i > 0 && strcmp(table[i - 1].path, entry.path) >= 0)
+      return false;
+  }
+  return true;
+}
+
+esp_err_t assets_mount()
+{
+  const esp_partition_t *partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, static_cast<esp_partition_subtype_t>(ASSETS_SUBTYPE), ASSETS_LABEL);
+  if (partition == nullptr)
+  {
+    ESP_LOGE(TAG, "No %s partition", ASSETS_LABEL);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  AssetHeader header;
+  esp_err_t ret = esp_partition_read(partition, 0, &header, sizeof(header));
+  if (ret != ESP_OK)
+    return ret;
+  if (header.magic != ASSETS_MAGIC || header.version != ASSETS_VERSION)
+  {
+    ESP_LOGE(TAG, "No web app image in the %s partition", ASSETS_LABEL);
+    return ESP_ERR_INVALID_VERSION;
+  }
+  if (header.size > partition->size || header.size < sizeof(header) + header.count * sizeof(AssetEntry))
+  {
+    ESP_LOGE(TAG, "Image size %u does not fit", unsigned(header.size));
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  // Only the image is mapped, not the whole partition, to leave the data
+  // address space for others. It stays mapped until reboot.
+  const void *ptr;
+  spi_flash_mmap_handle_t handle;
+  ret = esp_partition_mmap(partition, 0, header.size, SPI_FLASH_MMAP_DATA, &ptr, &handle);
+  if (ret != ESP_OK)
+    return ret;
+
+  const auto table = reinterpret_cast<const AssetEntry *>(static_cast<const uint8_t *>(ptr) + sizeof(header));
+  if (!check_table(header, table))
+  {
+    ESP_LOGE(TAG, "Corrupted asset table");
+    spi_flash_munmap(handle);
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  image = static_cast<const uint8_t *>(ptr);
+  entries = table;
+  count = header.count;
+  ESP_LOGI(TAG, "%u assets, %u bytes", unsigned(count), unsigned(header.size));
+  return ESP_OK;
+}
+
+// Orders like strcmp with the path as a counted string.
+static int compare(const AssetEntry &entry, const char *path, size_t len)
+{
+  const int c = strncmp(entry.path, path, len);
+  if (c != 0)
+    return c;
+  return entry.path[len] == '\0' ? 0 : 1;
+}
+
+const AssetEntry *assets_find(const char *path, size_t len)
+{
+  size_t first = 0, last = count;
+  while (first < last)
+  {
+    const size_t mid = first + (last - first) / 2;
+    const int c = compare(entries[mid], path, len);
+    if (c == 0)
+      return &entries[mid];
+    if (c < 0)
+      first = mid + 1;
+    else
+      last = mid;
+  }
+  return nullptr;
+}
+
+const uint8_t *assets_data(const AssetEntry &entry)
+{
+  return image + entry.offset;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+
+// Layout of the web app image that assets.py packs from web-app/dist and
+// writes to the assets partition. All fields are little-endian. A header is
+// followed by one entry per file, sorted by path, and then the file contents.
+
+#define ASSETS_MAGIC 0x54534149 // "IAST"
+#define ASSETS_VERSION 1
+// Data partition subtype of the image, from the custom range.
+#define ASSETS_SUBTYPE 0x40
+#define ASSETS_LABEL "assets"
+
+// Content is gzip compressed and served with Content-Encoding: gzip.
+#define ASSET_GZIP 0x1
+
+struct AssetHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t size; // of the whole image
+  uint32_t reserved;
+};
+
+struct AssetEntry
+{
+  char path[56]; // URI path such as "/build/bundle.js", null terminated
+  char type[32];
+  char etag[24]; // quoted, as make_etag formats it
+  uint32_t offset; // from the start of the image
+  uint32_t length;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(AssetHeader) == 16, "AssetHeader must match assets.py");
+static_assert(sizeof(AssetEntry) == 128, "AssetEntry must match assets.py");
+
+// Maps the image into the address space. Its table is checked once here, so
+// lookups afterwards need neither a filesystem nor a file handle.
+esp_err_t assets_mount();
+
+// The entry for a URI path, or nullptr when the image has none.
+const AssetEntry *assets_find(const char *path, size_t len);
+
+// Content of an entry, straight from the mapped flash.
+const uint8_t *assets_data(const AssetEntry &entry);
@@ -0,0 +1,118 @@
+#include <cstdint>
+#include <cstring>
+#include "esp_attr.h"
+
+#include "base64.hpp"
+
+// Every character is looked up in the table for its position in the quad.
+// The entry holds its six bits already moved to where they land in the three
+// decoded bytes, read as a little-endian word, so ORing the four entries
+// yields the output word. Characters outside the alphabet also set bit 24,
+// which makes validation one test per call instead of one per character.
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "b64decode assumes a little-endian target"
+#endif
+
+static const uint32_t invalid = 0x01000000;
+
+struct DecodeTables
+{
+  uint32_t pos[4][256];
+};
+
+static constexpr uint32_t sextet(uint8_t c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+' || c == '-')
+    return 62;
+  if (c == '/' || c == '_')
+    return 63;
+  // The lenient decoder has always read these two as alphabet characters.
+  if (c == ',')
+    return invalid | 63;
+  if (c == '.')
+    return invalid | 62;
+  return invalid;
+}
+
+static constexpr DecodeTables make_tables()
+{
+  DecodeTables t = {};
+  for (uint32_t c = 0; c < 256; c++)
+  {
+    const uint32_t s = sextet(c);
+    const uint32_t v = s & 0x3f;
+    const uint32_t flag = s & invalid;
+    t.pos[0][c] = flag | v << 2;
+    t.pos[1][c] = flag | v >> 4 | (v & 0x0f) << 12;
+    t.pos[2][c] = flag | (v >> 2) << 8 | (v & 0x03) << 22;
+    t.pos[3][c] = flag | v << 16;
+  }
+  return t;
+}
+
+// Kept in internal RAM: the lookups are the whole cost of decoding.
+static DRAM_ATTR const DecodeTables tables = make_tables();
+
+ssize_t b64decode(const char *data, const size_t len, char *buff, const size_t buflen, bool strict)
+{
+  if (len == 0)
+    return 0;
+  if (len % 4 != 0)
+    return -1;
+
+  const uint8_t *in = reinterpret_cast<const uint8_t *>(data);
+  uint8_t pad1 = in[len - 1] == '=';
+  uint8_t pad2 = pad1 && in[len - 2] != '=';
+  const size_t last = (len - pad1) / 4 << 2;
+  const size_t total = last / 4 * 3 + pad1 + pad2;
+
+  if (buflen < total)
+    return -1;
+
+  const uint32_t *d0 = tables.pos[0], *d1 = tables.pos[1], *d2 = tables.pos[2], *d3 = tables.pos[3];
+  uint8_t *out = reinterpret_cast<uint8_t *>(buff);
+  uint32_t flags = 0;
+  size_t i = 0;
+
+  // Whole-word stores spill one byte into the next quad's output, so they
+  // stop one quad short of the end.
+  for (; i + 8 < last; i += 8)
+  {
+    const uint32_t w0 = d0[in[i]] | d1[in[i + 1]] | d2[in[i + 2]] | d3[in[i + 3]];
+    const uint32_t w1 = d0[in[i + 4]] | d1[in[i + 5]] | d2[in[i + 6]] | d3[in[i + 7]];
+    flags |= w0 | w1;
+    memcpy(out, &w0, 4);
+    memcpy(out + 3, &w1, 4);
+    out += 6;
+  }
+  for (; i < last; i += 4)
+  {
+    const uint32_t w = d0[in[i]] | d1[in[i + 1]] | d2[in[i + 2]] | d3[in[i + 3]];
+    flags |= w;
+    *out++ = w;
+    *out++ = w >> 8;
+    *out++ = w >> 16;
+  }
+
+  if (pad1)
+  {
+    uint32_t w = d0[in[last]] | d1[in[last + 1]];
+    if (pad2)
+      w |= d2[in[last + 2]];
+    flags |= w;
+    *out++ = w;
+    if (pad2)
+      *out++ = w >> 8;
+  }
+
+  if (strict && (flags & invalid))
+    return -1;
+  return out - reinterpret_cast<uint8_t *>(buff);
+}
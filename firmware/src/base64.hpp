@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+#include <sys/types.h>
+
+// Decodes len characters of base64, a multiple of four, into buff and
+// returns the number of bytes written, or -1. In strict mode characters
+// outside the standard and URL-safe alphabets are rejected; otherwise they
+// decode as they always have, mostly as zero bits.
+ssize_t b64decode(const char *data, const size_t len, char *buff, const size_t buflen, bool strict = false);
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "esp_log.h"
+
+#include "body.hpp"
+
+using nlohmann::json;
+
+static const char *TAG = "body";
+
+// Containers nested deeper than this are refused; no request needs them.
+static const size_t max_depth = 8;
+// Receive timeouts in a row before the body is given up on.
+static const int recv_timeout_retries = 3;
+
+static const char *const body_types[] = {"application/json", "application/cbor", "application/msgpack"};
+
+const char *body_type(BodyFormat format)
+{
+  return body_types[size_t(format)];
+}
+
+BodyFormat body_format(httpd_req_t *req, const char *field)
+{
+  char value[128] = "";
+  httpd_req_get_hdr_value_str(req, field, value, sizeof(value));
+  if (strstr(value, "application/cbor") != nullptr)
+    return BodyFormat::CBOR;
+  if (strstr(value, "application/msgpack") != nullptr || strstr(value, "application/x-msgpack") != nullptr)
+    return BodyFormat::MSGPACK;
+  return BodyFormat::JSON;
+}
+
+bool BodyReader::object_end(const std::string &path)
+{
+  return true;
+}
+
+bool BodyReader::null()
+{
+  return field(path, nullptr);
+}
+
+bool BodyReader::boolean(bool val)
+{
+  return field(path, val);
+}
+
+bool BodyReader::number_integer(number_integer_t val)
+{
+  return field(path, val);
+}
+
+bool BodyReader::number_unsigned(number_unsigned_t val)
+{
+  return field(path, val);
+}
+
+bool BodyReader::number_float(number_float_t val, const string_t &s)
+{
+  return field(path, val);
+}
+
+bool BodyReader::string(string_t &val)
+{
+  return field(path, json(std::move(val)));
+}
+
+bool BodyReader::binary(binary_t &val)
+{
+  return field(path, json::binary(std::move(val)));
+}
+
+bool BodyReader::start_object(std::size_t elements)
+{
+  if (bases.size() == max_depth)
+    return false;
+  bases.push_back(path.size());
+  return true;
+}
+
+bool BodyReader::key(string_t &val)
+{
+  const size_t base = bases.back();
+  path.resize(base);
+  if (base > 0)
+    path += '/';
+  path += val;
+  return true;
+}
+
+bool BodyReader::end_object()
+{
+  path.resize(bases.back());
+  bases.pop_back();
+  return object_end(path);
+}
+
+bool BodyReader::start_array(std::size_t elements)
+{
+  if (bases.size() == max_depth)
+    return false;
+  bases.push_back(path.size());
+  return true;
+}
+
+bool BodyReader::end_array()
+{
+  path.resize(bases.back());
+  bases.pop_back();
+  return true;
+}
+
+bool BodyReader::parse_error(std::size_t position, const std::string &last_token,
+                             const nlohmann::detail::exception &ex)
+{
+  ESP_LOGW(TAG, "Invalid body at %u: %s", unsigned(position), ex.what());
+  return false;
+}
+
+// Pulls the body off the connection a buffer at a time while the parser
+// walks it byte by byte.
+class BodyInput
+{
+public:
+  explicit BodyInput(httpd_req_t *req) : req(req), remaining(req->content_len) {}
+
+  bool empty()
+  {
+    return pos == len && !fill();
+  }
+  char peek() const
+  {
+    return buff[pos];
+  }
+  void next()
+  {
+    pos++;
+  }
+  bool failed() const
+  {
+    return error;
+  }
+  bool timed_out() const
+  {
+    return timeout;
+  }
+
+private:
+  bool fill()
+  {
+    int timeouts = 0;
+    while (remaining > 0)
+    {
+      const auto n = httpd_req_recv(req, buff, std::min(remaining, sizeof(buff)));
+      if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts <= recv_timeout_retries)
+        continue;
+      if (n <= 0)
+      {
+        ESP_LOGE(TAG, "Failed to receive content");
+        error = true;
+        timeout = n == HTTPD_SOCK_ERR_TIMEOUT;
+        remaining = 0;
+        return false;
+      }
+      remaining -= n;
+      pos = 0;
+      len = n;
+      return true;
+    }
+    return false;
+  }
+
+  httpd_req_t *req;
+  size_t remaining;
+  char buff[128];
+  size_t pos = 0;
+  size_t len = 0;
+  bool error = false;
+  bool timeout = false;
+};
+
+// The input iterator the JSON library reads through. The default one marks
+// the end of the body.
+class BodyIterator
+{
+public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = char;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const char *;
+  using reference = char;
+
+  explicit BodyIterator(BodyInput *input = nullptr) : input(input) {}
+
+  char operator*() const
+  {
+    return input->peek();
+  }
+  BodyIterator &operator++()
+  {
+    input->next();
+    return *this;
+  }
+  bool operator==(const BodyIterator &other) const
+  {
+    return at_end() == other.at_end();
+  }
+  bool operator!=(const BodyIterator &other) const
+  {
+    return !(*this == other);
+  }
+
+private:
+  bool at_end() const
+  {
+    return input == nullptr || input->empty();
+  }
+
+  BodyInput *input;
+};
+
+esp_err_t receive_body(httpd_req_t *req, BodyReader &reader, size_t limit)
+{
+  if (req->content_len > limit)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Content too long");
+    return ESP_FAIL;
+  }
+
+  json::input_format_t format;
+  switch (body_format(req, "Content-Type"))
+  {
+  case BodyFormat::CBOR:
+    format = json::input_format_t::cbor;
+    break;
+  case BodyFormat::MSGPACK:
+    format = json::input_format_t::msgpack;
+    break;
+  default:
+    format = json::input_format_t::json;
+    break;
+  }
+
+  BodyInput input(req);
+  const bool parsed = json::sax_parse(BodyIterator(&input), BodyIterator(), &reader, format, true);
+  if (input.timed_out())
+  {
+    httpd_resp_send_err(req, HTTPD_408_REQ_TIMEOUT, "Timed out receiving content");
+    return ESP_FAIL;
+  }
+  if (input.failed())
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read content");
+    return ESP_FAIL;
+  }
+  if (!parsed)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to parse content");
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
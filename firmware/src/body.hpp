@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#include "nlohmann/json.hpp"
+
+// Largest request body taken by default. Endpoints that take lists pass
+// their own limit.
+#define BODY_LIMIT 1024
+
+// Documents travel as JSON unless the client names one of the binary forms
+// the JSON library also writes, in Accept for responses and in
+// Content-Type for request bodies. Either way they carry the same fields.
+enum class BodyFormat
+{
+  JSON,
+  CBOR,
+  MSGPACK,
+};
+
+const char *body_type(BodyFormat format);
+BodyFormat body_format(httpd_req_t *req, const char *field);
+
+// Receives a request body as parser events and keeps only what it needs,
+// so no document is built. Every value comes with its path: the object
+// keys leading to it joined by '/', where array elements take the path of
+// their array. Returning false rejects the body.
+class BodyReader : public nlohmann::json_sax<nlohmann::json>
+{
+public:
+  // Called for every value that is not an object or an array.
+  virtual bool field(const std::string &path, const nlohmann::json &value) = 0;
+  // Called when an object ends, with the path the object had.
+  virtual bool object_end(const std::string &path);
+
+  bool null() override;
+  bool boolean(bool val) override;
+  bool number_integer(number_integer_t val) override;
+  bool number_unsigned(number_unsigned_t val) override;
+  bool number_float(number_float_t val, const string_t &s) override;
+  bool string(string_t &val) override;
+  bool binary(binary_t &val) override;
+  bool start_object(std::size_t elements) override;
+  bool key(string_t &val) override;
+  bool end_object() override;
+  bool start_array(std::size_t elements) override;
+  bool end_array() override;
+  bool parse_error(std::size_t position, const std::string &last_token,
+                   const nlohmann::detail::exception &ex) override;
+
+private:
+  std::string path;
+  std::vector<uint16_t> bases; // length of path where each open container starts
+};
+
+// Reads a JSON, CBOR or MessagePack body of at most limit bytes from the
+// connection and feeds it to reader. On failure the error response has
+// been sent.
+esp_err_t receive_body(httpd_req_t *req, BodyReader &reader, size_t limit = BODY_LIMIT);
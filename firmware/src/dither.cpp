@@ -0,0 +1,211 @@
+#include <cstring>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "dither.hpp"
+
+static const char *TAG = "dither";
+
+const char *const dither_names[DITHERS] = {
+    "none", "floyd-steinberg", "atkinson", "stucki", "bayer", "blue-noise",
+};
+
+#define PAD 2
+
+// Gray value of each level, for the error left after quantising.
+static const int16_t level_gray[8] = {0, 36, 72, 109, 145, 182, 218, 255};
+
+// 8x8 Bayer matrix, its ranks scaled to thresholds in [0, 256).
+static const uint8_t bayer[64] = {
+    2,   130, 34,  162, 10,  138, 42,  170,
+    194, 66,  226, 98,  202, 74,  234, 106,
+    50,  178, 18,  146, 58,  186, 26,  154,
+    242, 114, 210, 82,  250, 122, 218, 90,
+    14,  142, 46,  174, 6,   134, 38,  166,
+    206, 78,  238, 110, 198, 70,  230, 102,
+    62,  190, 30,  158, 54,  182, 22,  150,
+    254, 126, 222, 94,  246, 118, 214, 86,
+};
+
+// 16x16 blue noise ranks from the void-and-cluster method (Ulichney, 1993,
+// Gaussian sigma 1.5). Unlike Bayer it leaves no visible grid.
+static const uint8_t blue_noise[256] = {
+    120, 61,  134, 223, 84,  33,  168, 12,  113, 225, 63,  246, 185, 233, 88,  169,
+    23,  206, 181, 17,  109, 214, 58,  140, 201, 24,  161, 93,  34,  133, 14,  221,
+    144, 73,  250, 49,  158, 187, 81,  251, 100, 51,  142, 210, 172, 57,  191, 106,
+    42,  167, 101, 126, 220, 3,   121, 40,  170, 231, 82,  8,   114, 254, 80,  232,
+    212, 11,  195, 31,  72,  239, 152, 196, 16,  127, 188, 222, 45,  157, 26,  128,
+    154, 87,  235, 143, 179, 94,  54,  108, 237, 65,  29,  105, 139, 207, 184, 66,
+    248, 47,  115, 62,  209, 20,  164, 217, 79,  146, 178, 243, 69,  90,  1,   118,
+    30,  190, 173, 6,   131, 255, 41,  136, 10,  204, 43,  159, 22,  229, 162, 218,
+    77,  148, 99,  226, 74,  182, 117, 192, 86,  247, 119, 97,  197, 130, 53,  103,
+    242, 19,  198, 44,  155, 96,  59,  230, 28,  165, 60,  5,   240, 39,  175, 202,
+    137, 64,  122, 238, 25,  211, 0,   149, 104, 224, 135, 183, 151, 71,  112, 9,
+    91,  213, 166, 85,  186, 111, 249, 174, 48,  75,  208, 32,  89,  205, 236, 160,
+    37,  252, 18,  55,  138, 38,  78,  123, 194, 13,  107, 253, 124, 15,  56,  189,
+    76,  145, 110, 228, 203, 163, 219, 21,  241, 141, 171, 50,  156, 227, 102, 129,
+    2,   199, 176, 68,  7,   98,  52,  150, 92,  36,  215, 83,  200, 27,  177, 216,
+    244, 95,  35,  153, 245, 125, 193, 234, 70,  180, 132, 4,   116, 67,  147, 46,
+};
+
+Ditherer::Ditherer(Dither method, int32_t width) : method(method), width(width)
+{
+  switch (method)
+  {
+  case Dither::FLOYD_STEINBERG:
+    rows = 2;
+    break;
+  case Dither::ATKINSON:
+  case Dither::STUCKI:
+    rows = 3;
+    break;
+  default:
+    return;
+  }
+
+  // Error rows are touched for every pixel, so keep them out of PSRAM.
+  const size_t row_len = width + 2 * PAD;
+  block = static_cast<int16_t *>(
+      heap_caps_calloc(rows * row_len, sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+  if (block == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to allocate error rows");
+    return;
+  }
+  for (int i = 0; i < rows; i++)
+    err[i] = block + i * row_len;
+}
+
+Ditherer::~Ditherer()
+{
+  heap_caps_free(block);
+}
+
+static inline int32_t clamp(int32_t v)
+{
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Moves on to the next row: the row below becomes the current one and the
+// one that drops off is cleared for reuse at the bottom.
+void Ditherer::advance()
+{
+  int16_t *done = err[0];
+  for (int i = 0; i + 1 < rows; i++)
+    err[i] = err[i + 1];
+  err[rows - 1] = done;
+  memset(done, 0, (width + 2 * PAD) * sizeof(int16_t));
+}
+
+// The weights and truncating division of the InkPlate driver, so that a
+// frame matches what drawImage() would have drawn.
+void Ditherer::floyd_steinberg(const uint8_t *gray, uint8_t *levels)
+{
+  int16_t *cur = err[0] + PAD;
+  int16_t *next = err[1] + PAD;
+  for (int32_t i = 0; i < width; i++)
+  {
+    const int32_t v = clamp(gray[i] + cur[i]);
+    const int32_t q = v >> 5;
+    const int32_t e = v - level_gray[q];
+    cur[i + 1] += e * 7 / 16;
+    next[i - 1] += e * 3 / 16;
+    next[i] += e * 5 / 16;
+    next[i + 1] += e / 16;
+    levels[i] = q;
+  }
+}
+
+// Spreads six eighths of the error, which keeps highlights and shadows
+// clean at the cost of some detail.
+void Ditherer::atkinson(const uint8_t *gray, uint8_t *levels)
+{
+  int16_t *cur = err[0] + PAD;
+  int16_t *next = err[1] + PAD;
+  int16_t *next2 = err[2] + PAD;
+  for (int32_t i = 0; i < width; i++)
+  {
+    const int32_t v = clamp(gray[i] + cur[i]);
+    const int32_t q = v >> 5;
+    const int32_t e = (v - level_gray[q]) / 8;
+    cur[i + 1] += e;
+    cur[i + 2] += e;
+    next[i - 1] += e;
+    next[i] += e;
+    next[i + 1] += e;
+    next2[i] += e;
+    levels[i] = q;
+  }
+}
+
+// Twelve neighbours with weights in 42nds, divided through a 16-bit
+// reciprocal with rounding.
+void Ditherer::stucki(const uint8_t *gray, uint8_t *levels)
+{
+  int16_t *cur = err[0] + PAD;
+  int16_t *next = err[1] + PAD;
+  int16_t *next2 = err[2] + PAD;
+  for (int32_t i = 0; i < width; i++)
+  {
+    const int32_t v = clamp(gray[i] + cur[i]);
+    const int32_t q = v >> 5;
+    const int32_t f = (v - level_gray[q]) * 1560; // 65536 / 42
+    const int32_t e1 = (f + 32768) >> 16;
+    const int32_t e2 = (f * 2 + 32768) >> 16;
+    const int32_t e4 = (f * 4 + 32768) >> 16;
+    const int32_t e8 = (f * 8 + 32768) >> 16;
+    cur[i + 1] += e8;
+    cur[i + 2] += e4;
+    next[i - 2] += e2;
+    next[i - 1] += e4;
+    next[i] += e8;
+    next[i + 1] += e4;
+    next[i + 2] += e2;
+    next2[i - 2] += e1;
+    next2[i - 1] += e2;
+    next2[i] += e4;
+    next2[i + 1] += e2;
+    next2[i + 2] += e1;
+    levels[i] = q;
+  }
+}
+
+// Places each pixel between the two nearest levels in 8-bit fixed point
+// and rounds up where the fraction passes the threshold of its cell.
+void Ditherer::ordered(const uint8_t *gray, uint8_t *levels, const uint8_t *thresholds, int32_t period)
+{
+  const int32_t mask = period - 1;
+  for (int32_t i = 0; i < width; i++)
+  {
+    const int32_t p = (gray[i] * (7 * 256) + 127) / 255;
+    const int32_t q = p >> 8;
+    levels[i] = q + (q < 7 && (p & 0xff) > thresholds[i & mask]);
+  }
+}
+
+void Ditherer::row(int32_t y, const uint8_t *gray, uint8_t *levels)
+{
+  switch (method)
+  {
+  case Dither::FLOYD_STEINBERG:
+    floyd_steinberg(gray, levels);
+    break;
+  case Dither::ATKINSON:
+    atkinson(gray, levels);
+    break;
+  case Dither::STUCKI:
+    stucki(gray, levels);
+    break;
+  case Dither::BAYER:
+    ordered(gray, levels, bayer + (y & 7) * 8, 8);
+    return;
+  case Dither::BLUE_NOISE:
+    ordered(gray, levels, blue_noise + (y & 15) * 16, 16);
+    return;
+  default:
+    for (int32_t i = 0; i < width; i++)
+      levels[i] = gray[i] >> 5;
+    return;
+  }
+  advance();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// How gray levels are brought down to the eight the panel shows. The values
+// are stored in settings and frame cache keys, so new ones go at the end.
+enum class Dither : uint8_t
+{
+  NONE,
+  FLOYD_STEINBERG,
+  ATKINSON,
+  STUCKI,
+  BAYER,
+  BLUE_NOISE,
+  COUNT,
+};
+
+static const size_t DITHERS = size_t(Dither::COUNT);
+
+// JSON names of the methods.
+extern const char *const dither_names[DITHERS];
+
+// Turns rows of 8-bit gray into panel levels 0 to 7, where 7 is white.
+// Error diffusion carries error to the rows handed over after the current
+// one, whichever way the image runs; ordered methods only look at the row
+// number. Arithmetic is integer throughout, with error rows in internal RAM.
+class Ditherer
+{
+public:
+  Ditherer(Dither method, int32_t width);
+  ~Ditherer();
+  Ditherer(const Ditherer &) = delete;
+  Ditherer &operator=(const Ditherer &) = delete;
+
+  // False when there was no memory for the error rows.
+  bool valid() const { return rows == 0 || block != nullptr; }
+  // True for methods that carry error from row to row.
+  bool diffuses() const { return rows > 0; }
+  void row(int32_t y, const uint8_t *gray, uint8_t *levels);
+
+private:
+  void floyd_steinberg(const uint8_t *gray, uint8_t *levels);
+  void atkinson(const uint8_t *gray, uint8_t *levels);
+  void stucki(const uint8_t *gray, uint8_t *levels);
+  void ordered(const uint8_t *gray, uint8_t *levels, const uint8_t *thresholds, int32_t period);
+  void advance();
+
+  const Dither method;
+  const int32_t width;
+  int rows = 0;          // error rows in use: the current one and those below
+  int16_t *block = nullptr;
+  int16_t *err[3] = {};  // two columns of padding on either side
+};
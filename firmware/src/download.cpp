@@ -0,0 +1,205 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "esp_log.h"
+
+#include "download.hpp"
+
+static const char *TAG = "download";
+
+static const size_t send_buffer_size = 4096;
+
+void make_etag(char *buff, size_t len, uint32_t size, uint32_t version)
+{
+  snprintf(buff, len, "\"%x-%x\"", size, version);
+}
+
+// If-None-Match uses the weak comparison, so W/ prefixes are ignored.
+static bool etag_listed(const char *list, const char *etag)
+{
+  const size_t etag_len = strlen(etag);
+  const char *p = list;
+  while (*p)
+  {
+    p += strspn(p, " \t,");
+    if (*p == '*')
+      return true;
+    if (strncmp(p, "W/", 2) == 0)
+      p += 2;
+    const size_t n = strcspn(p, ",");
+    size_t len = n;
+    while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t'))
+      len--;
+    if (len == etag_len && strncmp(p, etag, len) == 0)
+      return true;
+    p += n;
+  }
+  return false;
+}
+
+enum class RangeResult
+{
+  NONE,
+  SATISFIABLE,
+  UNSATISFIABLE,
+};
+
+// Only a single range is served; anything else gets the whole file, which
+// RFC 9110 allows.
+static RangeResult parse_range(const char *value, size_t size, size_t &first, size_t &last)
+{
+  if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ',') != nullptr)
+    return RangeResult::NONE;
+  const char *p = value + 6;
+  char *end;
+
+  if (*p == '-')
+  {
+    const unsigned long suffix = strtoul(p + 1, &end, 10);
+    if (end == p + 1 || *end != '\0')
+      return RangeResult::NONE;
+    if (suffix == 0 || size == 0)
+      return RangeResult::UNSATISFIABLE;
+    first = suffix < size ? size - suffix : 0;
+    last = size - 1;
+    return RangeResult::SATISFIABLE;
+  }
+
+  first = strtoul(p, &end, 10);
+  if (end == p || *end != '-')
+    return RangeResult::NONE;
+  p = end + 1;
+  if (*p == '\0')
+  {
+    last = size - 1;
+  }
+  else
+  {
+    last = strtoul(p, &end, 10);
+    if (*end != '\0' || last < first)
+      return RangeResult::NONE;
+    if (last >= size)
+      last = size - 1;
+  }
+  return first < size ? RangeResult::SATISFIABLE : RangeResult::UNSATISFIABLE;
+}
+
+static esp_err_t send_all(httpd_req_t *req, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    const int sent = httpd_send(req, buf, len);
+    if (sent == HTTPD_SOCK_ERR_TIMEOUT)
+      continue;
+    if (sent < 0)
+      return ESP_FAIL;
+    buf += sent;
+    len -= sent;
+  }
+  return ESP_OK;
+}
+
+// Reads a request header into buff, leaving it empty when absent.
+static bool get_header(httpd_req_t *req, const char *field, char *buff, size_t len)
+{
+  buff[0] = '\0';
+  return httpd_req_get_hdr_value_str(req, field, buff, len) == ESP_OK;
+}
+
+bool etag_matches(httpd_req_t *req, const char *etag)
+{
+  char value[128];
+  return get_header(req, "If-None-Match", value, sizeof(value)) && etag_listed(value, etag);
+}
+
+esp_err_t send_download(httpd_req_t *req, const Download &download)
+{
+  char value[128];
+  char head[512];
+  int head_len;
+
+  if (etag_matches(req, download.etag))
+  {
+    head_len = snprintf(head, sizeof(head), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%s%s%s\r\n", download.etag,
+                        download.cache_control ? "Cache-Control: " : "",
+                        download.cache_control ? download.cache_control : "", download.cache_control ? "\r\n" : "");
+    return send_all(req, head, head_len);
+  }
+
+  size_t first = 0, last = download.size - 1;
+  RangeResult range = RangeResult::NONE;
+  if (get_header(req, "Range", value, sizeof(value)))
+  {
+    char if_range[64];
+    // A stale If-Range asks for the whole file instead.
+    if (!get_header(req, "If-Range", if_range, sizeof(if_range)) || strcmp(if_range, download.etag) == 0)
+      range = parse_range(value, download.size, first, last);
+  }
+
+  if (range == RangeResult::UNSATISFIABLE)
+  {
+    head_len = snprintf(head, sizeof(head),
+                        "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%zu\r\nContent-Length: 0\r\n\r\n",
+                        download.size);
+    return send_all(req, head, head_len);
+  }
+
+  const size_t length = download.size == 0 ? 0 : last - first + 1;
+  head_len = snprintf(head, sizeof(head),
+                      "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nETag: %s\r\nAccept-Ranges: bytes\r\n",
+                      range == RangeResult::SATISFIABLE ? "206 Partial Content" : "200 OK", download.type, length,
+                      download.etag);
+  if (range == RangeResult::SATISFIABLE)
+    head_len += snprintf(head + head_len, sizeof(head) - head_len, "Content-Range: bytes %zu-%zu/%zu\r\n", first, last,
+                         download.size);
+  if (download.encoding)
+    head_len += snprintf(head + head_len, sizeof(head) - head_len, "Content-Encoding: %s\r\n", download.encoding);
+  if (download.cache_control)
+    head_len += snprintf(head + head_len, sizeof(head) - head_len, "Cache-Control: %s\r\n", download.cache_control);
+  head_len += snprintf(head + head_len, sizeof(head) - head_len, "\r\n");
+
+  if (req->method == HTTP_HEAD || length == 0)
+    return send_all(req, head, head_len);
+
+  if (download.data != nullptr)
+  {
+    const esp_err_t ret = send_all(req, head, head_len);
+    if (ret != ESP_OK)
+      return ret;
+    return send_all(req, static_cast<const char *>(download.data) + first, length);
+  }
+
+  FILE *fp = fopen(download.path, "rb");
+  char *buff = static_cast<char *>(malloc(send_buffer_size));
+  esp_err_t ret = fp && buff ? ESP_OK : ESP_FAIL;
+  if (ret == ESP_OK && first > 0 && fseek(fp, first, SEEK_SET) != 0)
+    ret = ESP_FAIL;
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to open %s", download.path);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read file");
+  }
+  else
+  {
+    ret = send_all(req, head, head_len);
+  }
+
+  size_t remaining = length;
+  while (ret == ESP_OK && remaining > 0)
+  {
+    const size_t n = fread(buff, 1, remaining < send_buffer_size ? remaining : send_buffer_size, fp);
+    if (n == 0)
+    {
+      // Headers are gone already; all that is left is to drop the connection.
+      ESP_LOGE(TAG, "Failed to read %s", download.path);
+      ret = ESP_FAIL;
+      break;
+    }
+    ret = send_all(req, buff, n);
+    remaining -= n;
+  }
+  if (fp)
+    fclose(fp);
+  free(buff);
+  return ret;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// A file to answer a GET or HEAD request with.
+struct Download
+{
+  const char *path;           // read unless data is set
+  size_t size;
+  const char *etag;           // quoted strong validator of this exact content
+  const char *type;
+  const char *encoding;       // Content-Encoding, or nullptr
+  const char *cache_control;  // or nullptr
+  const void *data = nullptr; // content already in memory
+};
+
+// Formats a strong ETag from the file size and a value that changes with
+// its content, such as the modification time or a hash.
+void make_etag(char *buff, size_t len, uint32_t size, uint32_t version);
+
+// Whether the request's If-None-Match lists this ETag.
+bool etag_matches(httpd_req_t *req, const char *etag);
+
+// Sends the file, answering If-None-Match with 304, HEAD with the headers
+// alone and a single byte Range with 206. The response is written with
+// httpd_send() so that every status carries the real Content-Length.
+// Content in memory goes out without being copied to a send buffer first.
+esp_err_t send_download(httpd_req_t *req, const Download &download);
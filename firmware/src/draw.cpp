@@ -3,6 +3,8 @@
 #include "inkplate.hpp"
 #include "qrcode.h"
 
+#include "frame.hpp"
+
 #undef PROGMEM
 #define PROGMEM
 #include "fonts/FreeMonoBold12pt7b.h"
@@ -89,3 +91,22 @@ void draw_padding_preview(int16_t top, int16_t left, int16_t right, int16_t bott
 
   display.display();
 }
+
+void draw_frame(const Frame &frame)
+{
+  // The driver has no way to take a whole buffer, so copy pixel by pixel
+  // with rotation off. The display has just been cleared, which leaves
+  // white pixels nothing to do.
+  const auto rotation = display.getRotation();
+  display.setRotation(0);
+  for (int16_t py = 0; py < PANEL_HEIGHT; py++)
+  {
+    for (int16_t px = 0; px < PANEL_WIDTH; px++)
+    {
+      const uint8_t color = frame.get(px, py);
+      if (color != 7)
+        display.drawPixel(px, py, color);
+    }
+  }
+  display.setRotation(rotation);
+}
@@ -0,0 +1,242 @@
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "events.hpp"
+
+static const char *TAG = "events";
+
+struct Event
+{
+  uint32_t id;
+  char type[12];
+  char data[EVENT_DATA_SIZE];
+};
+
+// One open stream. It is the session context of its socket, so httpd frees
+// it when the socket closes, and it is only touched on the server task.
+struct Subscriber
+{
+  httpd_handle_t server;
+  int fd;
+  uint32_t next;                  // id of the first event not yet formatted
+  bool lost;                      // a "lost" event is due before the next one
+  bool closing;                   // the socket failed and is being closed
+  char out[EVENT_DATA_SIZE + 48]; // the event being written out
+  size_t len;
+  size_t sent;
+};
+
+static SemaphoreHandle_t lock = nullptr;
+static Event ring[EVENT_RING_SIZE];
+static uint32_t last_id = 0;
+
+static Subscriber *subscribers[EVENT_SUBSCRIBERS];
+static std::atomic<uint32_t> subscriber_count{0};
+static std::atomic<httpd_handle_t> server{nullptr};
+static std::atomic<TaskHandle_t> server_task{nullptr};
+static std::atomic<bool> flush_pending{false};
+
+static std::atomic<uint32_t> published{0};
+static std::atomic<uint32_t> lost{0};
+
+// Formats the next event the subscriber has not seen. Returns false when it
+// is up to date.
+static bool next_event(Subscriber *sub)
+{
+  Event event;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  const uint32_t oldest = last_id >= EVENT_RING_SIZE ? last_id - EVENT_RING_SIZE + 1 : 1;
+  if (!sub->lost && sub->next < oldest)
+  {
+    sub->lost = true;
+    sub->next = oldest;
+  }
+  const bool due = sub->lost || sub->next <= last_id;
+  if (due && !sub->lost)
+    event = ring[sub->next++ % EVENT_RING_SIZE];
+  xSemaphoreGive(lock);
+  if (!due)
+    return false;
+
+  // Events in between are gone; the client has to fetch what it shows anew.
+  int len;
+  if (sub->lost)
+  {
+    sub->lost = false;
+    lost++;
+    len = snprintf(sub->out, sizeof(sub->out), "event: lost\ndata: {}\n\n");
+  }
+  else
+  {
+    len = snprintf(sub->out, sizeof(sub->out), "id: %u\nevent: %s\ndata: %s\n\n", unsigned(event.id), event.type,
+                   event.data);
+  }
+  sub->len = len;
+  sub->sent = 0;
+  return true;
+}
+
+// Writes out as much as the socket takes without blocking. What is left
+// waits for the next flush. Returns false when the socket failed.
+static bool pump(Subscriber *sub)
+{
+  for (;;)
+  {
+    if (sub->sent == sub->len && !next_event(sub))
+      return true;
+    const int sent = httpd_socket_send(sub->server, sub->fd, sub->out + sub->sent, sub->len - sub->sent, MSG_DONTWAIT);
+    if (sent == HTTPD_SOCK_ERR_TIMEOUT)
+      return true;
+    if (sent < 0)
+      return false;
+    sub->sent += sent;
+  }
+}
+
+static void pump_or_close(Subscriber *sub)
+{
+  if (sub->closing || pump(sub))
+    return;
+  ESP_LOGI(TAG, "Event stream on socket %d closed", sub->fd);
+  sub->closing = true;
+  // Frees sub through unsubscribe(), right away or after this work.
+  httpd_sess_trigger_close(sub->server, sub->fd);
+}
+
+static void flush(void *)
+{
+  flush_pending = false;
+  for (size_t i = 0; i < EVENT_SUBSCRIBERS; i++)
+  {
+    if (subscribers[i] != nullptr)
+      pump_or_close(subscribers[i]);
+  }
+}
+
+static void unsubscribe(void *ctx)
+{
+  for (size_t i = 0; i < EVENT_SUBSCRIBERS; i++)
+  {
+    if (subscribers[i] == ctx)
+    {
+      subscribers[i] = nullptr;
+      subscriber_count--;
+    }
+  }
+  delete static_cast<Subscriber *>(ctx);
+}
+
+esp_err_t events_start(httpd_handle_t handle)
+{
+  if (lock == nullptr)
+    lock = xSemaphoreCreateMutex();
+  if (lock == nullptr)
+    return ESP_ERR_NO_MEM;
+  server = handle;
+  return ESP_OK;
+}
+
+void events_publish(const char *type, const char *fmt, ...)
+{
+  if (lock == nullptr)
+    return;
+
+  Event event;
+  snprintf(event.type, sizeof(event.type), "%s", type);
+  va_list args;
+  va_start(args, fmt);
+  const int len = vsnprintf(event.data, sizeof(event.data), fmt, args);
+  va_end(args);
+  // Cut off JSON is worse than none.
+  if (len < 0 || size_t(len) >= sizeof(event.data))
+  {
+    ESP_LOGW(TAG, "Dropped %s event of %d bytes", type, len);
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  event.id = ++last_id;
+  ring[event.id % EVENT_RING_SIZE] = event;
+  xSemaphoreGive(lock);
+  published++;
+
+  if (subscriber_count == 0)
+    return;
+  // A handler on the server task, like an upload, cannot wait for work
+  // queued behind itself.
+  if (xTaskGetCurrentTaskHandle() == server_task)
+  {
+    flush(nullptr);
+    return;
+  }
+  if (!flush_pending.exchange(true) && httpd_queue_work(server, flush, nullptr) != ESP_OK)
+    flush_pending = false;
+}
+
+esp_err_t events_subscribe(httpd_req_t *req)
+{
+  size_t slot = 0;
+  while (slot < EVENT_SUBSCRIBERS && subscribers[slot] != nullptr)
+    slot++;
+  Subscriber *sub = lock != nullptr && slot < EVENT_SUBSCRIBERS ? new (std::nothrow) Subscriber() : nullptr;
+  if (sub == nullptr)
+  {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_sendstr(req, "Too many event streams");
+    return ESP_FAIL;
+  }
+
+  // Browsers send the id of the last event they saw when they reconnect.
+  char value[12] = "";
+  httpd_req_get_hdr_value_str(req, "Last-Event-ID", value, sizeof(value));
+  char *end;
+  const unsigned long seen = strtoul(value, &end, 10);
+  const bool resume = value[0] != '\0' && *end == '\0';
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  // An id from before a reboot is past the end of the ring.
+  sub->next = resume && seen <= last_id ? seen + 1 : last_id + 1;
+  sub->lost = resume && seen > last_id;
+  xSemaphoreGive(lock);
+
+  // No Content-Length: the stream ends when the socket closes.
+  static const char head[] = "HTTP/1.1 200 OK\r\n"
+                             "Content-Type: text/event-stream\r\n"
+                             "Cache-Control: no-cache\r\n"
+                             "\r\n"
+                             "retry: 3000\n\n";
+  if (httpd_send(req, head, strlen(head)) < 0)
+  {
+    delete sub;
+    return ESP_FAIL;
+  }
+
+  sub->server = req->handle;
+  sub->fd = httpd_req_to_sockfd(req);
+  subscribers[slot] = sub;
+  subscriber_count++;
+  server_task = xTaskGetCurrentTaskHandle();
+  req->sess_ctx = sub;
+  req->free_ctx = unsubscribe;
+  ESP_LOGI(TAG, "Event stream on socket %d from id %u", sub->fd, unsigned(sub->next));
+
+  pump_or_close(sub);
+  return ESP_OK;
+}
+
+void events_stats(EventStats &stats)
+{
+  stats.published = published;
+  stats.lost = lost;
+  stats.subscribers = subscriber_count;
+}
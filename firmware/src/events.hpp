@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Events kept for clients that fall behind or reconnect with Last-Event-ID.
+#define EVENT_RING_SIZE 16
+// Longest data of one event, a JSON object.
+#define EVENT_DATA_SIZE 112
+// Streams open at the same time.
+#define EVENT_SUBSCRIBERS 3
+
+struct EventStats
+{
+  uint32_t published;
+  uint32_t lost; // times a subscriber fell off the end of the ring
+  uint32_t subscribers;
+};
+
+// Makes events_publish() record events, which it ignores before, and
+// queues their sending on the server.
+esp_err_t events_start(httpd_handle_t server);
+
+// Records an event whose data is formatted like printf and has it sent to
+// the subscribers. It never waits for them: the event goes into a ring and
+// the server task writes it out as far as each socket takes it without
+// blocking. Safe from any task.
+void events_publish(const char *type, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Turns the request into a text/event-stream that stays open after the
+// handler returns. Events after Last-Event-ID are sent first when the ring
+// still holds them. Answers 503 when every slot is taken.
+esp_err_t events_subscribe(httpd_req_t *req);
+
+void events_stats(EventStats &stats);
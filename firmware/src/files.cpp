@@ -1,6 +1,20 @@
 #include <string>
 #include <vector>
 #include <dirent.h>
+#include <strings.h>
+
+#include "files.hpp"
+
+bool is_photo_name(const std::string &name)
+{
+  const auto dot = name.find_last_of(".");
+  if (dot == std::string::npos)
+    return false;
+  // Cameras name their files in capitals.
+  const char *ext = name.c_str() + dot + 1;
+  return strcasecmp(ext, "bmp") == 0 || strcasecmp(ext, "ink") == 0 || strcasecmp(ext, "jpg") == 0 ||
+         strcasecmp(ext, "jpeg") == 0;
+}
 
 void readbmps(const std::string &dirname, std::vector<std::string> &output)
 {
@@ -8,12 +22,8 @@ void readbmps(const std::string &dirname, std::vector<std::string> &output)
   struct dirent *ent;
   while ((ent = readdir(dir)) != nullptr)
   {
-    if (ent->d_type == DT_REG)
-    {
-      std::string name = ent->d_name;
-      if (name.substr(name.find_last_of(".") + 1) == "bmp")
-        output.push_back(name);
-    }
+    if (ent->d_type == DT_REG && is_photo_name(ent->d_name))
+      output.push_back(ent->d_name);
   }
   closedir(dir);
 }
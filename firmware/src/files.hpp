@@ -3,4 +3,11 @@
 #include <string>
 #include <vector>
 
+#ifndef SDCARD_ROOT
+#define SDCARD_ROOT "/sdcard"
+#endif
+
+// Whether the name has the extension of a photo file: BMP, .ink or JPEG.
+bool is_photo_name(const std::string &name);
+// Lists the photo files in a directory.
 void readbmps(const std::string &dirname, std::vector<std::string> &output);
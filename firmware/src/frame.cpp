@@ -0,0 +1,402 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <new>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+
+#include "frame.hpp"
+#include "library.hpp"
+#include "lock.hpp"
+#include "readahead.hpp"
+#include "settings.hpp"
+#include "inkplate.hpp"
+
+extern Inkplate display;
+
+// A cached frame is FrameHeader followed by Frame::SIZE bytes of pixels, so
+// a hit is one sequential read into the frame buffer with no decoding,
+// dithering or rotation left to do.
+
+static const char *TAG = "frame";
+
+static const uint16_t frame_version = 1;
+
+struct FrameHeader
+{
+  char magic[4];
+  uint16_t version;
+  uint16_t width;
+  uint16_t height;
+  uint16_t reserved0;
+  uint32_t key;
+  uint32_t source_size;
+  uint32_t source_mtime;
+  uint32_t reserved[3];
+};
+
+static_assert(sizeof(FrameHeader) == 36, "FrameHeader is stored on the card");
+
+uint32_t RenderOptions::key() const
+{
+  const uint8_t fields[] = {
+      uint8_t(x), uint8_t(x >> 8), uint8_t(y), uint8_t(y >> 8), rotation, uint8_t(dither), invert,
+      uint8_t(PANEL_WIDTH), uint8_t(PANEL_WIDTH >> 8), uint8_t(PANEL_HEIGHT), uint8_t(PANEL_HEIGHT >> 8),
+      uint8_t(frame_version)};
+
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (auto b : fields)
+  {
+    hash = (hash ^ b) * 16777619u;
+  }
+  return hash;
+}
+
+esp_err_t load_render_options(RenderOptions &options)
+{
+  const Settings settings = settings_get();
+  options.x = settings.padding_left;
+  options.y = settings.padding_top;
+  options.rotation = settings.orientation & 3;
+  options.dither = settings.dithering ? Dither(settings.dither) : Dither::NONE;
+  options.invert = settings.invert;
+  return ESP_OK;
+}
+
+Frame::Frame() : buff(static_cast<uint8_t *>(malloc(SIZE)))
+{
+  if (buff == nullptr)
+    ESP_LOGE(TAG, "Failed to allocate frame buffer");
+  else
+    clear();
+}
+
+Frame::~Frame()
+{
+  free(buff);
+}
+
+void Frame::clear()
+{
+  memset(buff, 0x77, SIZE);
+}
+
+void Frame::band_hashes(uint32_t *hashes) const
+{
+  // FNV-1a over whole words; a band is a multiple of four bytes.
+  static_assert(PANEL_WIDTH / 2 * FRAME_BAND_ROWS % 4 == 0, "Bands are hashed by word");
+  const size_t band_size = PANEL_WIDTH / 2 * FRAME_BAND_ROWS;
+  for (size_t band = 0; band < FRAME_BANDS; band++)
+  {
+    const size_t offset = band * band_size;
+    const size_t end = offset + band_size < SIZE ? offset + band_size : SIZE;
+    uint32_t hash = 2166136261u;
+    for (size_t i = offset; i < end; i += 4)
+    {
+      uint32_t word;
+      memcpy(&word, buff + i, 4);
+      hash = (hash ^ word) * 16777619u;
+    }
+    hashes[band] = hash;
+  }
+}
+
+PhotoStream::PhotoStream(const RenderOptions &options, Frame *frame)
+    : options(options), frame(frame), decoder(row_cb, this, packed_row_cb)
+{
+  // Padding crops a JPEG the way it crops a BMP rather than scaling it.
+  const bool swapped = options.rotation & 1;
+  decoder.fit(swapped ? PANEL_HEIGHT : PANEL_WIDTH, swapped ? PANEL_WIDTH : PANEL_HEIGHT);
+}
+
+PhotoStream::~PhotoStream()
+{
+  delete ditherer;
+  free(levels);
+}
+
+esp_err_t PhotoStream::feed(const uint8_t *data, size_t len)
+{
+  if (!decoder.feed(data, len))
+    return ESP_ERR_INVALID_ARG;
+  return failed ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+esp_err_t PhotoStream::finish()
+{
+  if (failed)
+    return ESP_ERR_NO_MEM;
+  return decoder.done() ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+void PhotoStream::row_cb(void *ctx, int32_t y, const uint8_t *gray)
+{
+  static_cast<PhotoStream *>(ctx)->row(y, gray);
+}
+
+void PhotoStream::packed_row_cb(void *ctx, int32_t y, const uint8_t *packed)
+{
+  static_cast<PhotoStream *>(ctx)->packed_row(y, packed);
+}
+
+// Where row y of the image lands: its row in the rotated layout and the
+// range of image columns that fall on the panel. False for a row that is
+// off the panel or has no columns on it.
+bool PhotoStream::span(int32_t y, int32_t &ly, int32_t &i0, int32_t &i1) const
+{
+  const int32_t w = decoder.width();
+  const bool swapped = options.rotation & 1;
+  const int32_t lw = swapped ? PANEL_HEIGHT : PANEL_WIDTH;
+  const int32_t lh = swapped ? PANEL_WIDTH : PANEL_HEIGHT;
+  ly = options.y + y;
+  i0 = options.x < 0 ? -options.x : 0;
+  i1 = lw - options.x < w ? lw - options.x : w;
+  return ly >= 0 && ly < lh && i0 < i1;
+}
+
+// Rows of a .ink photo already hold panel levels, so there is nothing to
+// dither; unrotated rows at an even offset are copied byte for byte.
+void PhotoStream::packed_row(int32_t y, const uint8_t *packed)
+{
+  const int32_t w = decoder.width();
+  int32_t ly, i0, i1;
+  if (failed || !span(y, ly, i0, i1))
+    return;
+
+  const uint8_t mask = options.invert ? 0x77 : 0;
+  if (frame != nullptr && options.rotation == 0 && !(options.x & 1))
+  {
+    uint8_t *dst = frame->data() + (ly * PANEL_WIDTH + options.x + i0) / 2;
+    const uint8_t *src = packed + i0 / 2;
+    const int32_t n = (i1 - i0) / 2;
+    for (int32_t i = 0; i < n; i++)
+      dst[i] = (src[i] & 0x77) ^ mask;
+    if ((i1 - i0) & 1)
+      frame->set(options.x + i1 - 1, ly, ((src[n] >> 4) ^ mask) & 7);
+    return;
+  }
+
+  if (levels == nullptr)
+  {
+    levels = static_cast<uint8_t *>(malloc(w));
+    if (levels == nullptr)
+    {
+      failed = true;
+      return;
+    }
+  }
+  for (int32_t i = i0; i < i1; i++)
+    levels[i] = ((i & 1 ? packed[i >> 1] : packed[i >> 1] >> 4) ^ mask) & 7;
+  place(ly, i0, i1);
+}
+
+void PhotoStream::row(int32_t y, const uint8_t *gray)
+{
+  const int32_t w = decoder.width();
+  if (failed)
+    return;
+  if (levels == nullptr)
+  {
+    levels = static_cast<uint8_t *>(malloc(w));
+    ditherer = new (std::nothrow) Ditherer(options.dither, w);
+    if (levels == nullptr || ditherer == nullptr || !ditherer->valid())
+    {
+      failed = true;
+      return;
+    }
+  }
+
+  // Error diffusion has to see the rows that are off the panel too.
+  int32_t ly, i0, i1;
+  const bool visible = span(y, ly, i0, i1);
+  if (!visible && !ditherer->diffuses())
+    return;
+  ditherer->row(y, gray, levels);
+  if (!visible)
+    return;
+
+  if (options.invert)
+  {
+    for (int32_t i = i0; i < i1; i++)
+      levels[i] ^= 7;
+  }
+  place(ly, i0, i1);
+}
+
+// Puts levels[i0, i1) of layout row ly on the panel.
+void PhotoStream::place(int32_t ly, int32_t i0, int32_t i1)
+{
+  // Panel position of image column i0 and the step per column.
+  const int32_t lx = options.x + i0;
+  int32_t px, py, dx, dy;
+  switch (options.rotation)
+  {
+  case 1:
+    px = PANEL_WIDTH - 1 - ly, py = lx, dx = 0, dy = 1;
+    break;
+  case 2:
+    px = PANEL_WIDTH - 1 - lx, py = PANEL_HEIGHT - 1 - ly, dx = -1, dy = 0;
+    break;
+  case 3:
+    px = ly, py = PANEL_HEIGHT - 1 - lx, dx = 0, dy = -1;
+    break;
+  default:
+    px = lx, py = ly, dx = 1, dy = 0;
+    break;
+  }
+
+  if (frame != nullptr)
+  {
+    for (int32_t i = i0; i < i1; i++, px += dx, py += dy)
+      frame->set(px, py, levels[i]);
+  }
+  else
+  {
+    const auto rotation = display.getRotation();
+    display.setRotation(0);
+    for (int32_t i = i0; i < i1; i++, px += dx, py += dy)
+      display.drawPixel(px, py, levels[i]);
+    display.setRotation(rotation);
+  }
+}
+
+static esp_err_t photo_sink(void *ctx, const uint8_t *data, size_t len)
+{
+  return static_cast<PhotoStream *>(ctx)->feed(data, len);
+}
+
+static esp_err_t stream_photo(const char *path, PhotoStream &stream)
+{
+  FILE *fp = fopen(path, "rb");
+  if (fp == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to open %s", path);
+    return ESP_FAIL;
+  }
+
+  // The card is read on the other core while this one decodes.
+  esp_err_t ret = read_ahead(fp, photo_sink, &stream);
+  if (ret == ESP_OK)
+    ret = stream.finish();
+  // A file that ends before the last row.
+  if (ret == ESP_ERR_INVALID_SIZE)
+    ret = ESP_FAIL;
+  fclose(fp);
+
+  if (ret != ESP_OK)
+    ESP_LOGE(TAG, "Failed to render %s: %s", path, esp_err_to_name(ret));
+  return ret;
+}
+
+esp_err_t render_photo(const char *path, const RenderOptions &options, Frame &frame)
+{
+  if (!frame.valid())
+    return ESP_ERR_NO_MEM;
+
+  PhotoStream stream(options, &frame);
+  frame.clear();
+  return stream_photo(path, stream);
+}
+
+esp_err_t draw_photo(const char *path, const RenderOptions &options)
+{
+  PhotoStream stream(options, nullptr);
+  return stream_photo(path, stream);
+}
+
+static std::string cache_path(const char *name)
+{
+  return std::string(FRAMES_DIR "/") + name;
+}
+
+esp_err_t frame_cache_load(const PhotoRecord &record, const RenderOptions &options, Frame &frame)
+{
+  if (!frame.valid())
+    return ESP_ERR_NO_MEM;
+
+  StoreLock lock;
+  FILE *fp = fopen(cache_path(record.name).c_str(), "rb");
+  if (fp == nullptr)
+    return ESP_ERR_NOT_FOUND;
+
+  FrameHeader header;
+  esp_err_t ret = ESP_ERR_INVALID_VERSION;
+  if (fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, "IKFB", 4) == 0 &&
+      header.version == frame_version && header.width == PANEL_WIDTH && header.height == PANEL_HEIGHT &&
+      header.key == options.key() && header.source_size == record.size && header.source_mtime == record.mtime)
+  {
+    ret = fread(frame.data(), 1, Frame::SIZE, fp) == Frame::SIZE ? ESP_OK : ESP_FAIL;
+  }
+  fclose(fp);
+  return ret;
+}
+
+esp_err_t frame_cache_store(const PhotoRecord &record, const RenderOptions &options, const Frame &frame)
+{
+  StoreLock lock;
+  mkdir(LIBRARY_DIR, 0755);
+  mkdir(FRAMES_DIR, 0755);
+
+  const auto path = cache_path(record.name);
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (fp == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to create %s", path.c_str());
+    return ESP_FAIL;
+  }
+
+  FrameHeader header = {{'I', 'K', 'F', 'B'}, frame_version, PANEL_WIDTH, PANEL_HEIGHT, 0,
+                        options.key(), record.size, record.mtime, {}};
+  const bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                  fwrite(frame.data(), 1, Frame::SIZE, fp) == Frame::SIZE;
+  if (fclose(fp) != 0 || !ok)
+  {
+    ESP_LOGE(TAG, "Failed to write %s", path.c_str());
+    remove(path.c_str());
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t frame_cache_fill(const PhotoRecord &record)
+{
+  RenderOptions options;
+  load_render_options(options);
+
+  // Rendering takes long, so only the store holds the lock, and only for a
+  // photo that is still there.
+  Frame frame;
+  esp_err_t ret = render_photo(photo_path(record).c_str(), options, frame);
+  if (ret != ESP_OK)
+    return ret;
+  StoreLock lock;
+  if (!library_current(record))
+    return ESP_ERR_NOT_FOUND;
+  return frame_cache_store(record, options, frame);
+}
+
+void frame_cache_remove(const std::string &name)
+{
+  StoreLock lock;
+  remove(cache_path(name.c_str()).c_str());
+}
+
+void frame_cache_clear()
+{
+  StoreLock lock;
+  DIR *dir = opendir(FRAMES_DIR);
+  if (dir == nullptr)
+    return;
+
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != nullptr)
+  {
+    if (ent->d_type == DT_REG)
+      remove(cache_path(ent->d_name).c_str());
+  }
+  closedir(dir);
+  ESP_LOGI(TAG, "Frame cache cleared");
+}
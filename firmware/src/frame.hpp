@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "esp_err.h"
+
+#include "dither.hpp"
+#include "image.hpp"
+#include "library.hpp"
+
+#if defined(INKPLATE_10)
+#define PANEL_WIDTH 1200
+#define PANEL_HEIGHT 825
+#elif defined(INKPLATE_6)
+#define PANEL_WIDTH 800
+#define PANEL_HEIGHT 600
+#else
+#error "Unknown panel"
+#endif
+
+#define FRAMES_DIR LIBRARY_DIR "/frames"
+
+// Frames are compared in bands of rows, by hash, so that the frame on the
+// panel does not have to be kept to tell what a new one changes.
+#define FRAME_BAND_ROWS 25
+#define FRAME_BANDS ((PANEL_HEIGHT + FRAME_BAND_ROWS - 1) / FRAME_BAND_ROWS)
+
+// Display settings that change how a photo turns into panel pixels.
+struct RenderOptions
+{
+  int16_t x;
+  int16_t y;
+  uint8_t rotation;
+  Dither dither;
+  bool invert;
+
+  uint32_t key() const;
+};
+
+esp_err_t load_render_options(RenderOptions &options);
+
+// Panel-native 3-bit image in the unrotated panel orientation, two pixels
+// per byte with the even column in the high nibble. 7 is white.
+class Frame
+{
+public:
+  static const size_t SIZE = PANEL_WIDTH * PANEL_HEIGHT / 2;
+
+  Frame();
+  ~Frame();
+  Frame(const Frame &) = delete;
+  Frame &operator=(const Frame &) = delete;
+
+  bool valid() const { return buff != nullptr; }
+  uint8_t *data() { return buff; }
+  const uint8_t *data() const { return buff; }
+  void clear();
+  void band_hashes(uint32_t *hashes) const;
+
+  uint8_t get(int16_t px, int16_t py) const
+  {
+    const uint8_t b = buff[(py * PANEL_WIDTH + px) >> 1];
+    return px & 1 ? b & 0x0f : b >> 4;
+  }
+
+  void set(int16_t px, int16_t py, uint8_t v)
+  {
+    uint8_t &b = buff[(py * PANEL_WIDTH + px) >> 1];
+    b = px & 1 ? (b & 0xf0) | v : (b & 0x0f) | v << 4;
+  }
+
+private:
+  uint8_t *buff;
+};
+
+// Decodes a BMP or .ink photo that arrives in pieces and renders every row
+// as soon as it is complete, into a frame or, without one, straight onto
+// the display. Memory use depends only on the image width.
+class PhotoStream
+{
+public:
+  PhotoStream(const RenderOptions &options, Frame *frame);
+  ~PhotoStream();
+  PhotoStream(const PhotoStream &) = delete;
+  PhotoStream &operator=(const PhotoStream &) = delete;
+
+  // Returns ESP_ERR_INVALID_ARG for data that is not a supported photo.
+  esp_err_t feed(const uint8_t *data, size_t len);
+  // Returns ESP_ERR_INVALID_SIZE until the last row has arrived.
+  esp_err_t finish();
+
+private:
+  static void row_cb(void *ctx, int32_t y, const uint8_t *gray);
+  static void packed_row_cb(void *ctx, int32_t y, const uint8_t *packed);
+  void row(int32_t y, const uint8_t *gray);
+  void packed_row(int32_t y, const uint8_t *packed);
+  bool span(int32_t y, int32_t &ly, int32_t &i0, int32_t &i1) const;
+  void place(int32_t ly, int32_t i0, int32_t i1);
+
+  const RenderOptions options;
+  Frame *frame;
+  PhotoDecoder decoder;
+  uint8_t *levels = nullptr;
+  Ditherer *ditherer = nullptr;
+  bool failed = false;
+};
+
+// Decodes a photo file and renders it into the frame the way drawImage()
+// would draw it on a cleared display.
+esp_err_t render_photo(const char *path, const RenderOptions &options, Frame &frame);
+// The same, straight onto the display, for when there is no memory for a frame.
+esp_err_t draw_photo(const char *path, const RenderOptions &options);
+
+// The frame cache keeps one rendered frame per photo, valid for the render
+// options and source file it was made from.
+esp_err_t frame_cache_load(const PhotoRecord &record, const RenderOptions &options, Frame &frame);
+esp_err_t frame_cache_store(const PhotoRecord &record, const RenderOptions &options, const Frame &frame);
+esp_err_t frame_cache_fill(const PhotoRecord &record);
+void frame_cache_remove(const std::string &name);
+void frame_cache_clear();
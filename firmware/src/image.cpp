@@ -0,0 +1,439 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "esp_log.h"
+
+#include "image.hpp"
+
+static const char *TAG = "image";
+
+static uint32_t read32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+
+static uint16_t read16(const uint8_t *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+BmpDecoder::BmpDecoder(row_cb_t row_cb, void *ctx) : row_cb(row_cb), ctx(ctx)
+{
+}
+
+BmpDecoder::~BmpDecoder()
+{
+  free(row);
+  free(gray);
+}
+
+bool BmpDecoder::parse_header()
+{
+  if (header[0] != 'B' || header[1] != 'M')
+  {
+    ESP_LOGE(TAG, "Not a BMP image");
+    return false;
+  }
+
+  offset = read32(header + 10);
+  const uint32_t info_size = read32(header + 14);
+  w = read32(header + 18);
+  const int32_t raw_h = read32(header + 22);
+  bpp = read16(header + 28);
+  const uint32_t compression = read32(header + 30);
+  uint32_t colors = read32(header + 46);
+
+  if (w <= 0 || w > 4096 || raw_h == 0 || raw_h > 4096 || raw_h < -4096 || compression != 0 ||
+      (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24))
+  {
+    ESP_LOGE(TAG, "Unsupported BMP: %dx%d, %d bpp, compression %u", w, raw_h, bpp, compression);
+    return false;
+  }
+  bottom_up = raw_h > 0;
+  h = bottom_up ? raw_h : -raw_h;
+  stride = ((w * bpp + 31) / 32) * 4;
+
+  if (bpp <= 8)
+  {
+    if (colors == 0 || colors > (1u << bpp))
+      colors = 1u << bpp;
+    const size_t palette_end = 14 + info_size + colors * 4;
+    if (palette_end > sizeof(header) || palette_end > offset)
+    {
+      ESP_LOGE(TAG, "Invalid BMP palette");
+      return false;
+    }
+    if (header_need < palette_end)
+    {
+      // Come back once the palette has arrived.
+      header_need = palette_end;
+      return true;
+    }
+    memset(palette, 0, sizeof(palette));
+    const uint8_t *p = header + 14 + info_size;
+    for (uint32_t i = 0; i < colors; i++, p += 4)
+      palette[i] = (p[2] * 77 + p[1] * 150 + p[0] * 29) >> 8;
+  }
+  else if (offset < 54)
+  {
+    return false;
+  }
+
+  row = static_cast<uint8_t *>(malloc(stride));
+  gray = static_cast<uint8_t *>(malloc(w));
+  if (row == nullptr || gray == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to allocate row buffers");
+    return false;
+  }
+  skipped = header_len;
+  state = skipped < offset ? State::GAP : State::ROWS;
+  return true;
+}
+
+void BmpDecoder::emit_row()
+{
+  switch (bpp)
+  {
+  case 1:
+    for (int32_t i = 0; i < w; i++)
+      gray[i] = palette[(row[i >> 3] >> (7 - (i & 7))) & 1];
+    break;
+  case 4:
+    for (int32_t i = 0; i + 1 < w; i += 2)
+    {
+      gray[i] = palette[row[i >> 1] >> 4];
+      gray[i + 1] = palette[row[i >> 1] & 0x0f];
+    }
+    if (w & 1)
+      gray[w - 1] = palette[row[w >> 1] >> 4];
+    break;
+  case 8:
+    for (int32_t i = 0; i < w; i++)
+      gray[i] = palette[row[i]];
+    break;
+  default:
+    for (int32_t i = 0; i < w; i++)
+      gray[i] = (row[i * 3 + 2] * 77 + row[i * 3 + 1] * 150 + row[i * 3] * 29) >> 8;
+    break;
+  }
+
+  row_cb(ctx, bottom_up ? h - 1 - rows_done : rows_done, gray);
+  if (++rows_done == h)
+    state = State::DONE;
+}
+
+bool BmpDecoder::feed(const uint8_t *data, size_t len)
+{
+  while (len > 0)
+  {
+    switch (state)
+    {
+    case State::HEADER:
+    {
+      const size_t n = std::min(len, header_need - header_len);
+      memcpy(header + header_len, data, n);
+      header_len += n;
+      data += n;
+      len -= n;
+      if (header_len == header_need)
+      {
+        const size_t need = header_need;
+        if (!parse_header())
+          state = State::FAILED;
+        else if (state == State::HEADER && header_need == need)
+          state = State::FAILED;
+      }
+      break;
+    }
+    case State::GAP:
+    {
+      const size_t n = std::min<size_t>(len, offset - skipped);
+      skipped += n;
+      data += n;
+      len -= n;
+      if (skipped == offset)
+        state = State::ROWS;
+      break;
+    }
+    case State::ROWS:
+    {
+      const size_t n = std::min<size_t>(len, stride - row_len);
+      memcpy(row + row_len, data, n);
+      row_len += n;
+      data += n;
+      len -= n;
+      if (row_len == stride)
+      {
+        row_len = 0;
+        emit_row();
+      }
+      break;
+    }
+    case State::DONE:
+      return true;
+    case State::FAILED:
+      return false;
+    }
+  }
+  return state != State::FAILED;
+}
+
+InkDecoder::InkDecoder(row_cb_t row_cb, void *ctx) : row_cb(row_cb), ctx(ctx)
+{
+  memset(&header, 0, sizeof(header));
+}
+
+InkDecoder::~InkDecoder()
+{
+  free(row);
+}
+
+bool InkDecoder::parse_header()
+{
+  memcpy(&header, buff, sizeof(header));
+  if (memcmp(header.magic, INK_MAGIC, 4) != 0 || header.version != INK_VERSION)
+  {
+    ESP_LOGE(TAG, "Not an ink image");
+    return false;
+  }
+  if (header.width == 0 || header.width > 4096 || header.height == 0 || header.height > 4096)
+  {
+    ESP_LOGE(TAG, "Unsupported ink image: %ux%u", header.width, header.height);
+    return false;
+  }
+
+  stride = (header.width + 1) / 2;
+  row = static_cast<uint8_t *>(malloc(stride));
+  if (row == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to allocate row buffer");
+    return false;
+  }
+  buff_len = 0;
+  state = State::LENGTH;
+  return true;
+}
+
+void InkDecoder::end_row()
+{
+  if (encoded > 0)
+  {
+    state = State::CONTROL;
+    return;
+  }
+  if (row_len != stride)
+  {
+    ESP_LOGE(TAG, "Ink row %d has %u bytes, not %u", rows_done, row_len, stride);
+    state = State::FAILED;
+    return;
+  }
+  row_cb(ctx, rows_done, row);
+  state = ++rows_done == header.height ? State::DONE : State::LENGTH;
+}
+
+bool InkDecoder::feed(const uint8_t *data, size_t len)
+{
+  while (len > 0)
+  {
+    switch (state)
+    {
+    case State::HEADER:
+    {
+      const size_t n = std::min(len, sizeof(header) - buff_len);
+      memcpy(buff + buff_len, data, n);
+      buff_len += n;
+      data += n;
+      len -= n;
+      if (buff_len == sizeof(header) && !parse_header())
+        state = State::FAILED;
+      break;
+    }
+    case State::LENGTH:
+      buff[buff_len++] = *data++;
+      len--;
+      if (buff_len == 2)
+      {
+        buff_len = 0;
+        encoded = read16(buff);
+        row_len = 0;
+        state = encoded > 0 ? State::CONTROL : State::FAILED;
+      }
+      break;
+    case State::CONTROL:
+    {
+      const uint8_t c = *data++;
+      len--;
+      encoded--;
+      if (c == 128)
+      {
+        end_row();
+        break;
+      }
+      // PackBits: 0 to 127 start a literal of 1 to 128 bytes, 129 to 255
+      // repeat the next byte 128 to 2 times.
+      run = c < 128 ? c + 1 : 257 - c;
+      if (row_len + run > stride || (c < 128 ? encoded < run : encoded < 1))
+        state = State::FAILED;
+      else
+        state = c < 128 ? State::LITERAL : State::REPEAT;
+      break;
+    }
+    case State::LITERAL:
+    {
+      const size_t n = std::min<size_t>(len, run);
+      memcpy(row + row_len, data, n);
+      row_len += n;
+      run -= n;
+      encoded -= n;
+      data += n;
+      len -= n;
+      if (run == 0)
+        end_row();
+      break;
+    }
+    case State::REPEAT:
+      memset(row + row_len, *data++, run);
+      len--;
+      row_len += run;
+      encoded--;
+      end_row();
+      break;
+    case State::DONE:
+      return true;
+    case State::FAILED:
+      return false;
+    }
+  }
+  return state != State::FAILED;
+}
+
+PhotoDecoder::PhotoDecoder(gray_cb_t gray_cb, void *ctx, packed_cb_t packed_cb)
+    : gray_cb(gray_cb), packed_cb(packed_cb), ctx(ctx), bmp(gray_cb, ctx), ink(ink_row_cb, this)
+{
+}
+
+PhotoDecoder::~PhotoDecoder()
+{
+  delete jpeg;
+  free(gray);
+}
+
+void PhotoDecoder::fit(int32_t max_width, int32_t max_height)
+{
+  this->max_width = max_width > 0 ? max_width : 1;
+  this->max_height = max_height > 0 ? max_height : 1;
+}
+
+bool PhotoDecoder::feed(const uint8_t *data, size_t len)
+{
+  if (format == Format::UNKNOWN && len > 0)
+  {
+    switch (data[0])
+    {
+    case 'B':
+      format = Format::BMP;
+      break;
+    case INK_MAGIC[0]:
+      format = Format::INK;
+      break;
+    case 0xFF:
+      // Tables and buffers for a JPEG only when there is one to decode.
+      jpeg = new (std::nothrow) JpegDecoder(gray_cb, ctx, max_width, max_height);
+      format = jpeg != nullptr && jpeg->valid() ? Format::JPEG : Format::INVALID;
+      break;
+    default:
+      format = Format::INVALID;
+      break;
+    }
+  }
+
+  switch (format)
+  {
+  case Format::BMP:
+    return bmp.feed(data, len);
+  case Format::INK:
+    // A failed allocation for gray rows turns the format invalid.
+    return ink.feed(data, len) && format == Format::INK;
+  case Format::JPEG:
+    return jpeg->feed(data, len);
+  case Format::UNKNOWN:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool PhotoDecoder::done() const
+{
+  switch (format)
+  {
+  case Format::BMP:
+    return bmp.done();
+  case Format::INK:
+    return ink.done();
+  case Format::JPEG:
+    return jpeg->done();
+  default:
+    return false;
+  }
+}
+
+int32_t PhotoDecoder::width() const
+{
+  switch (format)
+  {
+  case Format::BMP:
+    return bmp.width();
+  case Format::INK:
+    return ink.width();
+  case Format::JPEG:
+    return jpeg->width();
+  default:
+    return 0;
+  }
+}
+
+int32_t PhotoDecoder::height() const
+{
+  switch (format)
+  {
+  case Format::BMP:
+    return bmp.height();
+  case Format::INK:
+    return ink.height();
+  case Format::JPEG:
+    return jpeg->height();
+  default:
+    return 0;
+  }
+}
+
+void PhotoDecoder::ink_row_cb(void *ctx, int32_t y, const uint8_t *packed)
+{
+  auto self = static_cast<PhotoDecoder *>(ctx);
+  if (self->packed_cb != nullptr)
+  {
+    self->packed_cb(self->ctx, y, packed);
+    return;
+  }
+
+  const int32_t w = self->ink.width();
+  if (self->gray == nullptr)
+  {
+    self->gray = static_cast<uint8_t *>(malloc(w));
+    if (self->gray == nullptr)
+    {
+      ESP_LOGE(TAG, "Failed to allocate row buffer");
+      self->format = Format::INVALID;
+      return;
+    }
+  }
+  for (int32_t i = 0; i < w; i++)
+  {
+    const uint8_t level = (i & 1 ? packed[i >> 1] : packed[i >> 1] >> 4) & 7;
+    self->gray[i] = level * 255 / 7;
+  }
+  self->gray_cb(self->ctx, y, self->gray);
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "jpeg.hpp"
+
+// Incremental decoder for uncompressed 1, 4, 8 and 24-bit BMP images. The
+// file is fed in pieces of any size; each completed row is handed to the
+// callback as 8-bit gray levels together with its top-down row number.
+// Rows arrive in file order, which is bottom-up for most BMPs.
+class BmpDecoder
+{
+public:
+  typedef void (*row_cb_t)(void *ctx, int32_t y, const uint8_t *gray);
+
+  BmpDecoder(row_cb_t row_cb, void *ctx);
+  ~BmpDecoder();
+  BmpDecoder(const BmpDecoder &) = delete;
+  BmpDecoder &operator=(const BmpDecoder &) = delete;
+
+  // Returns false once the data is known not to be a supported BMP.
+  bool feed(const uint8_t *data, size_t len);
+
+  bool header_ready() const { return state >= State::ROWS; }
+  bool done() const { return state == State::DONE; }
+  bool failed() const { return state == State::FAILED; }
+  int32_t width() const { return w; }
+  int32_t height() const { return h; }
+
+private:
+  enum class State
+  {
+    HEADER,
+    GAP,
+    ROWS,
+    DONE,
+    FAILED,
+  };
+
+  bool parse_header();
+  void emit_row();
+
+  row_cb_t row_cb;
+  void *ctx;
+  State state = State::HEADER;
+
+  uint8_t header[54 + 256 * 4];
+  size_t header_len = 0;
+  size_t header_need = 54;
+  uint32_t offset = 0;
+  size_t skipped = 0;
+
+  int32_t w = 0;
+  int32_t h = 0;
+  bool bottom_up = true;
+  uint16_t bpp = 0;
+  uint8_t palette[256];
+
+  uint32_t stride = 0;
+  uint8_t *row = nullptr;
+  uint8_t *gray = nullptr;
+  size_t row_len = 0;
+  int32_t rows_done = 0;
+};
+
+// InkArt's own photo format, stored as .ink: an InkHeader and then one
+// record per row, top-down. A row holds 3-bit levels packed the way the
+// panel framebuffer keeps them, two pixels per byte with the even column in
+// the high nibble and 7 for white. Each record is its length as 16-bit
+// little-endian followed by PackBits runs over the packed bytes, so a row
+// expands with no palette, padding or dithering left to deal with.
+struct InkHeader
+{
+  char magic[4];
+  uint16_t version;
+  uint16_t width;
+  uint16_t height;
+  uint16_t reserved;
+};
+
+static_assert(sizeof(InkHeader) == 12, "InkHeader is stored on the card");
+
+#define INK_MAGIC "IKPH"
+#define INK_VERSION 1
+
+// Incremental decoder for .ink files. Each completed row is handed to the
+// callback in its packed form, (width + 1) / 2 bytes, together with its row
+// number.
+class InkDecoder
+{
+public:
+  typedef void (*row_cb_t)(void *ctx, int32_t y, const uint8_t *packed);
+
+  InkDecoder(row_cb_t row_cb, void *ctx);
+  ~InkDecoder();
+  InkDecoder(const InkDecoder &) = delete;
+  InkDecoder &operator=(const InkDecoder &) = delete;
+
+  // Returns false once the data is known not to be a valid .ink file.
+  bool feed(const uint8_t *data, size_t len);
+
+  bool header_ready() const { return state >= State::LENGTH; }
+  bool done() const { return state == State::DONE; }
+  bool failed() const { return state == State::FAILED; }
+  int32_t width() const { return header.width; }
+  int32_t height() const { return header.height; }
+
+private:
+  enum class State
+  {
+    HEADER,
+    LENGTH,
+    CONTROL,
+    LITERAL,
+    REPEAT,
+    DONE,
+    FAILED,
+  };
+
+  bool parse_header();
+  void end_row();
+
+  row_cb_t row_cb;
+  void *ctx;
+  State state = State::HEADER;
+
+  InkHeader header;
+  uint8_t buff[sizeof(InkHeader)];
+  size_t buff_len = 0;
+
+  uint32_t stride = 0;
+  uint8_t *row = nullptr;
+  uint32_t row_len = 0;
+  uint32_t encoded = 0; // bytes left in the record of the current row
+  uint32_t run = 0;     // bytes left in the current run
+  int32_t rows_done = 0;
+};
+
+// Decodes BMP, .ink or JPEG data, told apart by their first byte, into gray
+// rows. With a packed callback, rows of a .ink file go there instead,
+// untouched. Width and height are those of the rows, which for a JPEG may
+// be scaled down.
+class PhotoDecoder
+{
+public:
+  typedef void (*gray_cb_t)(void *ctx, int32_t y, const uint8_t *gray);
+  typedef void (*packed_cb_t)(void *ctx, int32_t y, const uint8_t *packed);
+
+  PhotoDecoder(gray_cb_t gray_cb, void *ctx, packed_cb_t packed_cb = nullptr);
+  ~PhotoDecoder();
+  PhotoDecoder(const PhotoDecoder &) = delete;
+  PhotoDecoder &operator=(const PhotoDecoder &) = delete;
+
+  // Bounds a JPEG is scaled down to fit, if it can be, before the first
+  // feed. Other formats come at their own size.
+  void fit(int32_t max_width, int32_t max_height);
+  bool feed(const uint8_t *data, size_t len);
+
+  bool is_ink() const { return format == Format::INK; }
+  bool done() const;
+  int32_t width() const;
+  int32_t height() const;
+
+private:
+  enum class Format
+  {
+    UNKNOWN,
+    BMP,
+    INK,
+    JPEG,
+    INVALID,
+  };
+
+  static void ink_row_cb(void *ctx, int32_t y, const uint8_t *packed);
+
+  gray_cb_t gray_cb;
+  packed_cb_t packed_cb;
+  void *ctx;
+  Format format = Format::UNKNOWN;
+  BmpDecoder bmp;
+  InkDecoder ink;
+  JpegDecoder *jpeg = nullptr;
+  int32_t max_width = 4096;
+  int32_t max_height = 4096;
+  uint8_t *gray = nullptr;
+};
@@ -0,0 +1,141 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "events.hpp"
+#include "jobs.hpp"
+
+static const char *TAG = "jobs";
+
+// Jobs waiting behind the running one. Each may hold a rendered frame.
+#define JOB_QUEUE_LENGTH 4
+// Finished jobs stay visible until this many newer ones have been submitted.
+#define JOB_HISTORY 8
+
+// Below the HTTP server task, so that requests are served while a job runs.
+#define JOB_TASK_PRIORITY 3
+
+const char *const job_state_names[4] = {"queued", "running", "done", "failed"};
+
+struct Job
+{
+  uint32_t id;
+  job_fn_t fn;
+  void *ctx;
+};
+
+static QueueHandle_t queue = nullptr;
+static SemaphoreHandle_t lock = nullptr;
+static JobStatus history[JOB_HISTORY];
+static uint32_t last_id = 0;
+
+// The same fields as /api/v1/jobs/<id> reports.
+static void publish(const JobStatus &status)
+{
+  if (status.state == JobState::FAILED)
+    events_publish("job", "{\"id\":%u,\"type\":\"%s\",\"state\":\"%s\",\"error\":\"%s\"}", unsigned(status.id),
+                   status.type, job_state_names[size_t(status.state)], esp_err_to_name(status.result));
+  else
+    events_publish("job", "{\"id\":%u,\"type\":\"%s\",\"state\":\"%s\"}", unsigned(status.id), status.type,
+                   job_state_names[size_t(status.state)]);
+}
+
+static void set_state(uint32_t id, JobState state, esp_err_t result)
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  JobStatus &status = history[id % JOB_HISTORY];
+  const bool found = status.id == id;
+  if (found)
+  {
+    status.state = state;
+    status.result = result;
+  }
+  const JobStatus changed = status;
+  xSemaphoreGive(lock);
+  if (found)
+    publish(changed);
+}
+
+static void worker_task(void *)
+{
+  Job job;
+  for (;;)
+  {
+    xQueueReceive(queue, &job, portMAX_DELAY);
+    set_state(job.id, JobState::RUNNING, ESP_OK);
+    const esp_err_t ret = job.fn(job.ctx);
+    if (ret != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Job %u failed: %s", job.id, esp_err_to_name(ret));
+    }
+    set_state(job.id, ret == ESP_OK ? JobState::DONE : JobState::FAILED, ret);
+  }
+}
+
+esp_err_t jobs_start()
+{
+  if (queue != nullptr)
+    return ESP_OK;
+
+  lock = xSemaphoreCreateMutex();
+  queue = xQueueCreate(JOB_QUEUE_LENGTH, sizeof(Job));
+  if (lock == nullptr || queue == nullptr ||
+      xTaskCreate(worker_task, "jobs", 8192, nullptr, JOB_TASK_PRIORITY, nullptr) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to start job worker");
+    if (queue)
+      vQueueDelete(queue);
+    if (lock)
+      vSemaphoreDelete(lock);
+    queue = nullptr;
+    lock = nullptr;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+esp_err_t job_submit(const char *type, job_fn_t fn, void *ctx, uint32_t &id)
+{
+  if (queue == nullptr)
+    return ESP_ERR_INVALID_STATE;
+
+  // The status is in place before the worker can see the job.
+  xSemaphoreTake(lock, portMAX_DELAY);
+  const Job job = {++last_id, fn, ctx};
+  JobStatus &status = history[job.id % JOB_HISTORY];
+  const JobStatus evicted = status;
+  status = {job.id, type, JobState::QUEUED, ESP_OK};
+  const bool queued = xQueueSend(queue, &job, 0) == pdPASS;
+  if (!queued)
+  {
+    status = evicted;
+    last_id--;
+  }
+  else
+  {
+    // Before the worker can announce that it is running.
+    publish(status);
+  }
+  xSemaphoreGive(lock);
+
+  if (!queued)
+  {
+    ESP_LOGW(TAG, "Job queue is full");
+    return ESP_ERR_NO_MEM;
+  }
+  id = job.id;
+  return ESP_OK;
+}
+
+esp_err_t job_status(uint32_t id, JobStatus &status)
+{
+  if (lock == nullptr || id == 0)
+    return ESP_ERR_NOT_FOUND;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  status = history[id % JOB_HISTORY];
+  xSemaphoreGive(lock);
+  return status.id == id ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+
+// Runs one job on the worker. The job owns ctx and releases it before
+// returning.
+typedef esp_err_t (*job_fn_t)(void *ctx);
+
+enum class JobState : uint8_t
+{
+  QUEUED,
+  RUNNING,
+  DONE,
+  FAILED,
+};
+
+// JSON names of the states.
+extern const char *const job_state_names[4];
+
+struct JobStatus
+{
+  uint32_t id;
+  const char *type; // static string naming what the job does
+  JobState state;
+  esp_err_t result;
+};
+
+// Starts the worker task that runs long jobs one at a time, in the order
+// they were submitted, so that the HTTP server task only has to queue them.
+esp_err_t jobs_start();
+
+// Queues fn(ctx) and returns the id of the job. On failure the job is not
+// queued and ctx stays with the caller: ESP_ERR_INVALID_STATE without a
+// worker, ESP_ERR_NO_MEM when the queue is full.
+esp_err_t job_submit(const char *type, job_fn_t fn, void *ctx, uint32_t &id);
+
+// The status of the most recent jobs is kept; older ones give
+// ESP_ERR_NOT_FOUND.
+esp_err_t job_status(uint32_t id, JobStatus &status);
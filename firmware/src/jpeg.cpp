@@ -0,0 +1,816 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "esp_log.h"
+
+#include "jpeg.hpp"
+
+static const char *TAG = "jpeg";
+
+// Enough for the tables and frame headers, and for two of the largest MCUs.
+#define IN_SIZE 8192
+// Worst case for one 8-bit block: a 16-bit code and 11 bits for each of 64
+// coefficients, every byte of it stuffed.
+#define BLOCK_BYTES 420
+
+static const uint8_t zigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// C(u) / 2 * cos((2x + 1) u pi / 2n) in Q12, by x and then u: the n-point
+// inverse DCT over the n lowest frequencies of a block.
+static const int16_t idct4[16] = {
+    1448, 1892, 1448, 784,
+    1448, 784, -1448, -1892,
+    1448, -784, -1448, 1892,
+    1448, -1892, 1448, -784,
+};
+static const int16_t idct2[4] = {
+    1448, 1448,
+    1448, -1448,
+};
+
+static inline uint8_t clamp(int32_t v)
+{
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline int32_t descale(int32_t x, int32_t n)
+{
+  return (x + (1 << (n - 1))) >> n;
+}
+
+#define CONST_BITS 13
+#define PASS1_BITS 2
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+// One pass of the accurate integer inverse DCT from the IJG library
+// (Loeffler, Ligtenberg and Moschytz), over eight values step apart.
+static inline void idct_1d(const int32_t *p, int32_t step, int32_t *out)
+{
+  int32_t z2 = p[2 * step], z3 = p[6 * step];
+  int32_t z1 = (z2 + z3) * FIX_0_541196100;
+  int32_t tmp2 = z1 - z3 * FIX_1_847759065;
+  int32_t tmp3 = z1 + z2 * FIX_0_765366865;
+  z2 = p[0];
+  z3 = p[4 * step];
+  int32_t tmp0 = (z2 + z3) * (1 << CONST_BITS);
+  int32_t tmp1 = (z2 - z3) * (1 << CONST_BITS);
+  const int32_t tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+  const int32_t tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+
+  tmp0 = p[7 * step];
+  tmp1 = p[5 * step];
+  tmp2 = p[3 * step];
+  tmp3 = p[step];
+  z1 = tmp0 + tmp3;
+  z2 = tmp1 + tmp2;
+  z3 = tmp0 + tmp2;
+  int32_t z4 = tmp1 + tmp3;
+  const int32_t z5 = (z3 + z4) * FIX_1_175875602;
+  tmp0 *= FIX_0_298631336;
+  tmp1 *= FIX_2_053119869;
+  tmp2 *= FIX_3_072711026;
+  tmp3 *= FIX_1_501321110;
+  z1 *= -FIX_0_899976223;
+  z2 *= -FIX_2_562915447;
+  z3 = z3 * -FIX_1_961570560 + z5;
+  z4 = z4 * -FIX_0_390180644 + z5;
+  tmp0 += z1 + z3;
+  tmp1 += z2 + z4;
+  tmp2 += z2 + z3;
+  tmp3 += z1 + z4;
+
+  out[0] = tmp10 + tmp3;
+  out[7] = tmp10 - tmp3;
+  out[1] = tmp11 + tmp2;
+  out[6] = tmp11 - tmp2;
+  out[2] = tmp12 + tmp1;
+  out[5] = tmp12 - tmp1;
+  out[3] = tmp13 + tmp0;
+  out[4] = tmp13 - tmp0;
+}
+
+static void idct_8x8(const int32_t *coef, uint8_t *out, int32_t stride)
+{
+  int32_t ws[64], tmp[8];
+  for (int32_t x = 0; x < 8; x++)
+  {
+    const int32_t *p = coef + x;
+    if ((p[8] | p[16] | p[24] | p[32] | p[40] | p[48] | p[56]) == 0)
+    {
+      for (int32_t y = 0; y < 8; y++)
+        ws[y * 8 + x] = p[0] * (1 << PASS1_BITS);
+      continue;
+    }
+    idct_1d(p, 8, tmp);
+    for (int32_t y = 0; y < 8; y++)
+      ws[y * 8 + x] = descale(tmp[y], CONST_BITS - PASS1_BITS);
+  }
+  for (int32_t y = 0; y < 8; y++, out += stride)
+  {
+    idct_1d(ws + y * 8, 1, tmp);
+    for (int32_t x = 0; x < 8; x++)
+      out[x] = clamp(descale(tmp[x], CONST_BITS + PASS1_BITS + 3) + 128);
+  }
+}
+
+static void idct_small(const int32_t *coef, uint8_t *out, int32_t stride, int32_t n)
+{
+  const int16_t *table = n == 4 ? idct4 : idct2;
+  int32_t ws[16];
+  for (int32_t v = 0; v < n; v++)
+  {
+    const int32_t *f = coef + v * 8;
+    for (int32_t x = 0; x < n; x++)
+    {
+      int32_t sum = 0;
+      for (int32_t u = 0; u < n; u++)
+        sum += table[x * n + u] * f[u];
+      ws[v * n + x] = descale(sum, 9);
+    }
+  }
+  for (int32_t y = 0; y < n; y++, out += stride)
+  {
+    for (int32_t x = 0; x < n; x++)
+    {
+      int32_t sum = 0;
+      for (int32_t v = 0; v < n; v++)
+        sum += table[y * n + v] * ws[v * n + x];
+      out[x] = clamp(descale(sum, 15) + 128);
+    }
+  }
+}
+
+static bool build_huffman(const uint8_t *counts, const uint8_t *symbols, uint16_t *lookup, int32_t *maxcode,
+                          int32_t *offset)
+{
+  memset(lookup, 0, (1 << 9) * sizeof(uint16_t));
+  int32_t code = 0, k = 0;
+  for (int32_t len = 1; len <= 16; len++)
+  {
+    const int32_t n = counts[len - 1];
+    if (code + n > (1 << len))
+      return false;
+    offset[len] = k - code;
+    maxcode[len] = n > 0 ? code + n - 1 : -1;
+    for (int32_t i = 0; i < n; i++, code++, k++)
+    {
+      if (len > 9)
+        continue;
+      const int32_t shift = 9 - len;
+      for (int32_t j = 0; j < (1 << shift); j++)
+        lookup[(code << shift) | j] = len << 8 | symbols[k];
+    }
+    code <<= 1;
+  }
+  return true;
+}
+
+JpegDecoder::JpegDecoder(row_cb_t row_cb, void *ctx, int32_t max_width, int32_t max_height)
+    : row_cb(row_cb), ctx(ctx), max_width(max_width), max_height(max_height)
+{
+  in = static_cast<uint8_t *>(malloc(IN_SIZE));
+  if (in == nullptr)
+    ESP_LOGE(TAG, "Failed to allocate input buffer");
+  dc[0].defined = dc[1].defined = ac[0].defined = ac[1].defined = false;
+}
+
+JpegDecoder::~JpegDecoder()
+{
+  free(in);
+  free(strip);
+}
+
+void JpegDecoder::fail(const char *reason)
+{
+  ESP_LOGE(TAG, "%s", reason);
+  state = State::FAILED;
+}
+
+bool JpegDecoder::feed(const uint8_t *data, size_t len)
+{
+  if (in == nullptr)
+    return false;
+
+  while (len > 0 && state != State::DONE && state != State::FAILED)
+  {
+    if (state == State::SKIP && pos == in_len)
+    {
+      // Exif and other metadata go past without being buffered.
+      const size_t n = std::min(len, segment);
+      segment -= n;
+      data += n;
+      len -= n;
+      if (segment == 0)
+        state = State::MARKER;
+      continue;
+    }
+
+    if (pos > 0)
+    {
+      memmove(in, in + pos, in_len - pos);
+      in_len -= pos;
+      pos = 0;
+    }
+    const size_t n = std::min(len, IN_SIZE - in_len);
+    memcpy(in + in_len, data, n);
+    in_len += n;
+    data += n;
+    len -= n;
+    process();
+    if (n == 0 && pos == 0 && state != State::FAILED)
+      fail("JPEG segment does not fit the buffer");
+  }
+  return state != State::FAILED;
+}
+
+void JpegDecoder::process()
+{
+  for (;;)
+  {
+    const size_t avail = in_len - pos;
+    switch (state)
+    {
+    case State::SOI:
+      if (avail < 2)
+        return;
+      if (in[pos] != 0xFF || in[pos + 1] != 0xD8)
+      {
+        fail("Not a JPEG image");
+        return;
+      }
+      pos += 2;
+      state = State::MARKER;
+      break;
+    case State::MARKER:
+    {
+      if (avail < 2)
+        return;
+      if (in[pos] != 0xFF)
+      {
+        fail("Invalid JPEG marker");
+        return;
+      }
+      marker = in[pos + 1];
+      if (marker == 0xFF)
+      {
+        // Fill byte.
+        pos++;
+        break;
+      }
+      if (marker == 0xD9)
+      {
+        fail("JPEG ended before the last row");
+        return;
+      }
+      if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+      {
+        pos += 2;
+        break;
+      }
+      if (avail < 4)
+        return;
+      segment = in[pos + 2] << 8 | in[pos + 3];
+      if (segment < 2)
+      {
+        fail("Invalid JPEG segment");
+        return;
+      }
+      segment -= 2;
+      pos += 4;
+      const bool parsed = marker == 0xC4 || marker == 0xDA || marker == 0xDB || marker == 0xDD ||
+                          (marker >= 0xC0 && marker <= 0xCF && marker != 0xC8 && marker != 0xCC);
+      state = parsed ? State::SEGMENT : State::SKIP;
+      break;
+    }
+    case State::SEGMENT:
+      if (segment > IN_SIZE)
+      {
+        fail("JPEG segment does not fit the buffer");
+        return;
+      }
+      if (avail < segment)
+        return;
+      state = State::MARKER;
+      if (!parse_segment(in + pos, segment))
+      {
+        state = State::FAILED;
+        return;
+      }
+      pos += segment;
+      break;
+    case State::SKIP:
+    {
+      const size_t n = std::min(avail, segment);
+      pos += n;
+      segment -= n;
+      if (segment > 0)
+        return;
+      state = State::MARKER;
+      break;
+    }
+    case State::ENTROPY:
+      if (!decode_mcus())
+        return;
+      break;
+    case State::SKIP_SCAN:
+      // Entropy-coded data ends at the first marker other than a restart.
+      while (pos + 1 < in_len &&
+             !(in[pos] == 0xFF && in[pos + 1] != 0 && (in[pos + 1] < 0xD0 || in[pos + 1] > 0xD7)))
+        pos++;
+      if (pos + 1 >= in_len)
+        return;
+      state = State::MARKER;
+      break;
+    case State::DONE:
+    case State::FAILED:
+      return;
+    }
+  }
+}
+
+bool JpegDecoder::parse_segment(const uint8_t *p, size_t len)
+{
+  switch (marker)
+  {
+  case 0xC0:
+  case 0xC1:
+    return parse_sof(p, len);
+  case 0xC2:
+    ESP_LOGE(TAG, "Progressive JPEG is not supported");
+    return false;
+  case 0xC4:
+    return parse_dht(p, len);
+  case 0xDA:
+    return parse_sos(p, len);
+  case 0xDB:
+    return parse_dqt(p, len);
+  case 0xDD:
+    if (len < 2)
+    {
+      ESP_LOGE(TAG, "Invalid JPEG restart interval");
+      return false;
+    }
+    restart_interval = p[0] << 8 | p[1];
+    return true;
+  default:
+    ESP_LOGE(TAG, "Unsupported JPEG coding process %02x", marker);
+    return false;
+  }
+}
+
+bool JpegDecoder::parse_dqt(const uint8_t *p, size_t len)
+{
+  while (len > 0)
+  {
+    const uint8_t precision = p[0] >> 4, id = p[0] & 15;
+    const size_t size = 1 + (precision ? 128 : 64);
+    if (id > 3 || len < size)
+    {
+      ESP_LOGE(TAG, "Invalid quantization table");
+      return false;
+    }
+    for (int32_t k = 0; k < 64; k++)
+      qt[id][k] = precision ? p[1 + 2 * k] << 8 | p[2 + 2 * k] : p[1 + k];
+    p += size;
+    len -= size;
+  }
+  return true;
+}
+
+bool JpegDecoder::parse_dht(const uint8_t *p, size_t len)
+{
+  while (len > 0)
+  {
+    const uint8_t type = p[0] >> 4, id = p[0] & 15;
+    size_t total = 0;
+    for (int32_t i = 0; len >= 17 && i < 16; i++)
+      total += p[1 + i];
+    if (type > 1 || id > 1 || len < 17 + total || total > 256)
+    {
+      ESP_LOGE(TAG, "Invalid or unsupported Huffman table");
+      return false;
+    }
+    Huffman &table = type == 0 ? dc[id] : ac[id];
+    memcpy(table.symbols, p + 17, total);
+    if (!build_huffman(p + 1, table.symbols, table.lookup, table.maxcode, table.offset))
+    {
+      ESP_LOGE(TAG, "Invalid Huffman table");
+      return false;
+    }
+    table.defined = true;
+    p += 17 + total;
+    len -= 17 + total;
+  }
+  return true;
+}
+
+bool JpegDecoder::parse_sof(const uint8_t *p, size_t len)
+{
+  if (len < 6 || w > 0)
+  {
+    ESP_LOGE(TAG, "Invalid JPEG frame header");
+    return false;
+  }
+  image_height = p[1] << 8 | p[2];
+  image_width = p[3] << 8 | p[4];
+  ncomps = p[5];
+  if (p[0] != 8 || (ncomps != 1 && ncomps != 3) || len < size_t(6 + 3 * ncomps))
+  {
+    ESP_LOGE(TAG, "Unsupported JPEG: %d-bit, %d components", p[0], ncomps);
+    return false;
+  }
+  if (image_width == 0 || image_height == 0)
+  {
+    ESP_LOGE(TAG, "Unsupported JPEG: %dx%d", image_width, image_height);
+    return false;
+  }
+
+  for (int32_t i = 0; i < ncomps; i++)
+  {
+    Component &c = comps[i];
+    const uint8_t *q = p + 6 + 3 * i;
+    c.id = q[0];
+    c.h = q[1] >> 4;
+    c.v = q[1] & 15;
+    c.tq = q[2];
+    if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4 || c.tq > 3)
+    {
+      ESP_LOGE(TAG, "Invalid JPEG component");
+      return false;
+    }
+    hmax = std::max<int32_t>(hmax, c.h);
+    vmax = std::max<int32_t>(vmax, c.v);
+  }
+  // Luma at a lower resolution than chroma would need upsampling.
+  if (comps[0].h != hmax || comps[0].v != vmax)
+  {
+    ESP_LOGE(TAG, "Unsupported JPEG sampling");
+    return false;
+  }
+
+  int32_t shift = 0;
+  while (shift < 3 && ((image_width + (1 << shift) - 1) >> shift > max_width ||
+                       (image_height + (1 << shift) - 1) >> shift > max_height))
+    shift++;
+  block = 8 >> shift;
+  w = (image_width * block + 7) / 8;
+  h = (image_height * block + 7) / 8;
+  if (w > 4096)
+  {
+    ESP_LOGE(TAG, "Unsupported JPEG: %dx%d", image_width, image_height);
+    w = h = 0;
+    return false;
+  }
+  ESP_LOGD(TAG, "JPEG %dx%d decoded at 1/%d", image_width, image_height, 1 << shift);
+  return true;
+}
+
+bool JpegDecoder::parse_sos(const uint8_t *p, size_t len)
+{
+  nscan = len > 0 ? p[0] : 0;
+  if (w == 0 || nscan < 1 || nscan > ncomps || len < size_t(4 + 2 * nscan))
+  {
+    ESP_LOGE(TAG, "Invalid JPEG scan");
+    return false;
+  }
+
+  bool luma = false;
+  int32_t blocks = 0;
+  for (int32_t i = 0; i < nscan; i++)
+  {
+    const uint8_t id = p[1 + 2 * i], tables = p[2 + 2 * i];
+    Component *c = nullptr;
+    for (int32_t j = 0; j < ncomps; j++)
+    {
+      if (comps[j].id == id)
+        c = &comps[j];
+    }
+    if (c == nullptr)
+    {
+      ESP_LOGE(TAG, "Invalid JPEG scan");
+      return false;
+    }
+    c->td = tables >> 4;
+    c->ta = tables & 15;
+    if (c->td > 1 || c->ta > 1 || !dc[c->td].defined || !ac[c->ta].defined)
+    {
+      ESP_LOGE(TAG, "JPEG scan uses an undefined Huffman table");
+      return false;
+    }
+    c->pred = 0;
+    scan[i] = c;
+    luma = luma || c == &comps[0];
+    blocks += nscan > 1 ? c->h * c->v : 1;
+  }
+  const uint8_t *q = p + 1 + 2 * nscan;
+  if (q[0] != 0 || q[1] != 63 || q[2] != 0 || blocks > 10)
+  {
+    ESP_LOGE(TAG, "Unsupported JPEG scan");
+    return false;
+  }
+
+  // Chroma has nothing to add to gray levels.
+  if (!luma)
+  {
+    state = State::SKIP_SCAN;
+    return true;
+  }
+
+  const bool interleaved = nscan > 1;
+  const int32_t bw = interleaved ? comps[0].h : 1, bh = interleaved ? comps[0].v : 1;
+  mcus_x = (image_width + 8 * bw - 1) / (8 * bw);
+  mcus_y = (image_height + 8 * bh - 1) / (8 * bh);
+  strip_stride = mcus_x * bw * block;
+  strip_rows = bh * block;
+  strip = static_cast<uint8_t *>(malloc(strip_stride * strip_rows));
+  if (strip == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to allocate MCU strip");
+    return false;
+  }
+
+  margin = blocks * BLOCK_BYTES + 8;
+  mcu_x = mcu_y = 0;
+  restarts_left = restart_interval;
+  bits = 0;
+  nbits = 0;
+  at_marker = false;
+  state = State::ENTROPY;
+  return true;
+}
+
+// Returns false when the next MCU has to wait for more data.
+bool JpegDecoder::decode_mcus()
+{
+  while (state == State::ENTROPY)
+  {
+    if (restart_interval > 0 && restarts_left == 0 && !restart())
+      return false;
+    if (in_len - pos < margin && !marker_ahead())
+      return false;
+    if (!decode_mcu())
+    {
+      fail("Corrupt JPEG data");
+      return false;
+    }
+    restarts_left--;
+    if (++mcu_x == mcus_x)
+    {
+      mcu_x = 0;
+      emit_strip();
+      if (++mcu_y == mcus_y)
+        state = State::DONE;
+    }
+  }
+  return true;
+}
+
+// Whether the entropy-coded data in the buffer runs into a marker, which
+// bounds what the next MCU can take.
+bool JpegDecoder::marker_ahead() const
+{
+  for (size_t i = pos; i + 1 < in_len; i++)
+  {
+    if (in[i] == 0xFF && in[i + 1] != 0)
+      return true;
+  }
+  return false;
+}
+
+// Steps over the restart marker between two intervals, where the bit
+// buffer and DC predictions start over.
+bool JpegDecoder::restart()
+{
+  while (pos + 1 < in_len && in[pos] == 0xFF && in[pos + 1] == 0xFF)
+    pos++;
+  if (in_len - pos < 2)
+    return false;
+  if (in[pos] != 0xFF || (in[pos + 1] & 0xF8) != 0xD0)
+  {
+    fail("Missing JPEG restart marker");
+    return false;
+  }
+  pos += 2;
+  bits = 0;
+  nbits = 0;
+  at_marker = false;
+  for (int32_t i = 0; i < nscan; i++)
+    scan[i]->pred = 0;
+  restarts_left = restart_interval;
+  return true;
+}
+
+bool JpegDecoder::decode_mcu()
+{
+  int32_t coef[64];
+  const bool interleaved = nscan > 1;
+  for (int32_t i = 0; i < nscan; i++)
+  {
+    Component &c = *scan[i];
+    const bool luma = &c == &comps[0];
+    const int32_t bw = interleaved ? c.h : 1, bh = interleaved ? c.v : 1;
+    for (int32_t by = 0; by < bh; by++)
+    {
+      for (int32_t bx = 0; bx < bw; bx++)
+      {
+        bool flat;
+        if (!decode_block(c, luma ? coef : nullptr, flat))
+          return false;
+        if (!luma)
+          continue;
+
+        uint8_t *out = strip + by * block * strip_stride + (mcu_x * bw + bx) * block;
+        if (flat)
+        {
+          const uint8_t v = clamp(descale(coef[0], 3) + 128);
+          for (int32_t y = 0; y < block; y++)
+            memset(out + y * strip_stride, v, block);
+        }
+        else if (block == 8)
+        {
+          idct_8x8(coef, out, strip_stride);
+        }
+        else
+        {
+          idct_small(coef, out, strip_stride, block);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+static inline int32_t extend(int32_t v, int32_t s)
+{
+  return v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+}
+
+// Keeps dequantized coefficients in the range of 8-bit samples, so that
+// corrupt data cannot overflow the inverse DCT.
+static inline int32_t dequantize(int32_t v, uint16_t q)
+{
+  v = std::min<int32_t>(std::max<int32_t>(v, -2047), 2047) * q;
+  return std::min<int32_t>(std::max<int32_t>(v, -2047), 2047);
+}
+
+// Decodes one block, keeping the coefficients that the scale needs when
+// coef is given and only stepping over the bits otherwise. Flat tells that
+// none but the DC was kept.
+bool JpegDecoder::decode_block(Component &c, int32_t *coef, bool &flat)
+{
+  flat = true;
+  const uint16_t *q = qt[c.tq];
+  int32_t s = decode(dc[c.td]);
+  if (s < 0 || s > 11)
+    return false;
+  if (s > 0)
+    c.pred = std::min<int32_t>(std::max<int32_t>(c.pred + extend(get_bits(s), s), -32768), 32767);
+  if (coef != nullptr)
+  {
+    memset(coef, 0, 64 * sizeof(int32_t));
+    coef[0] = dequantize(c.pred, q[0]);
+  }
+
+  const Huffman &table = ac[c.ta];
+  for (int32_t k = 1; k < 64; k++)
+  {
+    const int32_t rs = decode(table);
+    if (rs < 0)
+      return false;
+    const int32_t run = rs >> 4;
+    s = rs & 15;
+    if (s == 0)
+    {
+      if (run != 15)
+        break;
+      k += 15;
+      continue;
+    }
+    k += run;
+    if (k > 63 || s > 11)
+      return false;
+    const int32_t v = extend(get_bits(s), s);
+    const uint8_t n = zigzag[k];
+    if (coef != nullptr && (n & 7) < block && (n >> 3) < block)
+    {
+      coef[n] = dequantize(v, q[k]);
+      flat = false;
+    }
+  }
+  return true;
+}
+
+void JpegDecoder::emit_strip()
+{
+  const int32_t y0 = mcu_y * strip_rows;
+  for (int32_t y = 0; y < strip_rows && y0 + y < h; y++)
+    row_cb(ctx, y0 + y, strip + y * strip_stride);
+}
+
+// Tops the bit buffer up to more than 24 bits. Past a marker, which ends
+// the entropy-coded data, it reads zeros.
+void JpegDecoder::fill()
+{
+  while (nbits <= 24)
+  {
+    uint32_t b = 0;
+    if (!at_marker && pos < in_len)
+    {
+      b = in[pos];
+      if (b != 0xFF)
+        pos++;
+      else if (pos + 1 < in_len && in[pos + 1] == 0)
+        pos += 2;
+      else
+      {
+        at_marker = true;
+        b = 0;
+      }
+    }
+    bits |= b << (24 - nbits);
+    nbits += 8;
+  }
+}
+
+int32_t JpegDecoder::get_bits(int32_t n)
+{
+  fill();
+  const int32_t v = bits >> (32 - n);
+  bits <<= n;
+  nbits -= n;
+  return v;
+}
+
+int32_t JpegDecoder::decode(const Huffman &table)
+{
+  fill();
+  const uint16_t entry = table.lookup[bits >> (32 - 9)];
+  if (entry != 0)
+  {
+    bits <<= entry >> 8;
+    nbits -= entry >> 8;
+    return entry & 0xff;
+  }
+  for (int32_t len = 10; len <= 16; len++)
+  {
+    const int32_t code = bits >> (32 - len);
+    if (code <= table.maxcode[len])
+    {
+      bits <<= len;
+      nbits -= len;
+      return table.symbols[table.offset[len] + code];
+    }
+  }
+  return -1;
+}
+
+bool jpeg_size(FILE *fp, uint16_t &width, uint16_t &height)
+{
+  uint8_t b[5];
+  for (;;)
+  {
+    if (fread(b, 1, 2, fp) != 2 || b[0] != 0xFF)
+      return false;
+    while (b[1] == 0xFF)
+    {
+      if (fread(b + 1, 1, 1, fp) != 1)
+        return false;
+    }
+    const uint8_t marker = b[1];
+    if (marker == 0xD9 || marker == 0xDA)
+      return false;
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+      continue;
+    if (fread(b, 1, 2, fp) != 2)
+      return false;
+    const uint16_t len = b[0] << 8 | b[1];
+    if (len < 2)
+      return false;
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+    {
+      if (fread(b, 1, 5, fp) != 5)
+        return false;
+      height = b[1] << 8 | b[2];
+      width = b[3] << 8 | b[4];
+      return true;
+    }
+    if (fseek(fp, len - 2, SEEK_CUR) != 0)
+      return false;
+  }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Incremental decoder for baseline and extended sequential JPEG, fed in
+// pieces of any size like BmpDecoder. Only the luma is decoded, and only at
+// the scale the image needs: at 1/2, 1/4 and 1/8 each block keeps its
+// lowest frequencies and goes through a smaller inverse DCT, so a large
+// photo never exists at full size. Rows arrive top-down as gray levels, one
+// strip of MCUs at a time.
+class JpegDecoder
+{
+public:
+  typedef void (*row_cb_t)(void *ctx, int32_t y, const uint8_t *gray);
+
+  // Images are scaled down by the least of 1, 2, 4 and 8 that fits them in
+  // max_width x max_height, or by 8 when none does.
+  JpegDecoder(row_cb_t row_cb, void *ctx, int32_t max_width, int32_t max_height);
+  ~JpegDecoder();
+  JpegDecoder(const JpegDecoder &) = delete;
+  JpegDecoder &operator=(const JpegDecoder &) = delete;
+
+  // False when there was no memory for the input buffer.
+  bool valid() const { return in != nullptr; }
+  // Returns false once the data is known not to be a supported JPEG.
+  bool feed(const uint8_t *data, size_t len);
+
+  bool header_ready() const { return w > 0; }
+  bool done() const { return state == State::DONE; }
+  bool failed() const { return state == State::FAILED; }
+  // Size of the rows handed out, after scaling.
+  int32_t width() const { return w; }
+  int32_t height() const { return h; }
+
+private:
+  enum class State
+  {
+    SOI,
+    MARKER,
+    SEGMENT,
+    SKIP,
+    ENTROPY,
+    SKIP_SCAN,
+    DONE,
+    FAILED,
+  };
+
+  struct Huffman
+  {
+    uint16_t lookup[1 << 9]; // length << 8 | symbol of codes up to 9 bits
+    int32_t maxcode[17];     // largest code of each length, -1 for none
+    int32_t offset[17];      // symbol index minus code, by length
+    uint8_t symbols[256];
+    bool defined;
+  };
+
+  struct Component
+  {
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    uint8_t tq;
+    uint8_t td;
+    uint8_t ta;
+    int32_t pred;
+  };
+
+  void process();
+  bool parse_segment(const uint8_t *p, size_t len);
+  bool parse_dqt(const uint8_t *p, size_t len);
+  bool parse_dht(const uint8_t *p, size_t len);
+  bool parse_sof(const uint8_t *p, size_t len);
+  bool parse_sos(const uint8_t *p, size_t len);
+  bool decode_mcus();
+  bool marker_ahead() const;
+  bool restart();
+  bool decode_mcu();
+  bool decode_block(Component &c, int32_t *coef, bool &flat);
+  void emit_strip();
+  void fail(const char *reason);
+
+  void fill();
+  int32_t get_bits(int32_t n);
+  int32_t decode(const Huffman &table);
+
+  row_cb_t row_cb;
+  void *ctx;
+  const int32_t max_width;
+  const int32_t max_height;
+  State state = State::SOI;
+
+  uint8_t *in = nullptr;
+  size_t in_len = 0;
+  size_t pos = 0;
+  uint8_t marker = 0;
+  size_t segment = 0; // bytes left in the current segment
+
+  uint16_t qt[4][64]; // in zigzag order
+  Huffman dc[2];
+  Huffman ac[2];
+  Component comps[3];
+  int32_t ncomps = 0;
+  int32_t hmax = 1;
+  int32_t vmax = 1;
+  uint16_t restart_interval = 0;
+  int32_t image_width = 0;
+  int32_t image_height = 0;
+
+  int32_t w = 0;
+  int32_t h = 0;
+  int32_t block = 8; // pixels per side of a decoded block
+
+  Component *scan[3];
+  int32_t nscan = 0;
+  int32_t mcus_x = 0;
+  int32_t mcus_y = 0;
+  int32_t mcu_x = 0;
+  int32_t mcu_y = 0;
+  int32_t restarts_left = 0;
+  size_t margin = 0; // input a whole MCU may take
+  uint8_t *strip = nullptr;
+  int32_t strip_stride = 0;
+  int32_t strip_rows = 0;
+
+  uint32_t bits = 0; // left-aligned
+  int32_t nbits = 0;
+  bool at_marker = false;
+};
+
+// Reads the size of a JPEG from its frame header, with the file positioned
+// just after the SOI marker.
+bool jpeg_size(FILE *fp, uint16_t &width, uint16_t &height);
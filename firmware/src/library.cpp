@@ -0,0 +1,562 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "events.hpp"
+#include "files.hpp"
+#include "image.hpp"
+#include "jpeg.hpp"
+#include "library.hpp"
+#include "lock.hpp"
+
+// The photo index is two files on the card:
+//
+//   photos.idx   IndexHeader followed by one PhotoRecord per photo.
+//   visible.idx  VisibleHeader followed by the record position of every
+//                photo that is not hidden, as uint32_t.
+//
+// Both carry the same generation number, which changes on every update, so
+// a pair left inconsistent by a power loss is detected and rebuilt. Picking
+// the n-th visible photo is two seeks whatever the library size.
+
+static const char *TAG = "library";
+
+#define INDEX_PATH LIBRARY_DIR "/photos.idx"
+#define VISIBLE_PATH LIBRARY_DIR "/visible.idx"
+
+static const uint16_t index_version = 1;
+
+struct IndexHeader
+{
+  char magic[4];
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t count;
+  uint32_t visible;
+  uint32_t generation;
+  uint32_t reserved[3];
+};
+
+struct VisibleHeader
+{
+  char magic[4];
+  uint32_t generation;
+};
+
+// Lets the web app know that its photo list is out of date.
+static void publish_generation(uint32_t generation)
+{
+  events_publish("library", "{\"generation\":%u}", unsigned(generation));
+}
+
+static long record_offset(uint32_t pos)
+{
+  return sizeof(IndexHeader) + pos * sizeof(PhotoRecord);
+}
+
+static long slot_offset(uint32_t slot)
+{
+  return sizeof(VisibleHeader) + slot * sizeof(uint32_t);
+}
+
+static bool read_at(FILE *fp, long offset, void *data, size_t len)
+{
+  return fseek(fp, offset, SEEK_SET) == 0 && fread(data, 1, len, fp) == len;
+}
+
+static bool write_at(FILE *fp, long offset, const void *data, size_t len)
+{
+  return fseek(fp, offset, SEEK_SET) == 0 && fwrite(data, 1, len, fp) == len;
+}
+
+// Opened index files with validated, matching headers.
+struct Index
+{
+  FILE *records = nullptr;
+  FILE *visible = nullptr;
+  IndexHeader header;
+
+  ~Index()
+  {
+    close();
+  }
+
+  void close()
+  {
+    if (records)
+      fclose(records);
+    if (visible)
+      fclose(visible);
+    records = visible = nullptr;
+  }
+
+  bool open(const char *mode)
+  {
+    records = fopen(INDEX_PATH, mode);
+    visible = fopen(VISIBLE_PATH, mode);
+    if (records == nullptr || visible == nullptr)
+      return false;
+
+    VisibleHeader vh;
+    return read_at(records, 0, &header, sizeof(header)) &&
+           memcmp(header.magic, "IKIX", 4) == 0 &&
+           header.version == index_version &&
+           header.record_size == sizeof(PhotoRecord) &&
+           read_at(visible, 0, &vh, sizeof(vh)) &&
+           memcmp(vh.magic, "IKVS", 4) == 0 &&
+           vh.generation == header.generation;
+  }
+
+  // The visible list is written first so that a torn update leaves
+  // mismatched generations behind.
+  bool commit()
+  {
+    header.generation++;
+    VisibleHeader vh = {{'I', 'K', 'V', 'S'}, header.generation};
+    if (!(write_at(visible, 0, &vh, sizeof(vh)) && fflush(visible) == 0 &&
+          write_at(records, 0, &header, sizeof(header)) && fflush(records) == 0))
+      return false;
+    publish_generation(header.generation);
+    return true;
+  }
+
+  bool find(const std::string &filename, uint32_t &pos, PhotoRecord &record)
+  {
+    if (fseek(records, record_offset(0), SEEK_SET) != 0)
+      return false;
+    for (pos = 0; pos < header.count; pos++)
+    {
+      if (fread(&record, sizeof(record), 1, records) != 1)
+        return false;
+      if (filename == record.name)
+        return true;
+    }
+    return false;
+  }
+
+  bool read_slots(std::vector<uint32_t> &slots)
+  {
+    slots.resize(header.visible);
+    return header.visible == 0 || read_at(visible, slot_offset(0), slots.data(), slots.size() * sizeof(uint32_t));
+  }
+};
+
+std::string photo_path(const PhotoRecord &record)
+{
+  return std::string(SDCARD_ROOT "/") + ((record.flags & PHOTO_HIDDEN) ? "." : "") + record.name;
+}
+
+static bool make_record(const std::string &filename, PhotoRecord &record)
+{
+  const bool hidden = filename[0] == '.';
+  const std::string name = hidden ? filename.substr(1) : filename;
+  if (name.size() >= sizeof(record.name))
+  {
+    ESP_LOGW(TAG, "File name too long for the index: %s", filename.c_str());
+    return false;
+  }
+
+  memset(&record, 0, sizeof(record));
+  strcpy(record.name, name.c_str());
+  record.flags = hidden ? PHOTO_HIDDEN : 0;
+
+  const std::string path = SDCARD_ROOT "/" + filename;
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+  {
+    return false;
+  }
+  record.size = st.st_size;
+  record.mtime = st.st_mtime;
+
+  uint8_t header[26];
+  static_assert(sizeof(header) >= sizeof(InkHeader), "Header holds either format");
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp == nullptr)
+  {
+    return false;
+  }
+  const size_t len = fread(header, 1, sizeof(header), fp);
+  if (len == sizeof(header) && header[0] == 'B' && header[1] == 'M')
+  {
+    int32_t width, height;
+    memcpy(&width, header + 18, sizeof(width));
+    memcpy(&height, header + 22, sizeof(height));
+    record.width = width;
+    record.height = height < 0 ? -height : height;
+  }
+  else if (len >= sizeof(InkHeader) && memcmp(header, INK_MAGIC, 4) == 0)
+  {
+    InkHeader ink;
+    memcpy(&ink, header, sizeof(ink));
+    record.width = ink.width;
+    record.height = ink.height;
+  }
+  else if (len >= 2 && header[0] == 0xFF && header[1] == 0xD8)
+  {
+    // The frame header may be past Exif data, well into the file.
+    fseek(fp, 2, SEEK_SET);
+    jpeg_size(fp, record.width, record.height);
+  }
+  fclose(fp);
+  return true;
+}
+
+esp_err_t library_rebuild()
+{
+  StoreLock lock;
+  uint32_t generation = esp_random();
+  {
+    Index old;
+    if (old.open("rb"))
+      generation = old.header.generation + 1;
+  }
+
+  std::vector<std::string> bmp_images;
+  readbmps(SDCARD_ROOT "/", bmp_images);
+
+  mkdir(LIBRARY_DIR, 0755);
+  FILE *records = fopen(INDEX_PATH, "wb");
+  FILE *visible = fopen(VISIBLE_PATH, "wb");
+  if (records == nullptr || visible == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to create photo index");
+    if (records)
+      fclose(records);
+    if (visible)
+      fclose(visible);
+    return ESP_FAIL;
+  }
+
+  // Zero generation on the visible list until the records are complete.
+  IndexHeader header = {{'I', 'K', 'I', 'X'}, index_version, sizeof(PhotoRecord), 0, 0, generation, {}};
+  VisibleHeader vh = {{'I', 'K', 'V', 'S'}, 0};
+  bool ok = fwrite(&header, sizeof(header), 1, records) == 1 && fwrite(&vh, sizeof(vh), 1, visible) == 1;
+
+  PhotoRecord record;
+  for (const auto &filename : bmp_images)
+  {
+    if (!ok || !make_record(filename, record))
+      continue;
+    ok = fwrite(&record, sizeof(record), 1, records) == 1;
+    if (ok && !(record.flags & PHOTO_HIDDEN))
+    {
+      ok = fwrite(&header.count, sizeof(header.count), 1, visible) == 1;
+      header.visible++;
+    }
+    header.count++;
+  }
+
+  vh.generation = generation;
+  ok = ok && write_at(records, 0, &header, sizeof(header)) && write_at(visible, 0, &vh, sizeof(vh));
+  fclose(records);
+  fclose(visible);
+
+  if (!ok)
+  {
+    ESP_LOGE(TAG, "Failed to write photo index");
+    remove(INDEX_PATH);
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "Photo index rebuilt: %u photos, %u visible", header.count, header.visible);
+  publish_generation(generation);
+  return ESP_OK;
+}
+
+// Opens the index, rebuilding it first if it is missing or inconsistent.
+static bool open_index(Index &index, const char *mode)
+{
+  if (index.open(mode))
+    return true;
+
+  ESP_LOGW(TAG, "Photo index missing or stale, rebuilding");
+  index.close();
+  return library_rebuild() == ESP_OK && index.open(mode);
+}
+
+// A failed update leaves the index in an unknown state; dropping it makes the
+// next reader rebuild it from the card.
+static esp_err_t invalidate(Index &index)
+{
+  ESP_LOGE(TAG, "Failed to update photo index");
+  index.close();
+  remove(INDEX_PATH);
+  return ESP_FAIL;
+}
+
+esp_err_t library_count(uint32_t &count, uint32_t &visible)
+{
+  StoreLock lock;
+  Index index;
+  if (!open_index(index, "rb"))
+    return ESP_FAIL;
+  count = index.header.count;
+  visible = index.header.visible;
+  return ESP_OK;
+}
+
+esp_err_t library_generation(uint32_t &generation)
+{
+  StoreLock lock;
+  Index index;
+  if (!open_index(index, "rb"))
+    return ESP_FAIL;
+  generation = index.header.generation;
+  return ESP_OK;
+}
+
+esp_err_t library_list(const std::string &after, uint32_t limit, ArenaVector<PhotoRecord> &records, bool &more)
+{
+  StoreLock lock;
+  Index index;
+  if (!open_index(index, "rb") || fseek(index.records, record_offset(0), SEEK_SET) != 0)
+    return ESP_FAIL;
+
+  // Names are unique, so a name is a cursor that survives records moving
+  // around in the index. One pass keeps the limit + 1 smallest names after
+  // it in a max-heap; the extra one only tells whether there is more.
+  const auto by_name = [](const PhotoRecord &a, const PhotoRecord &b)
+  { return strcmp(a.name, b.name) < 0; };
+  const size_t keep = limit < index.header.count ? limit + 1 : index.header.count;
+  records.clear();
+  records.reserve(keep);
+
+  PhotoRecord record;
+  for (uint32_t pos = 0; pos < index.header.count; pos++)
+  {
+    if (fread(&record, sizeof(record), 1, index.records) != 1)
+      return invalidate(index);
+    if (!after.empty() && strcmp(record.name, after.c_str()) <= 0)
+      continue;
+    if (records.size() < keep)
+    {
+      records.push_back(record);
+      std::push_heap(records.begin(), records.end(), by_name);
+    }
+    else if (keep > 0 && by_name(record, records.front()))
+    {
+      std::pop_heap(records.begin(), records.end(), by_name);
+      records.back() = record;
+      std::push_heap(records.begin(), records.end(), by_name);
+    }
+  }
+
+  std::sort_heap(records.begin(), records.end(), by_name);
+  more = records.size() > limit;
+  if (more)
+    records.resize(limit);
+  return ESP_OK;
+}
+
+esp_err_t library_select(int &index, bool shuffle, PhotoRecord &record)
+{
+  StoreLock lock;
+  Index idx;
+  if (!open_index(idx, "rb"))
+    return ESP_FAIL;
+
+  const uint32_t visible = idx.header.visible;
+  if (visible == 0)
+    return ESP_ERR_NOT_FOUND;
+
+  if (shuffle)
+    index = esp_random() % visible;
+  else
+    index = index < 0 || uint32_t(index) + 1 >= visible ? 0 : index + 1;
+
+  uint32_t pos;
+  if (!read_at(idx.visible, slot_offset(index), &pos, sizeof(pos)) || pos >= idx.header.count ||
+      !read_at(idx.records, record_offset(pos), &record, sizeof(record)))
+  {
+    return invalidate(idx);
+  }
+  return ESP_OK;
+}
+
+esp_err_t library_find(const std::string &filename, PhotoRecord &record)
+{
+  StoreLock lock;
+  Index index;
+  if (!open_index(index, "rb"))
+    return ESP_FAIL;
+
+  uint32_t pos;
+  return index.find(filename, pos, record) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+bool library_current(const PhotoRecord &record)
+{
+  StoreLock lock;
+  PhotoRecord now;
+  return library_find(record.name, now) == ESP_OK && now.size == record.size && now.mtime == record.mtime;
+}
+
+esp_err_t library_add(const std::string &filename)
+{
+  return library_add(std::vector<std::string>{filename});
+}
+
+esp_err_t library_add(const std::vector<std::string> &filenames)
+{
+  StoreLock lock;
+  Index index;
+  if (!open_index(index, "r+b"))
+    return ESP_FAIL;
+
+  esp_err_t ret = ESP_OK;
+  bool changed = false;
+  for (const auto &filename : filenames)
+  {
+    PhotoRecord record;
+    if (!make_record(filename, record))
+    {
+      ret = ESP_FAIL;
+      continue;
+    }
+
+    // The file may have replaced one with the same name.
+    uint32_t pos;
+    PhotoRecord old;
+    if (index.find(record.name, pos, old))
+    {
+      record.flags = old.flags;
+      if (!write_at(index.records, record_offset(pos), &record, sizeof(record)))
+        return invalidate(index);
+      changed = true;
+      continue;
+    }
+
+    pos = index.header.count;
+    if (!write_at(index.records, record_offset(pos), &record, sizeof(record)))
+      return invalidate(index);
+    index.header.count++;
+
+    if (!(record.flags & PHOTO_HIDDEN))
+    {
+      if (!write_at(index.visible, slot_offset(index.header.visible), &pos, sizeof(pos)))
+        return invalidate(index);
+      index.header.visible++;
+    }
+    changed = true;
+  }
+  if (changed && !index.commit())
+    return invalidate(index);
+  return ret;
+}
+
+esp_err_t library_remove(const std::string &filename)
+{
+  StoreLock lock;
+  Index index;
+  if (!open_index(index, "r+b"))
+    return ESP_FAIL;
+
+  uint32_t pos;
+  PhotoRecord record;
+  if (!index.find(filename, pos, record))
+    return ESP_ERR_NOT_FOUND;
+
+  std::vector<uint32_t> slots;
+  if (!index.read_slots(slots))
+    return invalidate(index);
+
+  if (!(record.flags & PHOTO_HIDDEN))
+  {
+    for (uint32_t slot = 0; slot < slots.size(); slot++)
+    {
+      if (slots[slot] != pos)
+        continue;
+      slots[slot] = slots.back();
+      slots.pop_back();
+      if (slot < slots.size() && !write_at(index.visible, slot_offset(slot), &slots[slot], sizeof(uint32_t)))
+        return invalidate(index);
+      index.header.visible--;
+      break;
+    }
+  }
+
+  // Move the last record into the hole and repoint its visible slot.
+  const uint32_t last = index.header.count - 1;
+  if (pos != last)
+  {
+    PhotoRecord moved;
+    if (!read_at(index.records, record_offset(last), &moved, sizeof(moved)) ||
+        !write_at(index.records, record_offset(pos), &moved, sizeof(moved)))
+      return invalidate(index);
+
+    for (uint32_t slot = 0; slot < slots.size(); slot++)
+    {
+      if (slots[slot] != last)
+        continue;
+      if (!write_at(index.visible, slot_offset(slot), &pos, sizeof(pos)))
+        return invalidate(index);
+      break;
+    }
+  }
+  index.header.count--;
+  return index.commit() ? ESP_OK : invalidate(index);
+}
+
+esp_err_t library_set_hidden(const std::string &filename, bool hidden)
+{
+  return library_set_hidden(std::vector<HiddenChange>{{filename, hidden}});
+}
+
+esp_err_t library_set_hidden(const std::vector<HiddenChange> &changes)
+{
+  StoreLock lock;
+  Index index;
+  if (!open_index(index, "r+b"))
+    return ESP_FAIL;
+
+  std::vector<uint32_t> slots;
+  if (!index.read_slots(slots))
+    return invalidate(index);
+
+  esp_err_t ret = ESP_OK;
+  bool changed = false;
+  for (const auto &change : changes)
+  {
+    uint32_t pos;
+    PhotoRecord record;
+    if (!index.find(change.filename, pos, record))
+    {
+      ret = ESP_ERR_NOT_FOUND;
+      continue;
+    }
+    if (bool(record.flags & PHOTO_HIDDEN) == change.hidden)
+      continue;
+
+    record.flags = change.hidden ? record.flags | PHOTO_HIDDEN : record.flags & ~PHOTO_HIDDEN;
+    if (!write_at(index.records, record_offset(pos), &record, sizeof(record)))
+      return invalidate(index);
+
+    if (change.hidden)
+    {
+      const auto slot = std::find(slots.begin(), slots.end(), pos);
+      if (slot != slots.end())
+      {
+        *slot = slots.back();
+        slots.pop_back();
+      }
+    }
+    else
+    {
+      slots.push_back(pos);
+    }
+    changed = true;
+  }
+  if (!changed)
+    return ret;
+
+  // The visible list is rewritten once for the whole batch.
+  if (!slots.empty() && !write_at(index.visible, slot_offset(0), slots.data(), slots.size() * sizeof(uint32_t)))
+    return invalidate(index);
+  index.header.visible = slots.size();
+  return index.commit() ? ret : invalidate(index);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "esp_err.h"
+
+#include "arena.hpp"
+#include "files.hpp"
+
+#define LIBRARY_DIR SDCARD_ROOT "/.inkart"
+
+static const uint8_t PHOTO_HIDDEN = 0x01;
+
+// One fixed-width entry of the on-card photo index.
+struct PhotoRecord
+{
+  char name[48]; // file name without the leading dot of hidden photos
+  uint32_t size;
+  uint32_t mtime;
+  uint16_t width;
+  uint16_t height;
+  uint8_t flags;
+  uint8_t reserved[3];
+};
+
+static_assert(sizeof(PhotoRecord) == 64, "PhotoRecord is stored on the card");
+
+std::string photo_path(const PhotoRecord &record);
+
+esp_err_t library_rebuild();
+esp_err_t library_count(uint32_t &count, uint32_t &visible);
+// The generation changes with every update of the index.
+esp_err_t library_generation(uint32_t &generation);
+// Fills records with up to limit photos, in name order, whose names sort
+// after the given one (or from the first one when it is empty). more tells
+// whether photos are left after the last record.
+esp_err_t library_list(const std::string &after, uint32_t limit, ArenaVector<PhotoRecord> &records, bool &more);
+esp_err_t library_select(int &index, bool shuffle, PhotoRecord &record);
+esp_err_t library_find(const std::string &filename, PhotoRecord &record);
+// Whether the index still has the photo, unchanged since the record was
+// read. Checked under the lock before writing what is made from it, so that
+// nothing is left behind for a photo deleted in the meantime.
+bool library_current(const PhotoRecord &record);
+esp_err_t library_add(const std::string &filename);
+// Adds several photos with a single update of the index.
+esp_err_t library_add(const std::vector<std::string> &filenames);
+esp_err_t library_remove(const std::string &filename);
+esp_err_t library_set_hidden(const std::string &filename, bool hidden);
+
+struct HiddenChange
+{
+  std::string filename;
+  bool hidden;
+};
+
+// Hides and shows several photos with a single update of the index.
+esp_err_t library_set_hidden(const std::vector<HiddenChange> &changes);
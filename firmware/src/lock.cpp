@@ -0,0 +1,21 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "lock.hpp"
+
+// Made by whichever task gets here first; the static is initialized once.
+static SemaphoreHandle_t store_mutex()
+{
+  static const SemaphoreHandle_t mutex = xSemaphoreCreateRecursiveMutex();
+  return mutex;
+}
+
+StoreLock::StoreLock()
+{
+  xSemaphoreTakeRecursive(store_mutex(), portMAX_DELAY);
+}
+
+StoreLock::~StoreLock()
+{
+  xSemaphoreGiveRecursive(store_mutex());
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// The server task and the job worker share the photo index, the frame and
+// thumbnail caches and the settings. Every library_*, frame_cache_*,
+// thumbnail_* and settings_* call holds this lock for what it reads and
+// writes; callers take it too around several calls that must not be split.
+// A task may take it again while it holds it.
+class StoreLock
+{
+public:
+  StoreLock();
+  ~StoreLock();
+  StoreLock(const StoreLock &) = delete;
+  StoreLock &operator=(const StoreLock &) = delete;
+};
@@ -1,7 +1,5 @@
 #include <iostream>
 #include <string>
-#include <vector>
-#include <algorithm>
 #include <sys/types.h>
 #include <cstring>
 #include "freertos/FreeRTOS.h"
@@ -15,13 +13,21 @@
 #include "webapp.hpp"
 #include "draw.hpp"
 #include "files.hpp"
+#include "frame.hpp"
+#include "library.hpp"
+#include "metrics.hpp"
+#include "microbench.hpp"
+#include "settings.hpp"
 #include "inkplate.hpp"
 
 static const char *TAG = "main";
-static const int16_t nvs_version = 1;
 
 Inkplate display(DisplayMode::INKPLATE_3BIT);
 RTC_DATA_ATTR int last_index = -1;
+// Band hashes of the frame on the panel, if it came from a Frame. Setup mode
+// starts from a reset, which clears them along with the panel contents.
+RTC_DATA_ATTR uint32_t shown_bands[FRAME_BANDS];
+RTC_DATA_ATTR bool shown_valid = false;
 
 void init_nvs()
 {
@@ -32,28 +38,26 @@ void init_nvs()
     ret = nvs_flash_init();
   }
   ESP_ERROR_CHECK(ret);
-  nvs_handle_t handle;
-  if (nvs_open("system_settings", NVS_READONLY, &handle) == ESP_ERR_NVS_NOT_FOUND)
-  {
-    ESP_ERROR_CHECK(nvs_open("system_settings", NVS_READWRITE, &handle));
-    nvs_set_i16(handle, "version", nvs_version);
-    nvs_commit(handle);
-  }
-  nvs_close(handle);
 }
 
 void main_task(void *)
 {
+  wake_timer_start();
   init_nvs();
+  wake_phase_end(WakePhase::NVS);
 
   display.begin(true);
   display.clearDisplay();
+  wake_phase_end(WakePhase::DISPLAY);
 
   const auto wakeup_reason = esp_sleep_get_wakeup_cause();
   if (wakeup_reason != ESP_SLEEP_WAKEUP_TIMER)
   {
     char ssid[16], password[16], ip_addr[16];
 
+    // Files may have been copied to the card while it was out of the frame.
+    library_rebuild();
+
     init_ap(ssid, password, ip_addr);
     start_web_server();
 
@@ -82,55 +86,66 @@ void main_task(void *)
     }
   }
 
-  int16_t x, y;
-  uint8_t invert, rotation, dithering, shuffle;
-  uint16_t interval;
-
-  nvs_handle_t handle;
-  nvs_open("system_settings", NVS_READONLY, &handle);
-  nvs_get_u8(handle, "invert", &invert);
-  nvs_get_u8(handle, "dithering", &dithering);
-  nvs_get_u8(handle, "orientation", &rotation);
-  nvs_get_i16(handle, "padding-top", &y);
-  nvs_get_i16(handle, "padding-left", &x);
-  nvs_get_u16(handle, "refresh", &interval);
-  nvs_get_u8(handle, "shuffle", &shuffle);
-  nvs_close(handle);
-
-  std::vector<std::string> bmp_images;
-  std::vector<std::string> available;
-
-  readbmps("/sdcard/", bmp_images);
-  std::copy_if(bmp_images.begin(), bmp_images.end(), std::back_inserter(available), [](std::string bmp)
-               { return bmp[0] != '.'; });
-
-  if (available.size() > 0)
+  const Settings settings = settings_get();
+  const bool shuffle = settings.shuffle;
+  const uint16_t interval = settings.refresh;
+
+  RenderOptions options;
+  load_render_options(options);
+
+  uint32_t bands[FRAME_BANDS];
+  size_t changed = FRAME_BANDS;
+  bool framed = false;
+
+  PhotoRecord record;
+  const bool selected = library_select(last_index, shuffle, record) == ESP_OK;
+  wake_phase_end(WakePhase::SELECT);
+  if (selected)
   {
-    if (shuffle)
+    ESP_LOGI(TAG, "Display photo at index %d: %s", last_index, record.name);
+    const auto path = photo_path(record);
+
+    Frame frame;
+    auto ret = frame_cache_load(record, options, frame);
+    if (ret == ESP_OK)
     {
-      last_index = esp_random() % available.size();
+      wake_set_flags(WAKE_CACHE_HIT);
     }
-    else
+    else if (ret != ESP_ERR_NO_MEM)
+    {
+      ESP_LOGI(TAG, "Frame cache miss for %s", record.name);
+      ret = render_photo(path.c_str(), options, frame);
+      if (ret == ESP_OK)
+        frame_cache_store(record, options, frame);
+    }
+    wake_phase_end(WakePhase::RENDER);
+
+    if (ret == ESP_OK)
     {
-      last_index++;
+      frame.band_hashes(bands);
+      framed = true;
+      if (shown_valid)
+      {
+        changed = 0;
+        for (size_t band = 0; band < FRAME_BANDS; band++)
+        {
+          if (bands[band] != shown_bands[band])
+            changed++;
+        }
+      }
+      if (changed > 0)
+        draw_frame(frame);
     }
-    ESP_LOGI(TAG, "Search bmp image at index %d in SD", last_index);
-    auto iter = available.begin();
-    for (size_t i = 0; i < last_index; i++)
+    else
     {
-      iter++;
-      if (iter == available.end())
+      // Without memory for a frame, draw straight from the card.
+      if (ret != ESP_ERR_NO_MEM || draw_photo(path.c_str(), options) != ESP_OK)
       {
-        iter = available.begin();
-        last_index = 0;
-        break;
+        ESP_LOGW(TAG, "Failed to draw %s, rebuilding photo index", record.name);
+        wake_set_flags(WAKE_FAILED);
+        library_rebuild();
       }
     }
-
-    ESP_LOGI(TAG, "Display bmp image: %s", iter->c_str());
-    std::string filepath = "/sdcard/" + *iter;
-    display.setRotation(rotation);
-    display.drawImage(filepath.c_str(), x, y, dithering, invert);
   }
   else
   {
@@ -140,10 +155,28 @@ void main_task(void *)
       display.fillRect(width * i, 0, width, display.height(), i);
     }
   }
+  wake_phase_end(WakePhase::DRAW);
 
-  display.display();
+  // The driver refreshes a grayscale panel only as a whole, so a frame that
+  // changes any band is shown in full and one that changes none is skipped.
+  if (changed == 0)
+  {
+    ESP_LOGI(TAG, "Panel already shows this frame, skipping refresh");
+    wake_set_flags(WAKE_SKIPPED);
+  }
+  else
+  {
+    ESP_LOGI(TAG, "Refreshing panel, %u of %u bands changed", unsigned(changed), unsigned(FRAME_BANDS));
+    display.display();
+  }
+  if (framed)
+    memcpy(shown_bands, bands, sizeof(shown_bands));
+  shown_valid = framed;
+  wake_phase_end(WakePhase::REFRESH);
 
   ESP::delay(1000);
+  wake_phase_end(WakePhase::SETTLE);
+  wake_timer_commit();
   ESP_LOGI(TAG, "Entering deep sleep. Wake up after %d min.", interval > 0 ? interval : 30);
   esp_sleep_enable_timer_wakeup((uint64_t)(interval > 0 ? interval : 30) * 60 * 1000000);
   esp_deep_sleep_start();
@@ -153,6 +186,9 @@ extern "C"
 {
   void app_main()
   {
+#ifdef INKART_BENCH
+    microbench_run();
+#endif
     xTaskCreatePinnedToCore(main_task, "main_task", 8192, nullptr, 1, nullptr, 1);
   }
 }
@@ -0,0 +1,84 @@
+#include <cstring>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "metrics.hpp"
+
+static const char *TAG = "metrics";
+
+#define WAKE_HISTORY 32
+
+const char *const wake_phase_names[WAKE_PHASES] = {
+    "boot", "nvs", "display", "select", "render", "draw", "refresh", "settle",
+};
+
+// RTC_DATA_ATTR would be reinitialised by the reset that enters setup mode,
+// just before the history is wanted. No-init memory survives it and is
+// recognised by its magic.
+struct WakeLog
+{
+  uint32_t magic;
+  uint16_t head;
+  uint16_t count;
+  WakeRecord records[WAKE_HISTORY];
+};
+
+static const uint32_t wake_log_magic = 0x494b574c + sizeof(WakeLog);
+
+static RTC_NOINIT_ATTR WakeLog wake_log;
+
+static WakeRecord current;
+static int64_t mark;
+
+static bool log_valid()
+{
+  return wake_log.magic == wake_log_magic && wake_log.head < WAKE_HISTORY && wake_log.count <= WAKE_HISTORY;
+}
+
+void wake_timer_start()
+{
+  memset(&current, 0, sizeof(current));
+  mark = esp_timer_get_time();
+  current.phase_us[size_t(WakePhase::BOOT)] = mark;
+}
+
+void wake_phase_end(WakePhase phase)
+{
+  const int64_t now = esp_timer_get_time();
+  current.phase_us[size_t(phase)] += now - mark;
+  mark = now;
+}
+
+void wake_set_flags(uint8_t flags)
+{
+  current.flags |= flags;
+}
+
+void wake_timer_commit()
+{
+  if (!log_valid())
+  {
+    memset(&wake_log, 0, sizeof(wake_log));
+    wake_log.magic = wake_log_magic;
+  }
+  wake_log.records[wake_log.head] = current;
+  wake_log.head = (wake_log.head + 1) % WAKE_HISTORY;
+  if (wake_log.count < WAKE_HISTORY)
+    wake_log.count++;
+
+  uint32_t total = 0;
+  for (auto us : current.phase_us)
+    total += us;
+  ESP_LOGI(TAG, "Wake took %u ms", total / 1000);
+}
+
+void wake_history(std::vector<WakeRecord> &records)
+{
+  records.clear();
+  if (!log_valid())
+    return;
+  const uint16_t first = (wake_log.head + WAKE_HISTORY - wake_log.count) % WAKE_HISTORY;
+  for (uint16_t i = 0; i < wake_log.count; i++)
+    records.push_back(wake_log.records[(first + i) % WAKE_HISTORY]);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Parts of a timer wake, in the order main_task runs them.
+enum class WakePhase : uint8_t
+{
+  BOOT,     // application start-up until main_task
+  NVS,      // nvs_flash_init
+  DISPLAY,  // display.begin and clearDisplay
+  SELECT,   // settings and the photo index
+  RENDER,   // frame cache or decoding
+  DRAW,     // frame or image into the display buffer
+  REFRESH,  // display.display
+  SETTLE,   // delay before deep sleep
+  COUNT,
+};
+
+static const size_t WAKE_PHASES = size_t(WakePhase::COUNT);
+
+// JSON names of the phases.
+extern const char *const wake_phase_names[WAKE_PHASES];
+
+static const uint8_t WAKE_CACHE_HIT = 0x01;
+static const uint8_t WAKE_FAILED = 0x02;
+static const uint8_t WAKE_SKIPPED = 0x04;
+
+// Starts timing a wake. BOOT covers everything before this call.
+void wake_timer_start();
+// Charges the time since the previous mark to phase.
+void wake_phase_end(WakePhase phase);
+void wake_set_flags(uint8_t flags);
+// Adds the wake to the history kept across deep sleep and resets.
+void wake_timer_commit();
+
+struct WakeRecord
+{
+  uint32_t phase_us[WAKE_PHASES];
+  uint8_t flags;
+  uint8_t reserved[3];
+};
+
+// Copies the recorded wakes, oldest first.
+void wake_history(std::vector<WakeRecord> &records);
@@ -0,0 +1,172 @@
+#ifdef INKART_BENCH
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "base64.hpp"
+#include "dither.hpp"
+#include "microbench.hpp"
+
+static const char *TAG = "microbench";
+
+static const uint8_t base64table[256] =
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x3f, 0x3e, 0x3e, 0x3f,
+     0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+     0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x00, 0x00, 0x00, 0x00, 0x3f,
+     0x00, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+     0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33};
+
+#define b64d(i) ((uint32_t)base64table[(uint8_t)i])
+
+ssize_t b64decode_table(const char *data, const size_t len, char *buff, const size_t buflen)
+{
+  if (len == 0)
+    return 0;
+  if (len % 4 != 0)
+    return -1;
+
+  uint8_t pad1 = data[len - 1] == '=';
+  uint8_t pad2 = pad1 && data[len - 2] != '=';
+  const size_t last = (len - pad1) / 4 << 2;
+  const size_t total = last / 4 * 3 + pad1 + pad2;
+
+  if (buflen < total)
+    return -1;
+
+  char *b = buff;
+  for (size_t i = 0; i < last; i += 4)
+  {
+    uint32_t n = b64d(data[i]) << 18 | b64d(data[i + 1]) << 12 | b64d(data[i + 2]) << 6 | b64d(data[i + 3]);
+    *b++ = n >> 16;
+    *b++ = n >> 8 & 0xFF;
+    *b++ = n & 0xFF;
+  }
+
+  if (pad1)
+  {
+    uint32_t n = b64d(data[last]) << 18 | b64d(data[last + 1]) << 12;
+    *b++ = n >> 16;
+    if (pad2)
+    {
+      n |= b64d(data[last + 2]) << 6;
+      *b++ = n >> 8 & 0xFF;
+    }
+  }
+  return b - buff;
+}
+
+static void b64encode(const uint8_t *data, size_t len, char *out)
+{
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t i = 0;
+  for (; i + 2 < len; i += 3)
+  {
+    const uint32_t n = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+    *out++ = alphabet[n >> 18];
+    *out++ = alphabet[n >> 12 & 0x3f];
+    *out++ = alphabet[n >> 6 & 0x3f];
+    *out++ = alphabet[n & 0x3f];
+  }
+  if (i < len)
+  {
+    const uint32_t n = data[i] << 16 | (i + 1 < len ? data[i + 1] << 8 : 0);
+    *out++ = alphabet[n >> 18];
+    *out++ = alphabet[n >> 12 & 0x3f];
+    *out++ = i + 1 < len ? alphabet[n >> 6 & 0x3f] : '=';
+    *out++ = '=';
+  }
+}
+
+template <typename F>
+static void measure(const char *name, size_t bytes, int rounds, F fn, const char *unit = "MB/s")
+{
+  int64_t best = INT64_MAX;
+  for (int r = 0; r < rounds; r++)
+  {
+    const int64_t start = esp_timer_get_time();
+    fn();
+    const int64_t elapsed = esp_timer_get_time() - start;
+    if (elapsed < best)
+      best = elapsed;
+  }
+  ESP_LOGI(TAG, "%-24s %8lld us %8.2f %s", name, (long long)best, best > 0 ? double(bytes) / best : 0.0, unit);
+}
+
+// Runs each dithering method over a band of panel-wide rows.
+static void measure_dither()
+{
+  const int32_t width = 1200, rows = 100;
+  uint8_t *gray = static_cast<uint8_t *>(malloc(width * rows));
+  uint8_t *levels = static_cast<uint8_t *>(malloc(width));
+  if (gray == nullptr || levels == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to allocate dither buffers");
+  }
+  else
+  {
+    for (int32_t i = 0; i < width * rows; i++)
+      gray[i] = esp_random();
+
+    for (size_t m = 0; m < DITHERS; m++)
+    {
+      char name[32];
+      snprintf(name, sizeof(name), "dither %s", dither_names[m]);
+      measure(name, width * rows, 5, [&]
+              {
+                Ditherer ditherer(Dither(m), width);
+                for (int32_t y = 0; y < rows; y++)
+                  ditherer.row(y, gray + y * width, levels);
+              }, "Mpx/s");
+    }
+  }
+  free(gray);
+  free(levels);
+}
+
+void microbench_run()
+{
+  // One upload's worth of recv buffers.
+  const size_t raw_len = 48 * 1024 - 2;
+  const size_t text_len = (raw_len + 2) / 3 * 4;
+  uint8_t *raw = static_cast<uint8_t *>(malloc(raw_len));
+  char *text = static_cast<char *>(malloc(text_len));
+  char *out1 = static_cast<char *>(malloc(raw_len));
+  char *out2 = static_cast<char *>(malloc(raw_len));
+  if (raw == nullptr || text == nullptr || out1 == nullptr || out2 == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to allocate buffers");
+  }
+  else
+  {
+    for (size_t i = 0; i < raw_len; i++)
+      raw[i] = esp_random();
+    b64encode(raw, raw_len, text);
+
+    const int rounds = 10;
+    measure("b64decode table", text_len, rounds, [&]
+            { b64decode_table(text, text_len, out1, raw_len); });
+    measure("b64decode", text_len, rounds, [&]
+            { b64decode(text, text_len, out2, raw_len); });
+    measure("b64decode strict", text_len, rounds, [&]
+            { b64decode(text, text_len, out2, raw_len, true); });
+
+    if (memcmp(raw, out1, raw_len) != 0 || memcmp(raw, out2, raw_len) != 0)
+      ESP_LOGE(TAG, "b64decode output differs from the input");
+  }
+  free(raw);
+  free(text);
+  free(out1);
+  free(out2);
+
+  measure_dither();
+}
+
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+// Micro-benchmarks that run on the device when the firmware is built with
+// INKART_BENCH, and are linked into the host benchmark.
+
+#ifdef INKART_BENCH
+
+#include <cstddef>
+#include <sys/types.h>
+
+// The byte-at-a-time table decoder b64decode() replaced, kept as the
+// reference for comparisons.
+ssize_t b64decode_table(const char *data, const size_t len, char *buff, const size_t buflen);
+
+void microbench_run();
+
+#endif
@@ -0,0 +1,110 @@
+#include <atomic>
+#include <cstdlib>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "readahead.hpp"
+
+static const char *TAG = "readahead";
+
+// Two blocks: one being filled while the other is consumed.
+#define READ_AHEAD_BLOCKS 2
+#define READ_AHEAD_BLOCK_SIZE 8192
+
+// The wake task runs on core 1, which leaves core 0 to the reader.
+#define READ_AHEAD_CORE 0
+
+struct ReadBlock
+{
+  uint8_t *data;
+  int32_t len; // 0 at the end of the file, -1 after a read error
+};
+
+struct ReadAhead
+{
+  FILE *fp;
+  QueueHandle_t free_blocks;
+  QueueHandle_t full_blocks;
+  std::atomic<bool> stop;
+};
+
+static void reader_task(void *arg)
+{
+  auto ra = static_cast<ReadAhead *>(arg);
+  ReadBlock block;
+  do
+  {
+    xQueueReceive(ra->free_blocks, &block, portMAX_DELAY);
+    const size_t n = ra->stop ? 0 : fread(block.data, 1, READ_AHEAD_BLOCK_SIZE, ra->fp);
+    block.len = n > 0 ? int32_t(n) : ferror(ra->fp) ? -1 : 0;
+    // The last block tells the consumer that ra is no longer in use.
+    xQueueSend(ra->full_blocks, &block, portMAX_DELAY);
+  } while (block.len > 0);
+  vTaskDelete(nullptr);
+}
+
+static esp_err_t read_serial(FILE *fp, read_sink_t sink, void *ctx)
+{
+  const size_t buflen = 4096;
+  uint8_t *buff = static_cast<uint8_t *>(malloc(buflen));
+  esp_err_t ret = buff == nullptr ? ESP_ERR_NO_MEM : ESP_OK;
+  size_t len;
+  while (ret == ESP_OK && (len = fread(buff, 1, buflen, fp)) > 0)
+    ret = sink(ctx, buff, len);
+  if (ret == ESP_OK && ferror(fp))
+    ret = ESP_FAIL;
+  free(buff);
+  return ret;
+}
+
+esp_err_t read_ahead(FILE *fp, read_sink_t sink, void *ctx)
+{
+  ReadAhead ra;
+  ra.fp = fp;
+  ra.free_blocks = xQueueCreate(READ_AHEAD_BLOCKS, sizeof(ReadBlock));
+  ra.full_blocks = xQueueCreate(READ_AHEAD_BLOCKS, sizeof(ReadBlock));
+  ra.stop = false;
+  uint8_t *blocks = static_cast<uint8_t *>(malloc(READ_AHEAD_BLOCKS * READ_AHEAD_BLOCK_SIZE));
+
+  bool started = ra.free_blocks != nullptr && ra.full_blocks != nullptr && blocks != nullptr;
+  for (int i = 0; started && i < READ_AHEAD_BLOCKS; i++)
+  {
+    const ReadBlock block = {blocks + i * READ_AHEAD_BLOCK_SIZE, 0};
+    xQueueSend(ra.free_blocks, &block, 0);
+  }
+  started = started && xTaskCreatePinnedToCore(reader_task, "readahead", 4096, &ra, 1, nullptr, READ_AHEAD_CORE) == pdPASS;
+
+  esp_err_t ret = ESP_OK;
+  if (started)
+  {
+    // Keep taking blocks after a failed sink until the reader has stopped.
+    ReadBlock block;
+    for (;;)
+    {
+      xQueueReceive(ra.full_blocks, &block, portMAX_DELAY);
+      if (block.len <= 0)
+        break;
+      if (ret == ESP_OK)
+      {
+        ret = sink(ctx, block.data, block.len);
+        ra.stop = ret != ESP_OK;
+      }
+      xQueueSend(ra.free_blocks, &block, 0);
+    }
+    if (ret == ESP_OK && block.len < 0)
+      ret = ESP_FAIL;
+  }
+  else
+  {
+    ESP_LOGW(TAG, "Reading without read-ahead");
+  }
+
+  if (ra.free_blocks)
+    vQueueDelete(ra.free_blocks);
+  if (ra.full_blocks)
+    vQueueDelete(ra.full_blocks);
+  free(blocks);
+  return started ? ret : read_serial(fp, sink, ctx);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include "esp_err.h"
+
+// Receives file bytes in order. Returning an error stops the read.
+typedef esp_err_t (*read_sink_t)(void *ctx, const uint8_t *data, size_t len);
+
+// Reads a file to its end and passes it to sink block by block. A reader
+// task on the other core fills the next block from the card while sink
+// works on the current one, so the read takes as long as the slower of the
+// two rather than their sum. Without memory for the task or its blocks the
+// file is read in the calling task instead.
+esp_err_t read_ahead(FILE *fp, read_sink_t sink, void *ctx);
@@ -0,0 +1,105 @@
+#include <cstring>
+#include "esp_log.h"
+
+#include "router.hpp"
+
+static const char *TAG = "router";
+
+static int16_t route_for(const RouteTable &table, int16_t node, httpd_method_t method, bool &path_found)
+{
+  for (int16_t r = table.nodes[node].route; r >= 0; r = table.next[r])
+  {
+    path_found = true;
+    if (table.routes[r].method == method)
+      return r;
+  }
+  return -1;
+}
+
+// Matches path, the part of the URI after the slash that leads to the
+// children of parent. Tries a literal first and backs out of it when
+// nothing below fits the method, so /photos/import still reaches
+// /photos/* for a GET.
+static int16_t match(const RouteTable &table, int16_t parent, std::string_view path, httpd_method_t method,
+                     RouteParams &params, bool &path_found)
+{
+  const size_t slash = path.find('/');
+  const std::string_view segment = path.substr(0, slash);
+  for (const auto kind : {RouteSegment::LITERAL, RouteSegment::PARAM, RouteSegment::REST})
+  {
+    for (int16_t c = table.nodes[parent].child; c >= 0; c = table.nodes[c].sibling)
+    {
+      const RouteNode &node = table.nodes[c];
+      if (node.kind != kind)
+        continue;
+      if (kind == RouteSegment::LITERAL && segment != std::string_view(node.text, node.len))
+        continue;
+      if (kind == RouteSegment::PARAM && segment.empty())
+        continue;
+
+      const size_t count = params.count;
+      if (kind != RouteSegment::LITERAL)
+        params.values[params.count++] = kind == RouteSegment::REST ? path : segment;
+      const int16_t route = kind == RouteSegment::REST || slash == std::string_view::npos
+                                ? route_for(table, c, method, path_found)
+                                : match(table, c, path.substr(slash + 1), method, params, path_found);
+      if (route >= 0)
+        return route;
+      params.count = count;
+    }
+  }
+  return -1;
+}
+
+esp_err_t route_dispatch(httpd_req_t *req, const RouteTable &table)
+{
+  const std::string_view uri(req->uri, strcspn(req->uri, "?"));
+  RouteParams params;
+  bool path_found = false;
+  const int16_t route =
+      uri.empty() || uri[0] != '/' ? -1 : match(table, 0, uri.substr(1), req->method, params, path_found);
+  if (route < 0)
+  {
+    ESP_LOGD(TAG, "No route for %d %s", req->method, req->uri);
+    if (path_found)
+      httpd_resp_send_err(req, HTTPD_405_METHOD_NOT_ALLOWED, "Method not allowed.");
+    else
+      httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found.");
+    return ESP_FAIL;
+  }
+  return table.routes[route].handler(req, params);
+}
+
+static esp_err_t route_handler(httpd_req_t *req)
+{
+  return route_dispatch(req, *static_cast<const RouteTable *>(req->user_ctx));
+}
+
+esp_err_t route_register(httpd_handle_t server, const RouteTable &table)
+{
+  for (size_t r = 0; r < table.count; r++)
+  {
+    bool seen = false;
+    for (size_t i = 0; i < r && !seen; i++)
+      seen = table.routes[i].method == table.routes[r].method;
+    if (seen)
+      continue;
+
+    const httpd_uri_t uri = {
+        .uri = "/*",
+        .method = table.routes[r].method,
+        .handler = route_handler,
+        .user_ctx = const_cast<RouteTable *>(&table),
+    };
+    const esp_err_t ret = httpd_register_uri_handler(server, &uri);
+    if (ret != ESP_OK)
+      return ret;
+  }
+  return ESP_OK;
+}
+
+// The method is all httpd has left to tell the handlers apart by.
+bool route_match_all(const char *, const char *, size_t)
+{
+  return true;
+}
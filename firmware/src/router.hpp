@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Most segments one route may capture.
+#define ROUTE_MAX_PARAMS 2
+
+// What the * and ** of a route matched, in order. The views point into
+// req->uri and leave out the query string.
+struct RouteParams
+{
+  size_t count = 0;
+  std::string_view values[ROUTE_MAX_PARAMS];
+
+  std::string_view operator[](size_t i) const
+  {
+    return values[i];
+  }
+};
+
+typedef esp_err_t (*route_fn_t)(httpd_req_t *req, const RouteParams &params);
+
+// An endpoint. Every segment of the pattern is literal text, * for any one
+// segment that is not empty, or, as the last one only, ** for the rest of
+// the path with its slashes.
+struct Route
+{
+  httpd_method_t method;
+  const char *pattern;
+  route_fn_t handler;
+};
+
+enum class RouteSegment : uint8_t
+{
+  LITERAL,
+  PARAM,
+  REST,
+};
+
+// A segment of the trie the patterns are merged into.
+struct RouteNode
+{
+  const char *text = nullptr; // of a literal, not null terminated
+  uint16_t len = 0;
+  RouteSegment kind = RouteSegment::LITERAL;
+  int16_t child = -1;   // first node of the next segment
+  int16_t sibling = -1; // next node for the same segment
+  int16_t route = -1;   // first route ending at this node
+};
+
+// The trie as route_dispatch() walks it.
+struct RouteTable
+{
+  const Route *routes;
+  size_t count;
+  const RouteNode *nodes;
+  const int16_t *next; // route ending at the same node as this one
+};
+
+template <size_t ROUTES, size_t NODES>
+struct RouteTrie
+{
+  const Route *routes = nullptr;
+  RouteNode nodes[NODES] = {};
+  int16_t next[ROUTES] = {};
+  size_t count = 1; // the root, which stands for nothing
+  bool valid = true;
+
+  constexpr RouteTable table() const
+  {
+    return {routes, ROUTES, nodes, next};
+  }
+};
+
+// Nodes the trie of a table needs at most: one per segment and the root.
+template <size_t ROUTES>
+constexpr size_t route_node_bound(const Route (&routes)[ROUTES])
+{
+  size_t count = 1;
+  for (size_t r = 0; r < ROUTES; r++)
+  {
+    for (const char *p = routes[r].pattern; *p != '\0'; p++)
+      count += *p == '/';
+  }
+  return count;
+}
+
+// Merges the patterns into a trie while compiling, so that a request is
+// matched in one walk down its path. A table with a malformed pattern, more
+// captures than ROUTE_MAX_PARAMS or the same method and pattern twice comes
+// out not valid, which is meant for a static_assert.
+template <size_t NODES, size_t ROUTES>
+constexpr RouteTrie<ROUTES, NODES> make_route_trie(const Route (&routes)[ROUTES])
+{
+  RouteTrie<ROUTES, NODES> trie = {};
+  trie.routes = routes;
+  for (size_t r = 0; r < ROUTES; r++)
+  {
+    const char *p = routes[r].pattern;
+    if (*p != '/')
+    {
+      trie.valid = false;
+      return trie;
+    }
+    size_t node = 0, params = 0;
+    while (*p == '/')
+    {
+      p++;
+      size_t len = 0;
+      while (p[len] != '\0' && p[len] != '/')
+        len++;
+      RouteSegment kind = RouteSegment::LITERAL;
+      if (len == 1 && p[0] == '*')
+        kind = RouteSegment::PARAM;
+      else if (len == 2 && p[0] == '*' && p[1] == '*')
+        kind = RouteSegment::REST;
+      if ((kind != RouteSegment::LITERAL && ++params > ROUTE_MAX_PARAMS) ||
+          (kind == RouteSegment::REST && p[len] != '\0'))
+      {
+        trie.valid = false;
+        return trie;
+      }
+
+      int16_t found = -1;
+      for (int16_t c = trie.nodes[node].child; c >= 0 && found < 0; c = trie.nodes[c].sibling)
+      {
+        const RouteNode &other = trie.nodes[c];
+        if (other.kind != kind || other.len != len)
+          continue;
+        bool same = true;
+        for (size_t i = 0; i < len && same; i++)
+          same = other.text[i] == p[i];
+        if (same)
+          found = c;
+      }
+      if (found < 0)
+      {
+        found = trie.count++;
+        trie.nodes[found].text = p;
+        trie.nodes[found].len = len;
+        trie.nodes[found].kind = kind;
+        trie.nodes[found].sibling = trie.nodes[node].child;
+        trie.nodes[node].child = found;
+      }
+      node = found;
+      p += len;
+    }
+
+    for (int16_t other = trie.nodes[node].route; other >= 0; other = trie.next[other])
+    {
+      if (routes[other].method == routes[r].method)
+        trie.valid = false;
+    }
+    trie.next[r] = trie.nodes[node].route;
+    trie.nodes[node].route = r;
+  }
+  return trie;
+}
+
+// Calls the handler of the route matching the method and path of the
+// request. Literal segments win over *, and * over **. Paths that only some
+// other method has answer 405, the rest 404.
+esp_err_t route_dispatch(httpd_req_t *req, const RouteTable &table);
+
+// Registers one catch-all handler for each method of the table, all leading
+// to route_dispatch(). The server must have been started with
+// route_match_all as its uri_match_fn and the table must outlive it.
+esp_err_t route_register(httpd_handle_t server, const RouteTable &table);
+
+bool route_match_all(const char *reference_uri, const char *uri_to_match, size_t match_upto);
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "files.hpp"
+#include "session.hpp"
+
+static const char *TAG = "session";
+
+// Only the HTTP server task touches the sessions.
+static std::vector<UploadSession> sessions;
+
+std::string upload_session_path(uint32_t id)
+{
+  char buff[32];
+  snprintf(buff, sizeof(buff), SDCARD_ROOT "/%08x.part", id);
+  return buff;
+}
+
+esp_err_t upload_session_create(uint32_t size, uint32_t &id)
+{
+  if (size == 0 || size > UPLOAD_SESSION_MAX_SIZE)
+    return ESP_ERR_INVALID_ARG;
+
+  if (sessions.size() >= UPLOAD_SESSIONS)
+  {
+    const auto idle = std::min_element(sessions.begin(), sessions.end(),
+                                       [](const UploadSession &a, const UploadSession &b)
+                                       { return a.touched < b.touched; });
+    ESP_LOGW(TAG, "Dropping idle session %08x", idle->id);
+    upload_session_remove(idle->id);
+  }
+
+  // Random, so that a client still holding an id from before a reboot gets
+  // 404 rather than somebody else's session.
+  do
+  {
+    id = esp_random();
+  } while (id == 0 || upload_session_find(id) != nullptr);
+
+  FILE *fp = fopen(upload_session_path(id).c_str(), "wb");
+  if (fp == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to create %s", upload_session_path(id).c_str());
+    return ESP_FAIL;
+  }
+  fclose(fp);
+
+  sessions.push_back({id, size, {}, esp_timer_get_time()});
+  ESP_LOGI(TAG, "Session %08x for %u bytes", id, size);
+  return ESP_OK;
+}
+
+UploadSession *upload_session_find(uint32_t id)
+{
+  for (auto &session : sessions)
+  {
+    if (session.id == id)
+      return &session;
+  }
+  return nullptr;
+}
+
+void upload_session_add(UploadSession &session, uint32_t first, uint32_t last)
+{
+  session.touched = esp_timer_get_time();
+  if (first >= last)
+    return;
+
+  // Merge with every range it overlaps or touches.
+  auto &ranges = session.received;
+  auto it = std::lower_bound(ranges.begin(), ranges.end(), first,
+                             [](const std::pair<uint32_t, uint32_t> &range, uint32_t value)
+                             { return range.second < value; });
+  auto end = it;
+  while (end != ranges.end() && end->first <= last)
+  {
+    first = std::min(first, end->first);
+    last = std::max(last, end->second);
+    ++end;
+  }
+  it = ranges.erase(it, end);
+  ranges.insert(it, {first, last});
+}
+
+void upload_session_remove(uint32_t id, bool keep_file)
+{
+  const auto it = std::find_if(sessions.begin(), sessions.end(), [id](const UploadSession &session)
+                               { return session.id == id; });
+  if (it == sessions.end())
+    return;
+  if (!keep_file)
+    remove(upload_session_path(id).c_str());
+  sessions.erase(it);
+}
+
+void upload_session_sweep()
+{
+  DIR *dir = opendir(SDCARD_ROOT);
+  if (dir == nullptr)
+    return;
+  std::vector<std::string> stale;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != nullptr)
+  {
+    const size_t len = strlen(ent->d_name);
+    if (ent->d_type == DT_REG && len > 5 && strcmp(ent->d_name + len - 5, ".part") == 0)
+      stale.push_back(SDCARD_ROOT "/" + std::string(ent->d_name));
+  }
+  closedir(dir);
+
+  for (const auto &path : stale)
+  {
+    ESP_LOGI(TAG, "Removing stale %s", path.c_str());
+    remove(path.c_str());
+  }
+}
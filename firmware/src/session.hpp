@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "esp_err.h"
+
+// Open upload sessions at a time. Creating one more drops the session that
+// has been idle longest.
+#define UPLOAD_SESSIONS 4
+// Largest photo a session takes.
+#define UPLOAD_SESSION_MAX_SIZE (32u << 20)
+
+// A photo that arrives in chunks at explicit offsets, possibly over several
+// connections and out of order, into a .part file the photo index ignores.
+struct UploadSession
+{
+  uint32_t id;
+  uint32_t size;
+  // Byte ranges [first, second) that have arrived, sorted and disjoint.
+  std::vector<std::pair<uint32_t, uint32_t>> received;
+  int64_t touched; // esp_timer time of the last use
+
+  bool complete() const { return received.size() == 1 && received[0].first == 0 && received[0].second == size; }
+};
+
+std::string upload_session_path(uint32_t id);
+
+// Creates the session and its empty .part file.
+esp_err_t upload_session_create(uint32_t size, uint32_t &id);
+// The session, or nullptr. The pointer stays valid until the next call
+// that creates or removes a session.
+UploadSession *upload_session_find(uint32_t id);
+// Records that [first, last) has been written.
+void upload_session_add(UploadSession &session, uint32_t first, uint32_t last);
+// Forgets the session, removing its .part file unless keep_file is set.
+void upload_session_remove(uint32_t id, bool keep_file = false);
+// Removes the .part files that uploads cut off by a reboot left on the card.
+// Sessions live only in RAM, so none of them can be resumed. Call before the
+// server takes requests.
+void upload_session_sweep();
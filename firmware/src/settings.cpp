@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "esp_log.h"
+#include "nvs_flash.h"
+
+#include "dither.hpp"
+#include "lock.hpp"
+#include "settings.hpp"
+
+using nlohmann::json;
+
+// Settings live in the system_settings namespace as a SettingsBlob under
+// "settings". Version 1 firmware stored one key per field; those are read
+// once through the schema below and then erased.
+
+static const char *TAG = "settings";
+
+static const char *settings_namespace = "system_settings";
+static const char *settings_key = "settings";
+static const uint16_t settings_version = 2;
+
+struct SettingsBlob
+{
+  uint16_t version;
+  uint16_t length; // bytes of Settings stored, shorter for older firmware
+  Settings settings;
+};
+
+static_assert(sizeof(Settings) == 16, "Settings is stored in NVS");
+
+enum class FieldType : uint8_t
+{
+  BOOL,
+  U8,
+  U16,
+  I16,
+};
+
+struct SettingField
+{
+  const char *key;    // NVS key of the version 1 layout
+  const char *parent; // enclosing JSON object, or nullptr
+  const char *name;   // JSON member name
+  SettingsGroup group;
+  FieldType type;
+  uint8_t offset;
+  int32_t def;
+  int32_t min;
+  int32_t max;
+  const char *const *names; // JSON strings of an enumeration, or nullptr
+};
+
+static const char *const orientations[] = {
+    "landscape",
+    "portrait-left",
+    "upside-down",
+    "portrait-right",
+};
+
+#define FIELD(member) uint8_t(offsetof(Settings, member))
+
+static const SettingField schema[] = {
+    {"refresh", nullptr, "refresh", SettingsGroup::TIME, FieldType::U16, FIELD(refresh), 0, 0, 7 * 24 * 60, nullptr},
+    {"shuffle", nullptr, "shuffle", SettingsGroup::TIME, FieldType::BOOL, FIELD(shuffle), 0, 0, 1, nullptr},
+    {"invert", nullptr, "invert", SettingsGroup::DISPLAY, FieldType::BOOL, FIELD(invert), 0, 0, 1, nullptr},
+    {"dithering", nullptr, "dithering", SettingsGroup::DISPLAY, FieldType::BOOL, FIELD(dithering), 0, 0, 1, nullptr},
+    {"orientation", nullptr, "orientation", SettingsGroup::DISPLAY, FieldType::U8, FIELD(orientation), 0, 0, 3,
+     orientations},
+    {"padding-top", "padding", "top", SettingsGroup::DISPLAY, FieldType::I16, FIELD(padding_top), 0, -4096, 4096,
+     nullptr},
+    {"padding-left", "padding", "left", SettingsGroup::DISPLAY, FieldType::I16, FIELD(padding_left), 0, -4096, 4096,
+     nullptr},
+    {"padding-right", "padding", "right", SettingsGroup::DISPLAY, FieldType::I16, FIELD(padding_right), 0, -4096,
+     4096, nullptr},
+    {"padding-bottom", "padding", "bottom", SettingsGroup::DISPLAY, FieldType::I16, FIELD(padding_bottom), 0, -4096,
+     4096, nullptr},
+    {"algorithm", nullptr, "algorithm", SettingsGroup::DISPLAY, FieldType::U8, FIELD(dither),
+     int32_t(Dither::FLOYD_STEINBERG), int32_t(Dither::FLOYD_STEINBERG), int32_t(DITHERS) - 1, dither_names},
+};
+
+static int32_t get_field(const Settings &settings, const SettingField &field)
+{
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(&settings) + field.offset;
+  switch (field.type)
+  {
+  case FieldType::BOOL: // read as a byte so stray values fail the range check
+  case FieldType::U8:
+    return *p;
+  case FieldType::U16:
+    return *reinterpret_cast<const uint16_t *>(p);
+  case FieldType::I16:
+    return *reinterpret_cast<const int16_t *>(p);
+  }
+  return 0;
+}
+
+static void set_field(Settings &settings, const SettingField &field, int32_t value)
+{
+  uint8_t *p = reinterpret_cast<uint8_t *>(&settings) + field.offset;
+  switch (field.type)
+  {
+  case FieldType::BOOL:
+    *reinterpret_cast<bool *>(p) = value;
+    break;
+  case FieldType::U8:
+    *p = value;
+    break;
+  case FieldType::U16:
+    *reinterpret_cast<uint16_t *>(p) = value;
+    break;
+  case FieldType::I16:
+    *reinterpret_cast<int16_t *>(p) = value;
+    break;
+  }
+}
+
+static void set_defaults(Settings &settings)
+{
+  memset(&settings, 0, sizeof(settings));
+  for (const auto &field : schema)
+    set_field(settings, field, field.def);
+}
+
+// Reads whatever version 1 keys exist, keeping defaults for the rest.
+static bool load_legacy(nvs_handle_t handle, Settings &settings)
+{
+  bool found = false;
+  for (const auto &field : schema)
+  {
+    esp_err_t ret;
+    int32_t value = 0;
+    switch (field.type)
+    {
+    case FieldType::BOOL:
+    case FieldType::U8:
+    {
+      uint8_t v;
+      ret = nvs_get_u8(handle, field.key, &v);
+      value = v;
+      break;
+    }
+    case FieldType::U16:
+    {
+      uint16_t v;
+      ret = nvs_get_u16(handle, field.key, &v);
+      value = v;
+      break;
+    }
+    case FieldType::I16:
+    {
+      int16_t v;
+      ret = nvs_get_i16(handle, field.key, &v);
+      value = v;
+      break;
+    }
+    default:
+      ret = ESP_ERR_NOT_SUPPORTED;
+      break;
+    }
+    if (ret == ESP_OK && value >= field.min && value <= field.max)
+    {
+      set_field(settings, field, value);
+      found = true;
+    }
+  }
+  return found;
+}
+
+static esp_err_t store(nvs_handle_t handle, const Settings &settings)
+{
+  const SettingsBlob blob = {settings_version, sizeof(Settings), settings};
+  esp_err_t ret = nvs_set_blob(handle, settings_key, &blob, sizeof(blob));
+  if (ret == ESP_OK)
+    ret = nvs_commit(handle);
+  return ret;
+}
+
+static Settings cached;
+static bool loaded = false;
+
+static void load(Settings &settings)
+{
+  set_defaults(settings);
+
+  nvs_handle_t handle;
+  if (nvs_open(settings_namespace, NVS_READWRITE, &handle) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to open settings, using defaults");
+    return;
+  }
+
+  // A blob from older firmware is shorter and its missing fields keep their
+  // defaults; one from newer firmware is longer and its extra fields are
+  // unknown here.
+  size_t length = 0;
+  if (nvs_get_blob(handle, settings_key, nullptr, &length) == ESP_OK)
+  {
+    std::vector<uint8_t> data(length);
+    SettingsBlob blob;
+    const size_t header = offsetof(SettingsBlob, settings);
+    if (length >= header && nvs_get_blob(handle, settings_key, data.data(), &length) == ESP_OK)
+    {
+      memcpy(&blob, data.data(), header);
+      memcpy(&settings, data.data() + header, std::min({size_t(blob.length), length - header, sizeof(Settings)}));
+      if (blob.version < settings_version)
+      {
+        ESP_LOGI(TAG, "Upgrading settings from version %d", blob.version);
+        store(handle, settings);
+      }
+    }
+  }
+  else if (load_legacy(handle, settings))
+  {
+    ESP_LOGI(TAG, "Migrating settings to version %d", settings_version);
+    for (const auto &field : schema)
+      nvs_erase_key(handle, field.key);
+    nvs_erase_key(handle, "version");
+    store(handle, settings);
+  }
+  nvs_close(handle);
+
+  // Never trust stored values further than the schema allows.
+  for (const auto &field : schema)
+  {
+    const int32_t value = get_field(settings, field);
+    if (value < field.min || value > field.max)
+      set_field(settings, field, field.def);
+  }
+}
+
+Settings settings_get()
+{
+  StoreLock lock;
+  if (!loaded)
+  {
+    load(cached);
+    loaded = true;
+  }
+  return cached;
+}
+
+esp_err_t settings_set(const Settings &settings)
+{
+  StoreLock lock;
+  const Settings current = settings_get();
+  if (memcmp(&current, &settings, sizeof(Settings)) == 0)
+    return ESP_OK;
+
+  nvs_handle_t handle;
+  esp_err_t ret = nvs_open(settings_namespace, NVS_READWRITE, &handle);
+  if (ret == ESP_OK)
+  {
+    ret = store(handle, settings);
+    nvs_close(handle);
+  }
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to store settings: %s", esp_err_to_name(ret));
+    return ret;
+  }
+  cached = settings;
+  return ESP_OK;
+}
+
+void settings_to_json(const Settings &settings, SettingsGroup group, ArenaJson &j)
+{
+  for (const auto &field : schema)
+  {
+    if (field.group != group)
+      continue;
+    ArenaJson &target = field.parent ? j[field.parent][field.name] : j[field.name];
+    const int32_t value = get_field(settings, field);
+    if (field.names)
+      target = field.names[value];
+    else if (field.type == FieldType::BOOL)
+      target = bool(value);
+    else
+      target = value;
+  }
+}
+
+// Whether path, with object keys joined by '/', leads to field.
+static bool field_at(const SettingField &field, const std::string &path)
+{
+  if (field.parent == nullptr)
+    return path == field.name;
+  const size_t len = strlen(field.parent);
+  return path.size() > len && path[len] == '/' && path.compare(0, len, field.parent) == 0 &&
+         path.compare(len + 1, std::string::npos, field.name) == 0;
+}
+
+esp_err_t settings_field_from_json(const std::string &path, const json &value, SettingsGroup group,
+                                   Settings &settings)
+{
+  for (const auto &field : schema)
+  {
+    if (field.group != group || !field_at(field, path))
+      continue;
+
+    int32_t result;
+    if (field.names && value.is_string())
+    {
+      const auto &str = value.get_ref<const std::string &>();
+      for (result = field.min; result <= field.max; result++)
+      {
+        if (str == field.names[result])
+          break;
+      }
+    }
+    else if (field.type == FieldType::BOOL && value.is_boolean())
+    {
+      result = value.get<bool>();
+    }
+    else if (value.is_number_integer())
+    {
+      // Older clients send flags as 0 and 1.
+      const int64_t v = value.get<int64_t>();
+      result = v < field.min || v > field.max ? field.max + 1 : int32_t(v);
+    }
+    else
+    {
+      result = field.max + 1;
+    }
+
+    if (result < field.min || result > field.max)
+    {
+      ESP_LOGW(TAG, "Invalid value for %s", field.name);
+      return ESP_ERR_INVALID_ARG;
+    }
+    set_field(settings, field, result);
+    return ESP_OK;
+  }
+  return ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "esp_err.h"
+
+#include "arena.hpp"
+#include "nlohmann/json.hpp"
+
+// Everything the user configures. Stored in NVS as one blob, so new fields
+// go at the end.
+struct Settings
+{
+  uint16_t refresh; // minutes between photos, 0 for the default
+  bool shuffle;
+  bool invert;
+  bool dithering;
+  uint8_t orientation; // display rotation
+  int16_t padding_top;
+  int16_t padding_left;
+  int16_t padding_right;
+  int16_t padding_bottom;
+  uint8_t dither; // Dither used when dithering is on
+  uint8_t reserved;
+};
+
+// The API endpoint that exposes a setting.
+enum class SettingsGroup : uint8_t
+{
+  TIME,
+  DISPLAY,
+};
+
+// Returns a copy of the settings, reading NVS on first use only.
+Settings settings_get();
+// Stores settings, writing flash only when they differ from the current ones.
+esp_err_t settings_set(const Settings &settings);
+
+void settings_to_json(const Settings &settings, SettingsGroup group, ArenaJson &j);
+// Applies the field of group found at path in a request body, with object
+// keys joined by '/' as in "padding/top". Returns ESP_ERR_NOT_FOUND for a
+// path that is no such field, and ESP_ERR_INVALID_ARG, leaving settings as
+// they were, for a value of the wrong type or range.
+esp_err_t settings_field_from_json(const std::string &path, const nlohmann::json &value, SettingsGroup group,
+                                   Settings &settings);
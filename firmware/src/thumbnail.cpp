@@ -0,0 +1,220 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include "esp_log.h"
+
+#include "lock.hpp"
+#include "thumbnail.hpp"
+
+static const char *TAG = "thumbnail";
+
+ThumbnailStream::ThumbnailStream() : decoder(row_cb, this)
+{
+  // The box filter still gets at least twice the pixels it puts out.
+  decoder.fit(2 * THUMBNAIL_SIZE, 2 * THUMBNAIL_SIZE);
+}
+
+ThumbnailStream::~ThumbnailStream()
+{
+  free(column);
+  free(column_size);
+  free(sums);
+  free(pixels);
+}
+
+esp_err_t ThumbnailStream::feed(const uint8_t *data, size_t len)
+{
+  if (!decoder.feed(data, len))
+    return ESP_ERR_INVALID_ARG;
+  return failed ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+void ThumbnailStream::row_cb(void *ctx, int32_t y, const uint8_t *gray)
+{
+  static_cast<ThumbnailStream *>(ctx)->row(y, gray);
+}
+
+void ThumbnailStream::row(int32_t y, const uint8_t *gray)
+{
+  const int32_t w = decoder.width(), h = decoder.height();
+  if (failed)
+    return;
+  if (pixels == nullptr)
+  {
+    const int32_t longest = w > h ? w : h;
+    tw = longest > THUMBNAIL_SIZE ? w * THUMBNAIL_SIZE / longest : w;
+    th = longest > THUMBNAIL_SIZE ? h * THUMBNAIL_SIZE / longest : h;
+    tw = tw > 0 ? tw : 1;
+    th = th > 0 ? th : 1;
+    column = static_cast<uint16_t *>(malloc(w * sizeof(uint16_t)));
+    column_size = static_cast<uint16_t *>(calloc(tw, sizeof(uint16_t)));
+    sums = static_cast<uint32_t *>(calloc(tw, sizeof(uint32_t)));
+    pixels = static_cast<uint8_t *>(malloc(tw * th));
+    if (column == nullptr || column_size == nullptr || sums == nullptr || pixels == nullptr)
+    {
+      failed = true;
+      return;
+    }
+    for (int32_t x = 0; x < w; x++)
+    {
+      column[x] = x * tw / w;
+      column_size[column[x]]++;
+    }
+  }
+
+  // Rows come strictly upwards or downwards, so a band is complete as soon
+  // as a row from another one shows up.
+  const int32_t ty = y * th / h;
+  if (ty != band)
+  {
+    flush();
+    band = ty;
+  }
+  for (int32_t x = 0; x < w; x++)
+    sums[column[x]] += gray[x];
+  band_rows++;
+}
+
+void ThumbnailStream::flush()
+{
+  if (band_rows == 0)
+    return;
+  uint8_t *out = pixels + band * tw;
+  for (int32_t x = 0; x < tw; x++)
+  {
+    const uint32_t n = column_size[x] * band_rows;
+    out[x] = (sums[x] + n / 2) / n;
+    sums[x] = 0;
+  }
+  band_rows = 0;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+esp_err_t ThumbnailStream::write(const char *path)
+{
+  if (failed)
+    return ESP_ERR_NO_MEM;
+  if (!decoder.done())
+    return ESP_ERR_INVALID_SIZE;
+  flush();
+
+  const uint32_t stride = ((tw * 4 + 31) / 32) * 4;
+  const uint32_t offset = 14 + 40 + 16 * 4;
+  uint8_t header[offset] = {'B', 'M'};
+  put32(header + 2, offset + stride * th);
+  put32(header + 10, offset);
+  put32(header + 14, 40);
+  put32(header + 18, tw);
+  put32(header + 22, th);
+  put16(header + 26, 1);
+  put16(header + 28, 4);
+  put32(header + 34, stride * th);
+  put32(header + 46, 16);
+  for (int i = 0; i < 16; i++)
+    memset(header + 54 + i * 4, i * 17, 3);
+
+  // Write under another name so that an interrupted write never leaves a
+  // truncated thumbnail behind.
+  const std::string tmp = std::string(path) + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  uint8_t *line = static_cast<uint8_t *>(calloc(stride, 1));
+  if (fp == nullptr || line == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to create %s", tmp.c_str());
+    if (fp)
+      fclose(fp);
+    free(line);
+    return fp ? ESP_ERR_NO_MEM : ESP_FAIL;
+  }
+
+  bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+  for (int32_t y = th - 1; ok && y >= 0; y--)
+  {
+    const uint8_t *in = pixels + y * tw;
+    for (int32_t x = 0; x < tw; x += 2)
+      line[x >> 1] = (in[x] >> 4) << 4 | (x + 1 < tw ? in[x + 1] >> 4 : 0);
+    ok = fwrite(line, 1, stride, fp) == stride;
+  }
+  free(line);
+  if (fclose(fp) != 0 || !ok || rename(tmp.c_str(), path) != 0)
+  {
+    ESP_LOGE(TAG, "Failed to write %s", path);
+    remove(tmp.c_str());
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+std::string thumbnail_path(const std::string &name)
+{
+  return THUMBS_DIR "/" + name;
+}
+
+esp_err_t thumbnail_store(const PhotoRecord &record, ThumbnailStream &stream)
+{
+  StoreLock lock;
+  if (!library_current(record))
+    return ESP_ERR_NOT_FOUND;
+  mkdir(LIBRARY_DIR, 0755);
+  mkdir(THUMBS_DIR, 0755);
+  const esp_err_t ret = stream.write(thumbnail_path(record.name).c_str());
+  if (ret != ESP_OK)
+    ESP_LOGE(TAG, "Failed to make thumbnail of %s: %s", record.name, esp_err_to_name(ret));
+  return ret;
+}
+
+esp_err_t thumbnail_fill(const PhotoRecord &record)
+{
+  const auto path = thumbnail_path(record.name);
+  struct stat st;
+  {
+    StoreLock lock;
+    if (stat(path.c_str(), &st) == 0)
+      return ESP_OK;
+  }
+
+  // Decoding runs without the lock; thumbnail_store() checks the photo is
+  // still there before writing.
+  const auto source = photo_path(record);
+  FILE *fp = fopen(source.c_str(), "rb");
+  if (fp == nullptr)
+  {
+    ESP_LOGE(TAG, "Failed to open %s", source.c_str());
+    return ESP_FAIL;
+  }
+
+  const size_t buflen = 4096;
+  uint8_t *buff = static_cast<uint8_t *>(malloc(buflen));
+  ThumbnailStream stream;
+  esp_err_t ret = buff == nullptr ? ESP_ERR_NO_MEM : ESP_OK;
+  size_t len;
+  while (ret == ESP_OK && (len = fread(buff, 1, buflen, fp)) > 0)
+    ret = stream.feed(buff, len);
+  free(buff);
+  fclose(fp);
+
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to read %s: %s", source.c_str(), esp_err_to_name(ret));
+    return ret;
+  }
+  return thumbnail_store(record, stream);
+}
+
+void thumbnail_remove(const std::string &name)
+{
+  StoreLock lock;
+  remove(thumbnail_path(name).c_str());
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "esp_err.h"
+
+#include "image.hpp"
+#include "library.hpp"
+
+#define THUMBS_DIR LIBRARY_DIR "/thumbs"
+
+// Longest side of a thumbnail in pixels. Smaller photos keep their size.
+#define THUMBNAIL_SIZE 240
+
+// Shrinks a photo that arrives in pieces with a box filter: every thumbnail
+// pixel is the mean of the photo pixels that fall into it. The result is
+// kept in memory and written as a 4-bit grayscale BMP, which holds every
+// level the panel can show in about a twentieth of a panel-sized photo.
+class ThumbnailStream
+{
+public:
+  ThumbnailStream();
+  ~ThumbnailStream();
+  ThumbnailStream(const ThumbnailStream &) = delete;
+  ThumbnailStream &operator=(const ThumbnailStream &) = delete;
+
+  // Returns ESP_ERR_INVALID_ARG for data that is not a supported photo.
+  esp_err_t feed(const uint8_t *data, size_t len);
+  // Returns ESP_ERR_INVALID_SIZE until the last row has arrived.
+  esp_err_t write(const char *path);
+
+private:
+  static void row_cb(void *ctx, int32_t y, const uint8_t *gray);
+  void row(int32_t y, const uint8_t *gray);
+  void flush();
+
+  PhotoDecoder decoder;
+  int32_t tw = 0;
+  int32_t th = 0;
+  uint16_t *column = nullptr;     // thumbnail column of each photo column
+  uint16_t *column_size = nullptr; // photo columns in each thumbnail column
+  uint32_t *sums = nullptr;
+  uint8_t *pixels = nullptr;
+  int32_t band = -1;
+  int32_t band_rows = 0;
+  bool failed = false;
+};
+
+std::string thumbnail_path(const std::string &name);
+esp_err_t thumbnail_store(const PhotoRecord &record, ThumbnailStream &stream);
+// Makes the thumbnail of a photo unless there already is one.
+esp_err_t thumbnail_fill(const PhotoRecord &record);
+void thumbnail_remove(const std::string &name);
@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "esp_log.h"
+
+#include "base64.hpp"
+#include "events.hpp"
+#include "upload.hpp"
+
+static const char *TAG = "upload";
+
+static const size_t recv_buffer_size = 8192;
+// Receive timeouts in a row before a stalled client is dropped, so that it
+// cannot hold the server task.
+static const int recv_timeout_retries = 3;
+// Bytes between upload events, enough to move a progress bar.
+static const size_t upload_progress_step = 65536;
+
+esp_err_t Base64Stream::decode(const char *data, size_t len)
+{
+  while (len > 0)
+  {
+    const size_t n = std::min(len, sizeof(out) / 3 * 4);
+    const auto decoded = b64decode(data, n, out, sizeof(out), true);
+    if (decoded < 0)
+      return ESP_ERR_INVALID_ARG;
+    const esp_err_t ret = sink(ctx, reinterpret_cast<const uint8_t *>(out), decoded);
+    if (ret != ESP_OK)
+      return ret;
+    data += n;
+    len -= n;
+  }
+  return ESP_OK;
+}
+
+esp_err_t Base64Stream::feed(const char *data, size_t len)
+{
+  if (carry_len > 0)
+  {
+    const size_t n = std::min(len, sizeof(carry) - carry_len);
+    memcpy(carry + carry_len, data, n);
+    carry_len += n;
+    data += n;
+    len -= n;
+    if (carry_len < sizeof(carry))
+      return ESP_OK;
+    carry_len = 0;
+    const esp_err_t ret = decode(carry, sizeof(carry));
+    if (ret != ESP_OK)
+      return ret;
+  }
+
+  const size_t whole = len & ~size_t(3);
+  const esp_err_t ret = decode(data, whole);
+  carry_len = len - whole;
+  memcpy(carry, data + whole, carry_len);
+  return ret;
+}
+
+esp_err_t Base64Stream::finish()
+{
+  return carry_len == 0 ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+esp_err_t MultipartStream::begin(const char *content_type)
+{
+  const char *p = strstr(content_type, "boundary=");
+  if (p == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  p += strlen("boundary=");
+
+  std::string boundary;
+  if (*p == '"')
+  {
+    const char *end = strchr(++p, '"');
+    if (end == nullptr)
+      return ESP_ERR_INVALID_ARG;
+    boundary.assign(p, end);
+  }
+  else
+  {
+    boundary.assign(p, strcspn(p, "; \t"));
+  }
+  if (boundary.empty() || boundary.size() > 70)
+    return ESP_ERR_INVALID_ARG;
+
+  // The first delimiter may open the body, so behave as if the CRLF that
+  // precedes every delimiter had already been seen.
+  delimiter = "\r\n--" + boundary;
+  matched = 2;
+  return ESP_OK;
+}
+
+// Looks for the delimiter, passing everything before it to the sink while in
+// the body. The boundary cannot contain CR, so a failed partial match never
+// hides the start of another one.
+esp_err_t MultipartStream::scan(const uint8_t *data, size_t len, size_t &used)
+{
+  const bool body = state == State::BODY;
+  size_t i = 0;
+  while (i < len)
+  {
+    if (matched == 0)
+    {
+      const void *cr = memchr(data + i, '\r', len - i);
+      const size_t n = cr ? static_cast<const uint8_t *>(cr) - (data + i) : len - i;
+      if (n > 0)
+      {
+        if (body)
+        {
+          const esp_err_t ret = sink(ctx, data + i, n);
+          if (ret != ESP_OK)
+            return ret;
+        }
+        i += n;
+        continue;
+      }
+    }
+
+    if (data[i] == static_cast<uint8_t>(delimiter[matched]))
+    {
+      i++;
+      if (++matched == delimiter.size())
+      {
+        matched = 0;
+        state = body ? State::DONE : State::HEADERS;
+        break;
+      }
+    }
+    else
+    {
+      if (body)
+      {
+        const esp_err_t ret = sink(ctx, reinterpret_cast<const uint8_t *>(delimiter.data()), matched);
+        if (ret != ESP_OK)
+          return ret;
+      }
+      matched = 0;
+    }
+  }
+  used = i;
+  return ESP_OK;
+}
+
+esp_err_t MultipartStream::feed(const uint8_t *data, size_t len)
+{
+  while (len > 0 && state != State::DONE)
+  {
+    size_t used = 0;
+    if (state == State::HEADERS)
+    {
+      // Part headers are not needed; skip to the blank line that ends them.
+      while (used < len && header_tail != 0x0d0a0d0a)
+      {
+        header_tail = header_tail << 8 | data[used++];
+        if (++header_len > 1024)
+          return ESP_ERR_INVALID_ARG;
+      }
+      if (header_tail == 0x0d0a0d0a)
+        state = State::BODY;
+    }
+    else
+    {
+      const esp_err_t ret = scan(data, len, used);
+      if (ret != ESP_OK)
+        return ret;
+    }
+    data += used;
+    len -= used;
+  }
+  return ESP_OK;
+}
+
+esp_err_t MultipartStream::finish()
+{
+  return state == State::DONE ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static uint32_t parse_octal(const uint8_t *p, size_t len, bool &valid)
+{
+  uint32_t value = 0;
+  size_t i = 0;
+  while (i < len && p[i] == ' ')
+    i++;
+  for (; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+  {
+    if (value >> 29)
+      valid = false;
+    value = value << 3 | (p[i] - '0');
+  }
+  // Numbers end in NUL or space; base-256 sizes of huge files are refused.
+  if (i < len && p[i] != '\0' && p[i] != ' ')
+    valid = false;
+  return value;
+}
+
+esp_err_t TarStream::parse_header()
+{
+  bool empty = true;
+  for (size_t i = 0; i < sizeof(header) && empty; i++)
+    empty = header[i] == 0;
+  if (empty)
+  {
+    // The archive ends with zero blocks; whatever follows is ignored.
+    state = State::DONE;
+    return ESP_OK;
+  }
+
+  // The checksum is taken with its own field read as spaces.
+  uint32_t sum = 8 * ' ';
+  for (size_t i = 0; i < sizeof(header); i++)
+    sum += i >= 148 && i < 156 ? 0 : header[i];
+  bool valid = true;
+  const uint32_t checksum = parse_octal(header + 148, 8, valid);
+  remaining = parse_octal(header + 124, 12, valid);
+  if (!valid || checksum != sum)
+  {
+    ESP_LOGE(TAG, "Invalid tar header");
+    return ESP_ERR_INVALID_ARG;
+  }
+  padding = (512 - remaining % 512) % 512;
+
+  const char type = header[156];
+  regular = type == '0' || type == '\0';
+  if (regular)
+  {
+    // ustar keeps the directories of long paths in a prefix field.
+    char path[155 + 1 + 100 + 1];
+    const char *name = reinterpret_cast<const char *>(header);
+    const char *prefix = reinterpret_cast<const char *>(header + 345);
+    if (memcmp(header + 257, "ustar", 5) == 0 && prefix[0] != '\0')
+      snprintf(path, sizeof(path), "%.155s/%.100s", prefix, name);
+    else
+      snprintf(path, sizeof(path), "%.100s", name);
+    const esp_err_t ret = begin(ctx, path, remaining);
+    if (ret != ESP_OK)
+      return ret;
+  }
+
+  state = State::DATA;
+  if (remaining == 0)
+  {
+    state = State::HEADER;
+    return regular ? end(ctx) : ESP_OK;
+  }
+  return ESP_OK;
+}
+
+esp_err_t TarStream::feed(const uint8_t *data, size_t len)
+{
+  while (len > 0 && state != State::DONE)
+  {
+    size_t n;
+    switch (state)
+    {
+    case State::HEADER:
+    {
+      n = std::min(len, sizeof(header) - header_len);
+      memcpy(header + header_len, data, n);
+      header_len += n;
+      if (header_len == sizeof(header))
+      {
+        header_len = 0;
+        const esp_err_t ret = parse_header();
+        if (ret != ESP_OK)
+          return ret;
+      }
+      break;
+    }
+    case State::DATA:
+    {
+      n = std::min<size_t>(len, remaining);
+      if (regular)
+      {
+        const esp_err_t ret = sink(ctx, data, n);
+        if (ret != ESP_OK)
+          return ret;
+      }
+      remaining -= n;
+      if (remaining == 0)
+      {
+        state = padding > 0 ? State::PADDING : State::HEADER;
+        if (regular)
+        {
+          const esp_err_t ret = end(ctx);
+          if (ret != ESP_OK)
+            return ret;
+        }
+      }
+      break;
+    }
+    default:
+      n = std::min<size_t>(len, padding);
+      padding -= n;
+      if (padding == 0)
+        state = State::HEADER;
+      break;
+    }
+    data += n;
+    len -= n;
+  }
+  return ESP_OK;
+}
+
+esp_err_t TarStream::finish()
+{
+  // Some writers leave out the zero blocks at the end.
+  return state == State::DONE || (state == State::HEADER && header_len == 0) ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+enum class Encoding
+{
+  RAW,
+  MULTIPART,
+  BASE64,
+};
+
+esp_err_t receive_upload(httpd_req_t *req, upload_sink_t sink, void *ctx)
+{
+  char content_type[128] = "";
+  httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type));
+
+  Encoding encoding = Encoding::BASE64;
+  if (strncasecmp(content_type, "application/octet-stream", 24) == 0 || strncasecmp(content_type, "image/", 6) == 0 ||
+      strncasecmp(content_type, "application/x-tar", 17) == 0)
+    encoding = Encoding::RAW;
+  else if (strncasecmp(content_type, "multipart/form-data", 19) == 0)
+    encoding = Encoding::MULTIPART;
+
+  Base64Stream base64(sink, ctx);
+  MultipartStream multipart(sink, ctx);
+  if (encoding == Encoding::MULTIPART && multipart.begin(content_type) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "No boundary in %s", content_type);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  char *buff = static_cast<char *>(malloc(recv_buffer_size));
+  if (buff == nullptr)
+    return ESP_ERR_NO_MEM;
+
+  esp_err_t ret = ESP_OK;
+  size_t remaining = req->content_len;
+  size_t reported = 0;
+  int timeouts = 0;
+  while (ret == ESP_OK && remaining > 0)
+  {
+    const auto len = httpd_req_recv(req, buff, std::min(remaining, recv_buffer_size));
+    if (len == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts <= recv_timeout_retries)
+      continue;
+    if (len == HTTPD_SOCK_ERR_TIMEOUT)
+    {
+      ESP_LOGE(TAG, "Timed out receiving content");
+      ret = ESP_ERR_TIMEOUT;
+      break;
+    }
+    if (len <= 0)
+    {
+      ESP_LOGE(TAG, "Failed to receive content");
+      ret = ESP_FAIL;
+      break;
+    }
+    timeouts = 0;
+    remaining -= len;
+
+    const size_t received = req->content_len - remaining;
+    if (received - reported >= upload_progress_step || remaining == 0)
+    {
+      events_publish("upload", "{\"received\":%u,\"total\":%u}", unsigned(received), unsigned(req->content_len));
+      reported = received;
+    }
+
+    switch (encoding)
+    {
+    case Encoding::RAW:
+      ret = sink(ctx, reinterpret_cast<const uint8_t *>(buff), len);
+      break;
+    case Encoding::MULTIPART:
+      ret = multipart.feed(reinterpret_cast<const uint8_t *>(buff), len);
+      break;
+    case Encoding::BASE64:
+      ret = base64.feed(buff, len);
+      break;
+    }
+  }
+  free(buff);
+
+  if (ret == ESP_OK && encoding == Encoding::MULTIPART)
+    ret = multipart.finish();
+  else if (ret == ESP_OK && encoding == Encoding::BASE64)
+    ret = base64.finish();
+  if (ret == ESP_ERR_INVALID_SIZE)
+    ret = ESP_ERR_INVALID_ARG;
+  return ret;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Receives decoded upload bytes in order. Returning an error stops the upload.
+typedef esp_err_t (*upload_sink_t)(void *ctx, const uint8_t *data, size_t len);
+
+// Decodes base64 text that arrives in pieces of any length, carrying
+// incomplete quads over to the next piece.
+class Base64Stream
+{
+public:
+  Base64Stream(upload_sink_t sink, void *ctx) : sink(sink), ctx(ctx) {}
+
+  esp_err_t feed(const char *data, size_t len);
+  esp_err_t finish();
+
+private:
+  esp_err_t decode(const char *data, size_t len);
+
+  upload_sink_t sink;
+  void *ctx;
+  char carry[4];
+  size_t carry_len = 0;
+  char out[768];
+};
+
+// Extracts the body of the first part of a multipart/form-data stream.
+class MultipartStream
+{
+public:
+  MultipartStream(upload_sink_t sink, void *ctx) : sink(sink), ctx(ctx) {}
+
+  // Takes the Content-Type header value and picks the boundary out of it.
+  esp_err_t begin(const char *content_type);
+  esp_err_t feed(const uint8_t *data, size_t len);
+  esp_err_t finish();
+
+private:
+  enum class State
+  {
+    PREAMBLE,
+    HEADERS,
+    BODY,
+    DONE,
+  };
+
+  esp_err_t scan(const uint8_t *data, size_t len, size_t &used);
+
+  upload_sink_t sink;
+  void *ctx;
+  State state = State::PREAMBLE;
+  std::string delimiter;
+  size_t matched = 0;
+  uint32_t header_tail = 0;
+  size_t header_len = 0;
+};
+
+// Splits a tar archive that arrives in pieces of any length into its
+// regular files: begin gets the path and size of each, sink its content and
+// end is called once it is complete. Directories and other entries are
+// skipped.
+class TarStream
+{
+public:
+  typedef esp_err_t (*begin_t)(void *ctx, const char *path, uint32_t size);
+  typedef esp_err_t (*end_t)(void *ctx);
+
+  TarStream(begin_t begin, upload_sink_t sink, end_t end, void *ctx) : begin(begin), sink(sink), end(end), ctx(ctx) {}
+
+  esp_err_t feed(const uint8_t *data, size_t len);
+  // Returns ESP_ERR_INVALID_SIZE when the archive stopped inside an entry.
+  esp_err_t finish();
+
+private:
+  enum class State
+  {
+    HEADER,
+    DATA,
+    PADDING,
+    DONE,
+  };
+
+  esp_err_t parse_header();
+
+  begin_t begin;
+  upload_sink_t sink;
+  end_t end;
+  void *ctx;
+  State state = State::HEADER;
+  uint8_t header[512];
+  size_t header_len = 0;
+  uint32_t remaining = 0;
+  uint32_t padding = 0;
+  bool regular = false;
+};
+
+// Receives a photo in any of the encodings clients send and passes the file
+// bytes to sink:
+//
+//   application/octet-stream, image/*,
+//   application/x-tar                  the body as is
+//   multipart/form-data                the first part of the form
+//   anything else                      base64 text, as older web apps send
+//
+// Returns ESP_ERR_INVALID_ARG for a malformed body and ESP_ERR_TIMEOUT when
+// the client stops sending.
+esp_err_t receive_upload(httpd_req_t *req, upload_sink_t sink, void *ctx);
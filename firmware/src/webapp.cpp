@@ -1,46 +1,23 @@
-#include <string>
-#include <vector>
-#include <algorithm>
-#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
 #include "lwip/inet.h"
 #include "esp_http_server.h"
 #include "esp_netif.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
-#include "esp_spiffs.h"
 
 #include "api.hpp"
+#include "assets.hpp"
+#include "download.hpp"
+#include "events.hpp"
+#include "jobs.hpp"
+#include "router.hpp"
+#include "session.hpp"
 
 static const char *TAG = "webapp";
 
-#define SPIFFS_ROOT "/spiffs"
-
-esp_err_t mount_spiffs()
-{
-  esp_vfs_spiffs_conf_t conf = {
-      .base_path = SPIFFS_ROOT,
-      .partition_label = nullptr,
-      .max_files = 5,
-      .format_if_mount_failed = false,
-  };
-
-  esp_err_t ret = esp_vfs_spiffs_register(&conf);
-
-  if (ret != ESP_OK)
-  {
-    return ret;
-  }
-
-  size_t total = 0, used = 0;
-  ret = esp_spiffs_info(conf.partition_label, &total, &used);
-  if (ret == ESP_OK)
-  {
-    ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
-  }
-  return ret;
-}
-
 static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
   if (event_id == WIFI_EVENT_AP_STACONNECTED)
@@ -90,91 +67,106 @@ void init_ap(char *ssid, char *password, char *ip_addr)
   ESP_LOGI(TAG, "IP: %s SSID:%s password:%s", ip_addr, wifi_config.ap.ssid, wifi_config.ap.password);
 }
 
-static esp_err_t static_get_handler(httpd_req_t *req)
+static esp_err_t static_get_handler(httpd_req_t *req, const RouteParams &params)
 {
-  std::string filepath = req->uri;
-  filepath = SPIFFS_ROOT + filepath;
-
-  if (req->uri[strlen(req->uri) - 1] == '/')
+  const std::string_view rest = params[0];
+  char path[sizeof(AssetEntry::path)];
+  size_t len = 1 + rest.size();
+  if (len + strlen("index.html") >= sizeof(path))
   {
-    filepath += "index.html";
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found.");
+    return ESP_FAIL;
   }
-
-  std::ifstream ifs(filepath + ".gz", std::ios::in | std::ios::binary);
-  if (ifs)
+  path[0] = '/';
+  memcpy(path + 1, rest.data(), rest.size());
+  if (path[len - 1] == '/')
   {
-    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    memcpy(path + len, "index.html", strlen("index.html"));
+    len += strlen("index.html");
   }
-  else
+  path[len] = '\0';
+
+  const AssetEntry *asset = assets_find(path, len);
+  if (asset == nullptr)
   {
-    ifs.open(filepath, std::ios::in | std::ios::binary);
-    if (!ifs)
-    {
-      ESP_LOGE(TAG, "File not found: %s", filepath.c_str());
-      httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found.");
-      return ESP_FAIL;
-    }
-    httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=604800");
+    ESP_LOGE(TAG, "File not found: %s", path);
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found.");
+    return ESP_FAIL;
   }
 
-  const auto ext = filepath.substr(filepath.find_last_of(".") + 1);
-  if (ext == "html")
-    httpd_resp_set_type(req, "text/html");
-  else if (ext == "js")
-    httpd_resp_set_type(req, "text/javascript");
-  else if (ext == "css")
-    httpd_resp_set_type(req, "text/css");
-  else if (ext == "woff2")
-    httpd_resp_set_type(req, "font/woff2");
-  else if (ext == "png")
-    httpd_resp_set_type(req, "image/png");
-  else
-    httpd_resp_set_type(req, "application/octet-stream");
-
-  char buff[1024];
-  ssize_t read_bytes;
-
-  do
-  {
-    read_bytes = ifs.readsome(buff, sizeof(buff));
-    if (read_bytes == -1)
-    {
-      ESP_LOGE(TAG, "Failed to read file : %s", filepath.c_str());
-    }
-    else if (read_bytes > 0)
-    {
-      if (httpd_resp_send_chunk(req, buff, read_bytes) != ESP_OK)
-      {
-        ESP_LOGE(TAG, "File sending failed: %s", filepath.c_str());
-        httpd_resp_sendstr_chunk(req, nullptr);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
-        return ESP_FAIL;
-      }
-    }
-  } while (read_bytes > 0);
-
-  httpd_resp_send_chunk(req, nullptr, 0);
-  return ESP_OK;
+  // Type, encoding and ETag were all settled when the image was packed.
+  const bool gzip = asset->flags & ASSET_GZIP;
+  Download download = {
+      asset->path, asset->length, asset->etag, asset->type, gzip ? "gzip" : nullptr,
+      gzip ? nullptr : "public, max-age=604800",
+  };
+  download.data = assets_data(*asset);
+  return send_download(req, download);
 }
 
+static constexpr Route routes[] = {
+    {HTTP_GET, "/api/v1/system/info", system_info_get_handler},
+    {HTTP_GET, "/api/v1/system/display", system_display_get_handler},
+    {HTTP_POST, "/api/v1/system/display", system_display_post_handler},
+    {HTTP_POST, "/api/v1/system/display/preview", system_display_preview_post_handler},
+    {HTTP_GET, "/api/v1/system/time", system_time_get_handler},
+    {HTTP_POST, "/api/v1/system/time", system_time_post_handler},
+    {HTTP_GET, "/api/v1/system/metrics", system_metrics_get_handler},
+    {HTTP_POST, "/api/v1/system/reboot", system_reboot_post_handler},
+    {HTTP_GET, "/api/v1/photos", photo_list_get_handler},
+    {HTTP_PATCH, "/api/v1/photos", photo_list_patch_handler},
+    {HTTP_POST, "/api/v1/photos", photo_binary_post_handler},
+    {HTTP_POST, "/api/v1/photos/import", photo_import_post_handler},
+    {HTTP_POST, "/api/v1/photos/preview", photo_preview_binary_post_handler},
+    {HTTP_GET, "/api/v1/photos/*", photo_binary_get_handler},
+    {HTTP_HEAD, "/api/v1/photos/*", photo_binary_get_handler},
+    {HTTP_DELETE, "/api/v1/photos/*", photo_binary_delete_handler},
+    {HTTP_GET, "/api/v1/photos/*/thumbnail", photo_thumbnail_get_handler},
+    {HTTP_HEAD, "/api/v1/photos/*/thumbnail", photo_thumbnail_get_handler},
+    {HTTP_POST, "/api/v1/uploads", upload_session_post_handler},
+    {HTTP_PUT, "/api/v1/uploads/*", upload_session_put_handler},
+    {HTTP_GET, "/api/v1/uploads/*", upload_session_get_handler},
+    {HTTP_DELETE, "/api/v1/uploads/*", upload_session_delete_handler},
+    {HTTP_POST, "/api/v1/uploads/*/commit", upload_session_commit_handler},
+    {HTTP_GET, "/api/v1/jobs/*", job_get_handler},
+    {HTTP_GET, "/api/v1/events", events_get_handler},
+    // Everything else is the web app.
+    {HTTP_GET, "/**", static_get_handler},
+    {HTTP_HEAD, "/**", static_get_handler},
+};
+
+static constexpr auto route_trie = make_route_trie<route_node_bound(routes)>(routes);
+static_assert(route_trie.valid, "malformed or duplicate route");
+static constexpr RouteTable route_table = route_trie.table();
+
 void start_web_server()
 {
   esp_err_t ret;
   httpd_handle_t server = nullptr;
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-  config.max_uri_handlers = 16;
   config.max_open_sockets = 7;
   config.lru_purge_enable = true;
-  config.uri_match_fn = httpd_uri_match_wildcard;
+  // httpd only picks the handler of the method; the routes do the rest.
+  config.uri_match_fn = route_match_all;
 
-  ESP_LOGI(TAG, "Initializing SPIFFS");
-  ret = mount_spiffs();
+  ESP_LOGI(TAG, "Mapping web app");
+  ret = assets_mount();
   if (ret != ESP_OK)
   {
-    ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
+    ESP_LOGE(TAG, "Failed to map web app (%s)", esp_err_to_name(ret));
     return;
   }
 
+  // Nothing is being uploaded yet, so every .part file is left over.
+  upload_session_sweep();
+
+  // Without the worker, requests that hand off work answer 503.
+  ret = jobs_start();
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to start job worker (%s)", esp_err_to_name(ret));
+  }
+
   ESP_LOGI(TAG, "Starting HTTP Server");
   ret = httpd_start(&server, &config);
   if (ret != ESP_OK)
@@ -183,29 +175,14 @@ void start_web_server()
     return;
   };
 
-  // Register APIs
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &system_info_get_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &system_display_get_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &system_display_post_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &system_display_preview_post_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &system_time_get_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &system_time_post_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &photo_list_get_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &photo_list_patch_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &photo_binary_get_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &photo_binary_delete_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &photo_binary_post_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &photo_preview_binary_post_uri));
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &system_reboot_post_uri));
-
-  // Register static file handler
-  httpd_uri_t static_get_uri = {
-      .uri = "/*",
-      .method = HTTP_GET,
-      .handler = static_get_handler,
-      .user_ctx = nullptr,
-  };
-  ESP_ERROR_CHECK(httpd_register_uri_handler(server, &static_get_uri));
+  // Without it the event stream answers 503 and nothing is recorded.
+  ret = events_start(server);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to start events (%s)", esp_err_to_name(ret));
+  }
+
+  ESP_ERROR_CHECK(route_register(server, route_table));
 
   return;
 }
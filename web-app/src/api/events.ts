@@ -0,0 +1,57 @@
+// Progress the device pushes over /api/v1/events, one stream shared by
+// every listener. A listener gets the data of each event of its type, and
+// undefined whenever some may have been missed: each time the stream opens
+// and when the device says it lost events.
+export type Listener<T> = (data: T | undefined) => void;
+
+let source: EventSource | undefined;
+let failed = false;
+const listeners = new Map<string, Set<Listener<any>>>();
+
+function missed() {
+  for (const set of listeners.values()) {
+    set.forEach((listener) => listener(undefined));
+  }
+}
+
+function open() {
+  if (source || failed || typeof EventSource == "undefined") {
+    return source;
+  }
+  source = new EventSource("/api/v1/events");
+  source.onopen = missed;
+  source.onerror = () => {
+    // The browser reconnects a dropped stream by itself. One it gave up on,
+    // like when the device has no slot left, leaves listeners to poll.
+    if (source?.readyState == EventSource.CLOSED) {
+      failed = true;
+      source = undefined;
+      missed();
+    }
+  };
+  source.addEventListener("lost", missed);
+  return source;
+}
+
+// Returns the function that stops listening, or undefined when there are
+// no events to listen to.
+export function subscribe<T>(type: string, listener: Listener<T>) {
+  const events = open();
+  if (!events) {
+    return undefined;
+  }
+  let set = listeners.get(type);
+  if (!set) {
+    const created = new Set<Listener<any>>();
+    events.addEventListener(type, (event) => {
+      const data: T = JSON.parse((event as MessageEvent).data);
+      created.forEach((listener) => listener(data));
+    });
+    listeners.set(type, created);
+    set = created;
+  }
+  set.add(listener);
+  return () => {
+    set!.delete(listener);
+  };
+}
@@ -1,3 +1,4 @@
+import { subscribe } from "./events";
 import { get, patch, post } from "./method";
 
 export interface TimeConfig {
@@ -9,6 +10,7 @@ export interface TimeConfig {
 export interface Display {
   invert: boolean;
   dithering: boolean;
+  algorithm: Algorithm;
   orientation: Orientation;
   padding: {
     top: number;
@@ -18,6 +20,13 @@ export interface Display {
   };
 }
 
+export type Algorithm =
+  | "floyd-steinberg"
+  | "atkinson"
+  | "stucki"
+  | "bayer"
+  | "blue-noise";
+
 export type Orientation =
   | "portrait-right"
   | "upside-down"
@@ -27,10 +36,15 @@ export type Orientation =
 export interface Entry {
   filename: string;
   hidden: boolean;
+  size?: number;
+  width?: number;
+  height?: number;
+  uploaded?: number;
 }
 
 export interface PhotoEntry {
   data: Entry[];
+  next?: string;
 }
 
 export interface Info {
@@ -58,6 +72,123 @@ export interface OperationResult {
   detail?: string;
 }
 
+export interface Job {
+  id: number;
+  type: string;
+  state: "queued" | "running" | "done" | "failed";
+  error?: string;
+}
+
+// Requests that hand their work to the device's job worker answer 202.
+// Resolves once that work has finished, with whether it succeeded; any
+// other response resolves at once. The job's events end the wait as soon
+// as it is over. Polling stands in where there are none and, much slower,
+// catches what the stream may have missed.
+export function settle(res: Response, interval = 500) {
+  const location = res.headers.get("Location");
+  if (res.status != 202 || !location) {
+    return Promise.resolve(res.ok);
+  }
+  const id = Number(location.slice(location.lastIndexOf("/") + 1));
+  return new Promise<boolean>((resolve, reject) => {
+    let settled = false;
+    let timer: ReturnType<typeof setTimeout> | undefined;
+    const end = () => {
+      settled = true;
+      unsubscribe?.();
+      clearTimeout(timer);
+    };
+    const check = (job: Job) => {
+      if (!settled && (job.state == "done" || job.state == "failed")) {
+        end();
+        resolve(job.state == "done");
+      }
+    };
+    const poll = () =>
+      get<Job>(location).then(check, (err) => {
+        if (!settled) {
+          end();
+          reject(err);
+        }
+      });
+    const unsubscribe = subscribe<Job>("job", (job) => {
+      if (!job) {
+        poll();
+      } else if (job.id == id) {
+        check(job);
+      }
+    });
+    const tick = () => {
+      timer = setTimeout(
+        () => poll().then(() => settled || tick()),
+        unsubscribe ? interval * 10 : interval
+      );
+    };
+    // The job may be over before the stream could tell.
+    poll().then(() => settled || tick());
+  });
+}
+
+export interface UploadSession {
+  id: string;
+  size: number;
+  received: [number, number][];
+}
+
+// Sends a photo through an upload session in chunks, so that a dropped
+// connection costs only the chunk it cut off. After a failure the session
+// tells which ranges are still missing. Resolves with the response to the
+// commit.
+export async function uploadPhoto(
+  blob: Blob,
+  chunkSize = 64 * 1024,
+  attempts = 5
+) {
+  const created = await post("/api/v1/uploads", { size: blob.size });
+  if (!created.ok) {
+    return created;
+  }
+  const location = created.headers.get("Location")!;
+  let session: UploadSession = await created.json();
+  for (let attempt = 0; ; attempt++) {
+    const missing: [number, number][] = [];
+    let offset = 0;
+    for (const [first, last] of session.received) {
+      if (offset < first) {
+        missing.push([offset, first]);
+      }
+      offset = last;
+    }
+    if (offset < session.size) {
+      missing.push([offset, session.size]);
+    }
+    if (missing.length == 0) {
+      return fetch(`${location}/commit`, { method: "POST" });
+    }
+    if (attempt == attempts) {
+      return Promise.reject(new Error("upload failed"));
+    }
+    try {
+      for (const [first, last] of missing) {
+        for (let start = first; start < last; start += chunkSize) {
+          const end = Math.min(start + chunkSize, last);
+          const res = await fetch(`${location}?offset=${start}`, {
+            method: "PUT",
+            headers: [["Content-Type", "application/octet-stream"]],
+            body: blob.slice(start, end),
+          });
+          if (!res.ok) {
+            throw new Error(`chunk at ${start} failed`);
+          }
+        }
+      }
+    } catch {
+      // Ask the device what made it and send the rest.
+    }
+    session = await get<UploadSession>(location).catch(() => session);
+  }
+}
+
 type DeepPartial<T> = {
   [P in keyof T]?: DeepPartial<T[P]>;
 };
@@ -78,6 +209,30 @@ function API<T extends { [key in string]: any }>(path: string) {
   };
 }
 
+// Fetches the photo list a page at a time, handing each page over as soon
+// as it arrives.
+export async function listPhotos(
+  onPage: (entries: Entry[]) => void,
+  limit = 50
+) {
+  let after: string | undefined;
+  do {
+    const query = new URLSearchParams({ limit: limit.toString() });
+    if (after) {
+      query.set("after", after);
+    }
+    const page = await get<PhotoEntry>(`/api/v1/photos?${query}`);
+    onPage(page.data);
+    after = page.next;
+  } while (after);
+}
+
+// Browsers cannot show .ink photos, so their thumbnail stands in for them.
+export function photoSource(filename: string) {
+  const photo = `/api/v1/photos/${filename}`;
+  return filename.endsWith(".ink") ? `${photo}/thumbnail` : photo;
+}
+
 export default {
   config: API<TimeConfig>("/api/v1/system/time"),
   display: API<Display>("/api/v1/system/display"),
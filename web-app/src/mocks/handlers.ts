@@ -1,13 +1,15 @@
 import { rest, type DefaultRequestBody } from "msw";
-import type { ResponseComposition, RestContext } from "msw";
+import type { ResponseComposition, RestContext, RestRequest } from "msw";
 import { openPhotoDatabase } from "./db";
 import type {
   PhotoEntry,
+  Algorithm,
   Display,
   Orientation,
   TimeConfig,
   Info,
   OperationResult,
+  UploadSession,
 } from "../api";
 
 function handle500ErrorResponse(res: ResponseComposition, ctx: RestContext) {
@@ -23,7 +25,111 @@ function handle500ErrorResponse(res: ResponseComposition, ctx: RestContext) {
   };
 }
 
+// The mock serves the photo itself as its thumbnail; the browser scales it.
+function getPhoto(
+  req: RestRequest<DefaultRequestBody, { filename: string }>,
+  res: ResponseComposition,
+  ctx: RestContext
+) {
+  return openPhotoDatabase("readonly")
+    .then(({ photo, close }) =>
+      photo.get(req.params.filename).finally(close)
+    )
+    .then(async ({ target: { result: data } }) => {
+      if (!data) {
+        return res(ctx.status(404), ctx.body(""));
+      }
+      const file = data as File;
+      const buffer = await new Promise<ArrayBuffer>((resolve, reject) => {
+        const fr = new FileReader();
+        fr.onload = () => resolve(fr.result as ArrayBuffer);
+        fr.onerror = () => reject(fr.error);
+        fr.readAsArrayBuffer(file);
+      });
+      return res(
+        ctx.status(200),
+        ctx.set("Content-Length", buffer.byteLength.toString()),
+        ctx.set("Content-Type", "image/bmp"),
+        ctx.body(buffer)
+      );
+    })
+    .catch(handle500ErrorResponse(res, ctx));
+}
+
+// Upload sessions of the mock keep their chunks in memory until commit.
+const uploads = new Map<
+  string,
+  { session: UploadSession; chunks: Map<number, DefaultRequestBody> }
+>();
+
+function addRange(session: UploadSession, first: number, last: number) {
+  const ranges = [...session.received, [first, last] as [number, number]];
+  ranges.sort((a, b) => a[0] - b[0]);
+  session.received = ranges.reduce<[number, number][]>((merged, range) => {
+    const prev = merged[merged.length - 1];
+    if (prev && range[0] <= prev[1]) {
+      prev[1] = Math.max(prev[1], range[1]);
+    } else {
+      merged.push([range[0], range[1]]);
+    }
+    return merged;
+  }, []);
+}
+
 export const handlers = [
+  rest.post<{ size: number }>("/api/v1/uploads", (req, res, ctx) => {
+    const id = Math.floor(Math.random() * 0xffffffff)
+      .toString(16)
+      .padStart(8, "0");
+    const session: UploadSession = { id, size: req.body.size, received: [] };
+    uploads.set(id, { session, chunks: new Map() });
+    return res(
+      ctx.status(201),
+      ctx.set("Location", `/api/v1/uploads/${id}`),
+      ctx.json<UploadSession>(session)
+    );
+  }),
+  rest.put("/api/v1/uploads/:id", (req, res, ctx) => {
+    const upload = uploads.get(req.params.id as string);
+    if (!upload) {
+      return res(ctx.status(404));
+    }
+    const offset = parseInt(req.url.searchParams.get("offset") ?? "0");
+    const length = new Blob([req.body as BlobPart]).size;
+    upload.chunks.set(offset, req.body);
+    addRange(upload.session, offset, offset + length);
+    return res(ctx.status(200), ctx.json<UploadSession>(upload.session));
+  }),
+  rest.get("/api/v1/uploads/:id", (req, res, ctx) => {
+    const upload = uploads.get(req.params.id as string);
+    if (!upload) {
+      return res(ctx.status(404));
+    }
+    return res(ctx.status(200), ctx.json<UploadSession>(upload.session));
+  }),
+  rest.post("/api/v1/uploads/:id/commit", (req, res, ctx) => {
+    const upload = uploads.get(req.params.id as string);
+    if (!upload) {
+      return res(ctx.status(404));
+    }
+    uploads.delete(req.params.id as string);
+    const parts = [...upload.chunks.entries()]
+      .sort(([a], [b]) => a - b)
+      .map(([, chunk]) => chunk as BlobPart);
+    const file = new File(parts, `image-${Date.now()}.bmp`, {
+      type: "image/bmp",
+    });
+    return openPhotoDatabase("readwrite")
+      .then(async ({ photo, close }) => photo.add(file).finally(close))
+      .then(() =>
+        res(
+          ctx.delay(3000),
+          ctx.status(200),
+          ctx.json<OperationResult>({ status: "succeeded" })
+        )
+      )
+      .catch(handle500ErrorResponse(res, ctx));
+  }),
   rest.post<string>("/api/v1/photos", async (req, res, ctx) => {
     if (!req.body) {
       return res(
@@ -34,9 +140,12 @@ export const handlers = [
         })
       );
     }
-    const blob = await fetch(`data:image/bmp;base64,` + req.body).then(
-      (response) => response.blob()
-    );
+    // Older clients send the file base64 encoded as text.
+    const blob = req.headers.get("Content-Type")?.startsWith("image/")
+      ? new Blob([req.body], { type: "image/bmp" })
+      : await fetch(`data:image/bmp;base64,` + req.body).then((response) =>
+          response.blob()
+        );
     const file = new File([blob], `image-${Date.now()}.bmp`);
     return openPhotoDatabase("readwrite")
       .then(async ({ photo, close }) => photo.add(file).finally(close))
@@ -49,7 +158,9 @@ export const handlers = [
       )
       .catch(handle500ErrorResponse(res, ctx));
   }),
-  rest.get("/api/v1/photos", (_req, res, ctx) => {
+  rest.get("/api/v1/photos", (req, res, ctx) => {
+    const limit = parseInt(req.url.searchParams.get("limit") ?? "0") || 0;
+    const after = req.url.searchParams.get("after") ?? "";
     return openPhotoDatabase("readonly")
       .then(({ photo, hidden, close }) =>
         Promise.all([photo.getAll(), hidden.getAll()])
@@ -58,47 +169,31 @@ export const handlers = [
             const hiddenList = new Set(
               hiddens.target.result.map((item) => item.name)
             );
-            const filelist = (photos.target.result ?? []).map((file) => ({
-              filename: file.name,
-              hidden: hiddenList.has(file.name),
-            }));
+            const filelist = (photos.target.result ?? [])
+              .map((file: File) => ({
+                filename: file.name,
+                hidden: hiddenList.has(file.name),
+                size: file.size,
+                uploaded: Math.floor(file.lastModified / 1000),
+              }))
+              .filter((entry) => entry.filename > after)
+              .sort((a, b) => (a.filename < b.filename ? -1 : 1));
+            const data = limit ? filelist.slice(0, limit) : filelist;
+            const next =
+              data.length < filelist.length
+                ? data[data.length - 1].filename
+                : undefined;
             return res(
               ctx.delay(2000),
               ctx.status(200),
-              ctx.json<PhotoEntry>({ data: filelist })
+              ctx.json<PhotoEntry>({ data, next })
             );
           })
       )
       .catch(handle500ErrorResponse(res, ctx));
   }),
-  rest.get<DefaultRequestBody, { filename: string }>(
-    "/api/v1/photos/:filename",
-    (req, res, ctx) => {
-      return openPhotoDatabase("readonly")
-        .then(({ photo, close }) =>
-          photo.get(req.params.filename).finally(close)
-        )
-        .then(async ({ target: { result: data } }) => {
-          if (!data) {
-            return res(ctx.status(404), ctx.body(""));
-          }
-          const file = data as File;
-          const buffer = await new Promise<ArrayBuffer>((resolve, reject) => {
-            const fr = new FileReader();
-            fr.onload = () => resolve(fr.result as ArrayBuffer);
-            fr.onerror = () => reject(fr.error);
-            fr.readAsArrayBuffer(file);
-          });
-          return res(
-            ctx.status(200),
-            ctx.set("Content-Length", buffer.byteLength.toString()),
-            ctx.set("Content-Type", "image/bmp"),
-            ctx.body(buffer)
-          );
-        })
-        .catch(handle500ErrorResponse(res, ctx));
-    }
-  ),
+  rest.get("/api/v1/photos/:filename", getPhoto),
+  rest.get("/api/v1/photos/:filename/thumbnail", getPhoto),
   rest.delete<DefaultRequestBody, { filename: string }>(
     "/api/v1/photos/:filename",
     (req, res, ctx) => {
@@ -127,30 +222,32 @@ export const handlers = [
     }
   ),
   rest.patch<PhotoEntry>("/api/v1/photos", (req, res, ctx) => {
-    const [{ hidden: hide, filename }] = req.body.data;
+    const entries = req.body.data;
     return openPhotoDatabase("readwrite")
       .then(({ photo, hidden, close }) =>
-        photo
-          .get(filename)
-          .then(({ target: { result: data } }) => {
-            if (!data) {
+        Promise.all(entries.map(({ filename }) => photo.get(filename))).then(
+          (found) => {
+            if (found.some(({ target: { result } }) => !result)) {
+              close();
               return res(
                 ctx.status(404),
                 ctx.json<OperationResult>({ status: "failed" })
               );
             }
-            const request = hide
-              ? hidden.add({ name: filename })
-              : hidden.delete(filename);
-
-            return request.finally(close) as Promise<any>;
-          })
-          .then(() =>
-            res(
-              ctx.status(200),
-              ctx.json<OperationResult>({ status: "succeeded" })
+            return Promise.all(
+              entries.map(({ hidden: hide, filename }) =>
+                hide ? hidden.add({ name: filename }) : hidden.delete(filename)
+              )
             )
-          )
+              .finally(close)
+              .then(() =>
+                res(
+                  ctx.status(200),
+                  ctx.json<OperationResult>({ status: "succeeded" })
+                )
+              );
+          }
+        )
       )
       .catch(handle500ErrorResponse(res, ctx));
   }),
@@ -173,6 +270,9 @@ export const handlers = [
   rest.get("/api/v1/system/display", (_req, res, ctx) => {
     const invert = sessionStorage.getItem("invert") == "true";
     const dithering = sessionStorage.getItem("dithering") == "true";
+    const algorithm =
+      (sessionStorage.getItem("algorithm") as Algorithm | null) ??
+      "floyd-steinberg";
     const orientation =
       (sessionStorage.getItem("orientation") as Orientation | null) ??
       "landscape";
@@ -185,6 +285,7 @@ export const handlers = [
       ctx.json<Display>({
         invert,
         dithering,
+        algorithm,
         orientation,
         padding: { top, left, right, bottom },
       })
@@ -193,10 +294,14 @@ export const handlers = [
   rest.post<Display>("/api/v1/system/display", (req, res, ctx) => {
     const {
       invert,
+      dithering,
+      algorithm,
       orientation,
       padding: { top, left, right, bottom },
     } = req.body;
     sessionStorage.setItem("invert", invert.toString());
+    sessionStorage.setItem("dithering", dithering.toString());
+    sessionStorage.setItem("algorithm", algorithm);
     sessionStorage.setItem("orientation", orientation);
     sessionStorage.setItem("paddingTop", top.toString(10));
     sessionStorage.setItem("paddingLeft", left.toString(10));